@@ -98,6 +98,11 @@ bool App::HandleInput(float dt) {
         pause_ = !pause_;
     }
 
+    if (keyboard.IsJustKeyDown(Keyboard::F9)) {
+        Profiler::Instance()->DumpJson("profile.json");
+        Profiler::Instance()->DumpCsv("profile.csv");
+    }
+
     if (keyboard.IsJustKeyDown(Keyboard::F11)) {
         wnd_->ToogleFullScreen();
     }
@@ -147,6 +152,7 @@ void App::DoFrame(float dt) {
     
 
     Input::Instance()->EndFrame();
+    Profiler::Instance()->EndFrame();
 
     //job1.WaitComplete();
     //job2.WaitComplete();
@@ -0,0 +1,319 @@
+#include "Bench.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <atomic>
+#include <thread>
+#include <algorithm>
+#include "Common/Log.h"
+#include "Concurrent/CpuTopology.h"
+#include "Jobs/JobSystem.h"
+
+namespace glacier {
+namespace bench {
+
+namespace {
+
+struct SuiteEntry {
+    const char* name;
+    BenchSuite run;
+};
+
+const SuiteEntry kSuites[] = {
+    { "jobs", RunJobBench },
+    { "physics", RunPhysicsBench },
+};
+
+std::atomic<uint32_t> bench_sink = 0;
+
+void AppendJsonString(std::string& json, const char* str) {
+    json += '"';
+    for (; *str; ++str) {
+        char c = *str;
+        if (c == '"' || c == '\\') {
+            json += '\\';
+            json += c;
+        }
+        else if ((unsigned char)c >= 0x20) {
+            json += c;
+        }
+    }
+    json += '"';
+}
+
+void AppendJsonNumber(std::string& json, double value) {
+    char buf[64];
+    if (isfinite(value)) {
+        snprintf(buf, sizeof(buf), "%.6g", value);
+    }
+    else {
+        snprintf(buf, sizeof(buf), "null");
+    }
+
+    json += buf;
+}
+
+double GetPercentile(const std::vector<double>& sorted, double percentile) {
+    size_t index = (size_t)(percentile * (sorted.size() - 1) + 0.5);
+    return sorted[std::min(index, sorted.size() - 1)];
+}
+
+const char* GetBuildName() {
+#ifdef NDEBUG
+    return "release";
+#else
+    return "debug";
+#endif
+}
+
+}
+
+void BenchReport::SetMeta(const char* key, const char* value) {
+    std::string json;
+    AppendJsonString(json, value);
+    meta_.emplace_back(key, json);
+}
+
+void BenchReport::SetMeta(const char* key, double value) {
+    std::string json;
+    AppendJsonNumber(json, value);
+    meta_.emplace_back(key, json);
+}
+
+void BenchReport::Add(const char* name, std::initializer_list<BenchValue> values) {
+    Record record{ name };
+    for (auto& value : values) {
+        record.values.emplace_back(value.key, value.value);
+    }
+
+    records_.push_back(std::move(record));
+}
+
+void BenchReport::Add(const char* name, const std::vector<BenchValue>& values) {
+    Record record{ name };
+    for (auto& value : values) {
+        record.values.emplace_back(value.key, value.value);
+    }
+
+    records_.push_back(std::move(record));
+}
+
+void BenchReport::Add(const char* name, const char* prefix, const SampleStats& stats,
+    std::initializer_list<BenchValue> values)
+{
+    Record record{ name };
+    for (auto& value : values) {
+        record.values.emplace_back(value.key, value.value);
+    }
+
+    std::string p = prefix;
+    record.values.emplace_back(p + "_mean", stats.mean);
+    record.values.emplace_back(p + "_stddev", stats.stddev);
+    record.values.emplace_back(p + "_min", stats.min);
+    record.values.emplace_back(p + "_p50", stats.p50);
+    record.values.emplace_back(p + "_p95", stats.p95);
+    record.values.emplace_back(p + "_p99", stats.p99);
+    record.values.emplace_back(p + "_max", stats.max);
+
+    records_.push_back(std::move(record));
+}
+
+std::string BenchReport::ToJson() const {
+    std::string json = "{\n  \"meta\": {";
+    for (size_t i = 0; i < meta_.size(); ++i) {
+        json += i > 0 ? ", " : "";
+        AppendJsonString(json, meta_[i].first.c_str());
+        json += ": ";
+        json += meta_[i].second;
+    }
+
+    json += "},\n  \"results\": [\n";
+    for (size_t i = 0; i < records_.size(); ++i) {
+        auto& record = records_[i];
+        json += "    {\"name\": ";
+        AppendJsonString(json, record.name.c_str());
+        for (auto& value : record.values) {
+            json += ", ";
+            AppendJsonString(json, value.first.c_str());
+            json += ": ";
+            AppendJsonNumber(json, value.second);
+        }
+
+        json += i + 1 < records_.size() ? "},\n" : "}\n";
+    }
+
+    json += "  ]\n}\n";
+    return json;
+}
+
+bool BenchReport::Save(const char* path) const {
+    std::string json = ToJson();
+
+    FILE* file = fopen(path, "wb");
+    if (!file) {
+        return false;
+    }
+
+    bool result = fwrite(json.data(), 1, json.size(), file) == json.size();
+    fclose(file);
+
+    return result;
+}
+
+void BenchReport::Print() const {
+    for (auto& record : records_) {
+        std::string line = record.name;
+        for (auto& value : record.values) {
+            char buf[96];
+            snprintf(buf, sizeof(buf), " %s=%.4g", value.first.c_str(), value.second);
+            line += buf;
+        }
+
+        LOG_LOG("{}", line);
+    }
+}
+
+SampleStats ComputeStats(std::vector<double>& samples) {
+    SampleStats stats = {};
+    if (samples.empty()) {
+        return stats;
+    }
+
+    std::sort(samples.begin(), samples.end());
+
+    double sum = 0.0;
+    for (double sample : samples) {
+        sum += sample;
+    }
+
+    stats.mean = sum / samples.size();
+
+    double variance = 0.0;
+    for (double sample : samples) {
+        variance += (sample - stats.mean) * (sample - stats.mean);
+    }
+
+    stats.stddev = sqrt(variance / samples.size());
+    stats.min = samples.front();
+    stats.p50 = GetPercentile(samples, 0.50);
+    stats.p95 = GetPercentile(samples, 0.95);
+    stats.p99 = GetPercentile(samples, 0.99);
+    stats.max = samples.back();
+
+    return stats;
+}
+
+uint32_t SpinWork(uint32_t iterations, uint32_t seed) {
+    uint32_t x = seed | 1;
+    for (uint32_t i = 0; i < iterations; ++i) {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+    }
+
+    return x;
+}
+
+void Consume(uint32_t value) {
+    bench_sink.fetch_xor(value, std::memory_order_relaxed);
+}
+
+bool ParseBenchOptions(const char* cmd_line, BenchOptions& options) {
+    if (!cmd_line) {
+        return false;
+    }
+
+    std::vector<std::string> args;
+    for (const char* p = cmd_line; *p;) {
+        while (*p == ' ' || *p == '\t') ++p;
+        if (!*p) break;
+
+        std::string arg;
+        if (*p == '"') {
+            for (++p; *p && *p != '"'; ++p) arg += *p;
+            if (*p) ++p;
+        }
+        else {
+            for (; *p && *p != ' ' && *p != '\t'; ++p) arg += *p;
+        }
+
+        args.push_back(std::move(arg));
+    }
+
+    auto it = std::find(args.begin(), args.end(), "-bench");
+    if (it == args.end()) {
+        return false;
+    }
+
+    for (++it; it != args.end(); ++it) {
+        if (*it == "-threads" && it + 1 != args.end()) {
+            options.thread_count = (uint32_t)strtoul((++it)->c_str(), nullptr, 10);
+        }
+        else if (*it == "-out" && it + 1 != args.end()) {
+            options.output = *++it;
+        }
+        else if (*it == "-unpinned") {
+            options.pin = false;
+        }
+        else if ((*it)[0] != '-') {
+            options.suite = *it;
+        }
+    }
+
+    return true;
+}
+
+int RunBench(const BenchOptions& options) {
+    auto& topology = concurrent::CpuTopology::Get();
+
+    //the default policy without a count: a worker per performance core but the caller's,
+    //an explicit count may go past them
+    jobs::JobThreadPolicy thread_policy;
+    thread_policy.affinity.pin = options.pin;
+    uint32_t thread_count = options.thread_count;
+    if (thread_count == 0) {
+        thread_count = (uint32_t)topology.GetCpus(concurrent::CoreSet::kPerformance).size();
+    }
+    else {
+        thread_policy.affinity.cores = concurrent::CoreSet::kAll;
+    }
+
+    auto job_system = jobs::JobSystem::Instance();
+    job_system->Initialize(thread_count, {}, {}, thread_policy);
+
+    BenchReport report;
+    report.SetMeta("build", GetBuildName());
+    report.SetMeta("suite", options.suite.c_str());
+    report.SetMeta("thread_count", job_system->GetThreadCount());
+    report.SetMeta("pinned", options.pin ? 1.0 : 0.0);
+    report.SetMeta("cpu_count", (double)topology.GetLogicalCount());
+    report.SetMeta("core_count", (double)topology.GetCoreCount());
+
+    bool found = false;
+    for (auto& suite : kSuites) {
+        if (options.suite == "all" || options.suite == suite.name) {
+            LOG_LOG("bench suite {}", suite.name);
+            suite.run(options, report);
+            found = true;
+        }
+    }
+
+    job_system->WaitUntilFinish();
+
+    if (!found) {
+        LOG_ERR("unknown bench suite {}", options.suite);
+        return 1;
+    }
+
+    report.Print();
+    if (!report.Save(options.output.c_str())) {
+        LOG_ERR("failed to write bench report {}", options.output);
+        return 1;
+    }
+
+    return 0;
+}
+
+}
+}
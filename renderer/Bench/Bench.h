@@ -0,0 +1,85 @@
+#pragma once
+
+#include <stdint.h>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <utility>
+#include <initializer_list>
+
+namespace glacier {
+namespace bench {
+
+struct BenchOptions {
+    std::string suite = "all";
+    uint32_t thread_count = 0; //0: one worker per performance core
+    bool pin = true;
+    std::string output = "bench.json";
+};
+
+struct BenchValue {
+    const char* key;
+    double value;
+};
+
+struct SampleStats {
+    double mean;
+    double stddev;
+    double min;
+    double p50;
+    double p95;
+    double p99;
+    double max;
+};
+
+//Flat records written as json, so that runs of different builds can be diffed
+class BenchReport {
+public:
+    void SetMeta(const char* key, const char* value);
+    void SetMeta(const char* key, double value);
+
+    void Add(const char* name, std::initializer_list<BenchValue> values);
+    void Add(const char* name, const std::vector<BenchValue>& values);
+    //mean, stddev, min, p50, p95, p99 and max of the samples, prefixed by prefix
+    void Add(const char* name, const char* prefix, const SampleStats& stats,
+        std::initializer_list<BenchValue> values = {});
+
+    std::string ToJson() const;
+    bool Save(const char* path) const;
+    void Print() const;
+
+private:
+    struct Record {
+        std::string name;
+        std::vector<std::pair<std::string, double>> values;
+    };
+
+    std::vector<std::pair<std::string, std::string>> meta_; //json encoded values
+    std::vector<Record> records_;
+};
+
+using BenchSuite = void(*)(const BenchOptions& options, BenchReport& report);
+
+inline int64_t GetBenchTime() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+//sorts samples
+SampleStats ComputeStats(std::vector<double>& samples);
+
+//Busy work the optimizer can't drop, about a ns per iteration
+uint32_t SpinWork(uint32_t iterations, uint32_t seed);
+void Consume(uint32_t value);
+
+//"-bench [suite] [-threads n] [-unpinned] [-out path]", false without -bench
+bool ParseBenchOptions(const char* cmd_line, BenchOptions& options);
+
+//Run the suites matching options.suite headless and save the report, returns the process exit code
+int RunBench(const BenchOptions& options);
+
+void RunJobBench(const BenchOptions& options, BenchReport& report);
+void RunPhysicsBench(const BenchOptions& options, BenchReport& report);
+
+}
+}
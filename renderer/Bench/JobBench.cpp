@@ -0,0 +1,659 @@
+#include "Bench.h"
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include "Jobs/Fiber.h"
+#include "Jobs/JobSystem.h"
+#include "Concurrent/SpinLock.h"
+#include "Concurrent/RingBuffer.h"
+#include "Concurrent/MPMCRingBuffer.h"
+#include "Concurrent/SPSCRingBuffer.h"
+#include "Concurrent/MPSCQueue.h"
+#include "Concurrent/ThreadSafeQueue.h"
+#include "Concurrent/ThreadJobSystem.h"
+
+namespace glacier {
+namespace bench {
+
+namespace {
+
+using jobs::JobHandle;
+using jobs::JobSystem;
+
+constexpr uint32_t kEmptyJobCount = 4096;
+constexpr uint32_t kRepeat = 8;
+constexpr uint32_t kWorkLeaf = 2000;
+
+double ToMs(int64_t ns) { return ns / 1e6; }
+
+JobHandle Join(JobSystem* job_system, const std::vector<JobHandle>& handles) {
+    return job_system->Schedule({}, handles.data(), (uint32_t)handles.size());
+}
+
+//Round trip between two fibers of one thread
+void BenchFiberSwitch(BenchReport& report) {
+    constexpr uint32_t kSwitchCount = 200000;
+    int64_t duration = 0;
+
+    //on its own thread, the calling one may already be a fiber
+    std::thread thread([&duration]() {
+        jobs::Fiber thread_fiber;
+        jobs::Fiber other;
+        thread_fiber.InitFromThread();
+        other.Init([&thread_fiber](void*) {
+            while (true) {
+                thread_fiber.SwitchTo();
+            }
+        }, nullptr, 64 * 1024);
+
+        other.SwitchTo(); //warm up
+        int64_t begin = GetBenchTime();
+        for (uint32_t i = 0; i < kSwitchCount; ++i) {
+            other.SwitchTo();
+        }
+
+        duration = GetBenchTime() - begin;
+
+        other.Release();
+        thread_fiber.ReleaseThread();
+    });
+
+    thread.join();
+    report.Add("fiber_switch", { { "switch_ns", duration / (2.0 * kSwitchCount) } });
+}
+
+//A job waiting on an empty child: suspend, run the child elsewhere, resume
+void BenchWaitSwitch(JobSystem* job_system, BenchReport& report) {
+    constexpr uint32_t kWaitCount = 10000;
+    int64_t duration = 0;
+
+    auto handle = job_system->Schedule([job_system, &duration]() {
+        int64_t begin = GetBenchTime();
+        for (uint32_t i = 0; i < kWaitCount; ++i) {
+            auto child = job_system->Schedule([]() {});
+            job_system->WaitComplete(child);
+        }
+
+        duration = GetBenchTime() - begin;
+    });
+
+    job_system->WaitComplete(handle);
+    report.Add("job_wait_switch", { { "wait_ns", (double)duration / kWaitCount } });
+}
+
+//Schedule empty jobs and retire them, from the main thread and from a job
+void BenchEmptyJobs(JobSystem* job_system, BenchReport& report) {
+    std::vector<JobHandle> handles(kEmptyJobCount);
+
+    int64_t schedule_time = 0;
+    int64_t best = INT64_MAX;
+    for (uint32_t r = 0; r < kRepeat; ++r) {
+        int64_t begin = GetBenchTime();
+        for (auto& handle : handles) {
+            handle = job_system->Schedule([]() {});
+        }
+
+        int64_t scheduled = GetBenchTime();
+        job_system->WaitComplete(Join(job_system, handles));
+
+        int64_t end = GetBenchTime();
+        schedule_time += scheduled - begin;
+        best = std::min(best, end - begin);
+    }
+
+    report.Add("empty_jobs_main", {
+        { "job_count", kEmptyJobCount },
+        { "jobs_per_sec", kEmptyJobCount / (best / 1e9) },
+        { "schedule_ns", (double)schedule_time / (kRepeat * kEmptyJobCount) },
+        { "schedule_complete_ns", (double)best / kEmptyJobCount },
+    });
+
+    best = INT64_MAX;
+    for (uint32_t r = 0; r < kRepeat; ++r) {
+        int64_t begin = GetBenchTime();
+        auto root = job_system->Schedule([job_system, &handles]() {
+            for (auto& handle : handles) {
+                handle = job_system->Schedule([]() {});
+            }
+
+            job_system->WaitComplete(Join(job_system, handles));
+        });
+
+        job_system->WaitComplete(root);
+        best = std::min(best, GetBenchTime() - begin);
+    }
+
+    report.Add("empty_jobs_worker", {
+        { "job_count", kEmptyJobCount },
+        { "jobs_per_sec", kEmptyJobCount / (best / 1e9) },
+        { "schedule_complete_ns", (double)best / kEmptyJobCount },
+    });
+}
+
+//Time from Schedule to the job starting, workers idle (parked) or kept busy
+void BenchScheduleLatency(JobSystem* job_system, BenchReport& report) {
+    constexpr uint32_t kSampleCount = 2000;
+    std::vector<double> latency(kSampleCount);
+    std::vector<double> round_trip(kSampleCount);
+
+    for (uint32_t i = 0; i < kSampleCount; ++i) {
+        std::atomic<int64_t> start = 0;
+        int64_t begin = GetBenchTime();
+        auto handle = job_system->Schedule([&start]() {
+            start.store(GetBenchTime(), std::memory_order_relaxed);
+        });
+
+        job_system->WaitComplete(handle);
+        int64_t end = GetBenchTime();
+
+        latency[i] = (start.load(std::memory_order_relaxed) - begin) / 1e3;
+        round_trip[i] = (end - begin) / 1e3;
+
+        //let the workers park again
+        if ((i & 15) == 0) {
+            std::this_thread::sleep_for(std::chrono::microseconds(200));
+        }
+    }
+
+    report.Add("schedule_latency_idle", "us", ComputeStats(latency));
+    report.Add("schedule_round_trip_idle", "us", ComputeStats(round_trip));
+
+    //all workers but one spin through long jobs, the sample competes with them for the last one
+    if (job_system->GetThreadCount() < 2) {
+        return;
+    }
+
+    std::atomic_bool stop = false;
+    std::vector<JobHandle> background(job_system->GetThreadCount() - 1);
+    for (auto& handle : background) {
+        handle = job_system->Schedule([&stop]() {
+            while (!stop.load(std::memory_order_relaxed)) {
+                Consume(SpinWork(1000, 7));
+            }
+        }, jobs::JobPriority::kLow);
+    }
+
+    for (uint32_t i = 0; i < kSampleCount; ++i) {
+        std::atomic<int64_t> start = 0;
+        int64_t begin = GetBenchTime();
+        auto handle = job_system->Schedule([&start]() {
+            start.store(GetBenchTime(), std::memory_order_relaxed);
+        }, jobs::JobPriority::kHigh);
+
+        job_system->WaitComplete(handle);
+        latency[i] = (start.load(std::memory_order_relaxed) - begin) / 1e3;
+    }
+
+    stop.store(true, std::memory_order_relaxed);
+    job_system->WaitComplete(Join(job_system, background));
+
+    report.Add("schedule_latency_busy", "us", ComputeStats(latency));
+}
+
+//ParallelFor over balanced and imbalanced work, the grain limits how many chunks can run
+//at once: width 1..N shows the scaling with the worker count of one process
+void BenchParallelFor(JobSystem* job_system, BenchReport& report) {
+    constexpr uint32_t kCount = 1 << 16;
+    constexpr uint32_t kWork = 64;
+
+    uint32_t max_width = job_system->GetThreadCount();
+    std::vector<uint32_t> widths;
+    for (uint32_t width = 1; width < max_width; width *= 2) {
+        widths.push_back(width);
+    }
+    widths.push_back(max_width);
+
+    struct Workload {
+        const char* name;
+        uint32_t (*cost)(uint32_t i);
+    };
+
+    const Workload workloads[] = {
+        { "parallel_for_balanced", [](uint32_t) { return kWork; } },
+        //the last eighth of the range costs 16x, a static split leaves most workers idle
+        { "parallel_for_imbalanced", [](uint32_t i) { return i >= kCount / 8 * 7 ? kWork * 16 : kWork / 2; } },
+    };
+
+    for (auto& workload : workloads) {
+        auto cost = workload.cost;
+        double base_ms = 0.0;
+
+        for (uint32_t width : widths) {
+            uint32_t grain = (kCount + width - 1) / width;
+            int64_t best = INT64_MAX;
+
+            for (uint32_t r = 0; r < kRepeat; ++r) {
+                int64_t begin = GetBenchTime();
+                auto handle = job_system->ParallelFor([cost](uint32_t begin, uint32_t end) {
+                    uint32_t value = 0;
+                    for (uint32_t i = begin; i < end; ++i) {
+                        value ^= SpinWork(cost(i), i);
+                    }
+
+                    Consume(value);
+                }, kCount, grain);
+
+                job_system->WaitComplete(handle);
+                best = std::min(best, GetBenchTime() - begin);
+            }
+
+            double ms = ToMs(best);
+            if (width == 1) {
+                base_ms = ms;
+            }
+
+            report.Add(workload.name, {
+                { "width", (double)width },
+                { "ms", ms },
+                { "speedup", base_ms / ms },
+            });
+        }
+
+        //fine grained, the way it is used in the frame
+        int64_t best = INT64_MAX;
+        for (uint32_t r = 0; r < kRepeat; ++r) {
+            int64_t begin = GetBenchTime();
+            auto handle = job_system->ParallelFor([cost](uint32_t begin, uint32_t end) {
+                uint32_t value = 0;
+                for (uint32_t i = begin; i < end; ++i) {
+                    value ^= SpinWork(cost(i), i);
+                }
+
+                Consume(value);
+            }, kCount, 64);
+
+            job_system->WaitComplete(handle);
+            best = std::min(best, GetBenchTime() - begin);
+        }
+
+        std::string name = workload.name;
+        name += "_adaptive";
+        report.Add(name.c_str(), { { "grain", 64 }, { "ms", ToMs(best) }, { "speedup", base_ms / ToMs(best) } });
+    }
+}
+
+//Every job waits on the previous one
+void BenchDependencyChain(JobSystem* job_system, BenchReport& report) {
+    constexpr uint32_t kLength = 10000;
+
+    int64_t best = INT64_MAX;
+    for (uint32_t r = 0; r < kRepeat; ++r) {
+        int64_t begin = GetBenchTime();
+        JobHandle handle = job_system->Schedule([]() {});
+        for (uint32_t i = 1; i < kLength; ++i) {
+            handle = job_system->Schedule([]() {}, handle);
+        }
+
+        job_system->WaitComplete(handle);
+        best = std::min(best, GetBenchTime() - begin);
+    }
+
+    report.Add("dependency_chain", { { "length", kLength }, { "link_ns", (double)best / kLength } });
+}
+
+void SpawnTree(JobSystem* job_system, uint32_t depth, uint32_t fanout) {
+    if (depth == 0) {
+        Consume(SpinWork(kWorkLeaf, depth));
+        return;
+    }
+
+    JobHandle children[16];
+    for (uint32_t i = 0; i < fanout; ++i) {
+        children[i] = job_system->Schedule([job_system, depth, fanout]() {
+            SpawnTree(job_system, depth - 1, fanout);
+        });
+    }
+
+    job_system->WaitComplete(job_system->Schedule({}, children, fanout));
+}
+
+//Recursive fan-out with a join per node, and a flat fan-out into a single join
+void BenchFanOutFanIn(JobSystem* job_system, BenchReport& report) {
+    constexpr uint32_t kDepth = 4;
+    constexpr uint32_t kFanout = 6;
+    constexpr uint32_t kFlatCount = 1024;
+
+    uint32_t node_count = 0;
+    for (uint32_t i = 0, level = 1; i <= kDepth; ++i, level *= kFanout) {
+        node_count += level;
+    }
+
+    int64_t best = INT64_MAX;
+    for (uint32_t r = 0; r < kRepeat; ++r) {
+        int64_t begin = GetBenchTime();
+        auto root = job_system->Schedule([job_system]() {
+            SpawnTree(job_system, kDepth, kFanout);
+        });
+
+        job_system->WaitComplete(root);
+        best = std::min(best, GetBenchTime() - begin);
+    }
+
+    report.Add("fan_out_tree", {
+        { "depth", kDepth },
+        { "fanout", kFanout },
+        { "job_count", (double)node_count },
+        { "ms", ToMs(best) },
+        { "job_ns", (double)best / node_count },
+    });
+
+    std::vector<JobHandle> handles(kFlatCount);
+    best = INT64_MAX;
+    for (uint32_t r = 0; r < kRepeat; ++r) {
+        int64_t begin = GetBenchTime();
+        auto root = job_system->Schedule([]() {});
+        for (auto& handle : handles) {
+            handle = job_system->Schedule([]() { Consume(SpinWork(kWorkLeaf, 3)); }, root);
+        }
+
+        job_system->WaitComplete(Join(job_system, handles));
+        best = std::min(best, GetBenchTime() - begin);
+    }
+
+    report.Add("fan_out_flat", { { "job_count", kFlatCount }, { "ms", ToMs(best) } });
+}
+
+//Half the threads push, half pop, through the lock free ring and the SpinLock one
+template<typename Ring>
+double RunRing(uint32_t thread_count, uint32_t item_count) {
+    static Ring ring;
+
+    uint32_t producers = std::max(1u, thread_count / 2);
+    uint32_t consumers = std::max(1u, thread_count - producers);
+    uint32_t per_producer = item_count / producers;
+    uint32_t total = per_producer * producers;
+
+    std::atomic<uint32_t> consumed = 0;
+    std::atomic<uint32_t> ready = 0;
+    std::atomic_bool go = false;
+    std::vector<std::thread> threads;
+
+    for (uint32_t i = 0; i < producers; ++i) {
+        threads.emplace_back([&, per_producer]() {
+            ready.fetch_add(1);
+            while (!go.load(std::memory_order_acquire));
+
+            for (uint32_t n = 0; n < per_producer; ++n) {
+                while (!ring.Push(n)) {
+                    concurrent::CpuRelax();
+                }
+            }
+        });
+    }
+
+    for (uint32_t i = 0; i < consumers; ++i) {
+        threads.emplace_back([&, total]() {
+            ready.fetch_add(1);
+            while (!go.load(std::memory_order_acquire));
+
+            uint32_t value = 0;
+            while (consumed.load(std::memory_order_relaxed) < total) {
+                if (ring.Pop(value)) {
+                    consumed.fetch_add(1, std::memory_order_relaxed);
+                }
+                else {
+                    concurrent::CpuRelax();
+                }
+            }
+        });
+    }
+
+    while (ready.load() < producers + consumers) {
+        std::this_thread::yield();
+    }
+
+    int64_t begin = GetBenchTime();
+    go.store(true, std::memory_order_release);
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    return total / ((GetBenchTime() - begin) / 1e9);
+}
+
+void BenchRingContention(BenchReport& report) {
+    constexpr uint32_t kItemCount = 1 << 20;
+    const uint32_t thread_counts[] = { 2, 8, 32 };
+
+    for (uint32_t thread_count : thread_counts) {
+        double mpmc = RunRing<concurrent::MPMCRingBuffer<uint32_t, 1024>>(thread_count, kItemCount);
+        double spin = RunRing<concurrent::RingBuffer<uint32_t, 1024>>(thread_count, kItemCount);
+        report.Add("ring_contention", {
+            { "threads", (double)thread_count },
+            { "mpmc_ops_per_sec", mpmc },
+            { "spinlock_ops_per_sec", spin },
+        });
+    }
+
+    //one producer and one consumer, where the wait-free ring applies
+    double spsc = RunRing<concurrent::SPSCRingBuffer<uint32_t, 1024>>(2, kItemCount);
+    double mpmc = RunRing<concurrent::MPMCRingBuffer<uint32_t, 1024>>(2, kItemCount);
+    double spin = RunRing<concurrent::RingBuffer<uint32_t, 1024>>(2, kItemCount);
+    report.Add("ring_spsc", {
+        { "spsc_ops_per_sec", spsc },
+        { "mpmc_ops_per_sec", mpmc },
+        { "spinlock_ops_per_sec", spin },
+    });
+}
+
+//render::CommandQueue buffer recycling without a device: recording threads acquire a buffer
+//and submit it, one thread moves the submitted ones back as if their fence completed
+struct BenchCommandBuffer : public concurrent::MPSCNode {
+    uint64_t fence_value = 0;
+};
+
+class MPSCRecycler {
+public:
+    BenchCommandBuffer* Acquire() {
+        concurrent::SpinLockGuard guard(available_lock_);
+        return available_.Pop();
+    }
+
+    void Release(BenchCommandBuffer* buffer) { available_.Push(buffer); }
+    void Submit(BenchCommandBuffer* buffer) { inflight_.Push(buffer); }
+
+    uint32_t Recycle() {
+        if (!inflight_lock_.TryLock()) {
+            return 0;
+        }
+
+        uint32_t count = 0;
+        while (auto buffer = inflight_.Pop()) {
+            available_.Push(buffer);
+            ++count;
+        }
+
+        inflight_lock_.Unlock();
+        return count;
+    }
+
+private:
+    concurrent::MPSCQueue<BenchCommandBuffer> inflight_;
+    concurrent::SpinLock inflight_lock_;
+    concurrent::MPSCQueue<BenchCommandBuffer> available_;
+    concurrent::SpinLock available_lock_;
+};
+
+class MutexRecycler {
+public:
+    BenchCommandBuffer* Acquire() {
+        BenchCommandBuffer* buffer;
+        return available_.TryPop(buffer) ? buffer : nullptr;
+    }
+
+    void Release(BenchCommandBuffer* buffer) { available_.Push(buffer); }
+    void Submit(BenchCommandBuffer* buffer) { inflight_.Push(buffer); }
+
+    uint32_t Recycle() {
+        uint32_t count = 0;
+        BenchCommandBuffer* buffer;
+        while (inflight_.TryPop(buffer)) {
+            available_.Push(buffer);
+            ++count;
+        }
+
+        return count;
+    }
+
+private:
+    concurrent::ThreadSafeQueue<BenchCommandBuffer*> inflight_;
+    concurrent::ThreadSafeQueue<BenchCommandBuffer*> available_;
+};
+
+template<typename Recycler>
+double RunRecycler(uint32_t thread_count, uint32_t submit_count) {
+    Recycler recycler;
+    std::vector<BenchCommandBuffer> buffers(thread_count * 8);
+    for (auto& buffer : buffers) {
+        recycler.Release(&buffer);
+    }
+
+    std::atomic<uint32_t> done = 0;
+    std::atomic_bool go = false;
+    std::vector<std::thread> threads;
+    for (uint32_t i = 0; i < thread_count; ++i) {
+        threads.emplace_back([&, submit_count]() {
+            while (!go.load(std::memory_order_acquire));
+
+            for (uint32_t n = 0; n < submit_count;) {
+                auto buffer = recycler.Acquire();
+                if (!buffer) {
+                    recycler.Recycle();
+                    continue;
+                }
+
+                buffer->fence_value = n++;
+                recycler.Submit(buffer);
+            }
+
+            done.fetch_add(1, std::memory_order_release);
+        });
+    }
+
+    int64_t begin = GetBenchTime();
+    go.store(true, std::memory_order_release);
+    while (done.load(std::memory_order_acquire) < thread_count) {
+        recycler.Recycle();
+    }
+
+    int64_t duration = GetBenchTime() - begin;
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    return (double)thread_count * submit_count / (duration / 1e9);
+}
+
+void BenchCommandQueueRecycle(BenchReport& report) {
+    constexpr uint32_t kThreadCount = 8;
+    constexpr uint32_t kSubmitCount = 100000;
+
+    double mpsc = RunRecycler<MPSCRecycler>(kThreadCount, kSubmitCount);
+    double mutex = RunRecycler<MutexRecycler>(kThreadCount, kSubmitCount);
+    report.Add("command_buffer_recycle", {
+        { "threads", kThreadCount },
+        { "mpsc_submits_per_sec", mpsc },
+        { "mutex_submits_per_sec", mutex },
+    });
+}
+
+//A frame shaped load: a wide ParallelFor, a dependent chain and a fan-out joined at the end.
+//Run once pinned and once with -unpinned to compare the variance
+void BenchFrameVariance(JobSystem* job_system, BenchReport& report) {
+    constexpr uint32_t kFrameCount = 300;
+    constexpr uint32_t kCount = 1 << 14;
+    constexpr uint32_t kChainLength = 16;
+    constexpr uint32_t kFanout = 64;
+
+    std::vector<double> frame_times(kFrameCount);
+    JobHandle handles[kFanout + 2];
+
+    for (uint32_t frame = 0; frame < kFrameCount; ++frame) {
+        int64_t begin = GetBenchTime();
+
+        handles[0] = job_system->ParallelFor([](uint32_t begin, uint32_t end) {
+            uint32_t value = 0;
+            for (uint32_t i = begin; i < end; ++i) {
+                value ^= SpinWork(32, i);
+            }
+
+            Consume(value);
+        }, kCount, 64);
+
+        JobHandle chain = job_system->Schedule([]() { Consume(SpinWork(2000, 1)); });
+        for (uint32_t i = 1; i < kChainLength; ++i) {
+            chain = job_system->Schedule([]() { Consume(SpinWork(2000, 2)); }, chain);
+        }
+        handles[1] = chain;
+
+        for (uint32_t i = 0; i < kFanout; ++i) {
+            handles[i + 2] = job_system->Schedule([i]() { Consume(SpinWork(4000, i)); });
+        }
+
+        job_system->WaitComplete(job_system->Schedule({}, handles, kFanout + 2));
+        frame_times[frame] = ToMs(GetBenchTime() - begin);
+    }
+
+    report.Add("frame_variance", "ms", ComputeStats(frame_times), { { "frames", kFrameCount } });
+}
+
+//The old thread pool job system on the same loads
+void BenchThreadJobSystem(JobSystem* job_system, BenchReport& report) {
+    constexpr uint32_t kCount = 1 << 16;
+
+    auto thread_jobs = concurrent::ThreadJobSystem::Instance();
+    thread_jobs->Initialize(job_system->GetThreadCount());
+
+    int64_t best = INT64_MAX;
+    for (uint32_t r = 0; r < kRepeat; ++r) {
+        int64_t begin = GetBenchTime();
+        for (uint32_t i = 0; i < kEmptyJobCount; ++i) {
+            thread_jobs->Schedule([](concurrent::ThreadJobSystem::JobArgs) {});
+        }
+
+        thread_jobs->Wait();
+        best = std::min(best, GetBenchTime() - begin);
+    }
+
+    report.Add("thread_jobs_empty", {
+        { "job_count", kEmptyJobCount },
+        { "jobs_per_sec", kEmptyJobCount / (best / 1e9) },
+        { "schedule_complete_ns", (double)best / kEmptyJobCount },
+    });
+
+    best = INT64_MAX;
+    for (uint32_t r = 0; r < kRepeat; ++r) {
+        int64_t begin = GetBenchTime();
+        thread_jobs->Schedule(kCount, 64, [](concurrent::ThreadJobSystem::JobArgs args) {
+            Consume(SpinWork(64, args.jobIndex));
+        });
+
+        thread_jobs->Wait();
+        best = std::min(best, GetBenchTime() - begin);
+    }
+
+    report.Add("thread_jobs_dispatch", { { "count", kCount }, { "group", 64 }, { "ms", ToMs(best) } });
+}
+
+}
+
+void RunJobBench(const BenchOptions&, BenchReport& report) {
+    auto job_system = JobSystem::Instance();
+
+    BenchFiberSwitch(report);
+    BenchWaitSwitch(job_system, report);
+    BenchEmptyJobs(job_system, report);
+    BenchScheduleLatency(job_system, report);
+    BenchParallelFor(job_system, report);
+    BenchDependencyChain(job_system, report);
+    BenchFanOutFanIn(job_system, report);
+    BenchFrameVariance(job_system, report);
+    BenchRingContention(report);
+    BenchCommandQueueRecycle(report);
+    BenchThreadJobSystem(job_system, report);
+}
+
+}
+}
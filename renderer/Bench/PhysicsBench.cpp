@@ -0,0 +1,298 @@
+#include "Bench.h"
+#include <string>
+#include <algorithm>
+#include <vector>
+#include "Common/Uncopyable.h"
+#include "Core/GameObject.h"
+#include "Jobs/JobSystem.h"
+#include "Physics/World.h"
+#include "Physics/Dynamic/Rigidbody.h"
+#include "Physics/Collider/BoxCollider.h"
+
+namespace glacier {
+namespace bench {
+
+namespace {
+
+using physics::World;
+
+double ToMs(int64_t ns) { return ns / 1e6; }
+
+//Bodies of one benchmark, the world is emptied with it
+class PhysicsScene : private Uncopyable {
+public:
+    ~PhysicsScene() {
+        for (auto go : objects_) {
+            GameObject::Destroy(go);
+        }
+
+        GameObjectManager::Instance()->CleanDead();
+        World::Instance()->Clear();
+    }
+
+    uint32_t body_count() const { return (uint32_t)bodies_.size(); }
+    Rigidbody* body(uint32_t index) const { return bodies_[index]; }
+
+    void AddGround(float half_size) {
+        auto& go = GameObject::Create("ground");
+        go.transform().position({ 0.0f, -0.5f, 0.0f });
+        go.AddComponent<BoxCollider>(Vec3f{ half_size, 0.5f, half_size });
+        objects_.push_back(&go);
+    }
+
+    Rigidbody* AddBox(const Vec3f& position, const Vec3f& extents) {
+        auto& go = GameObject::Create("box");
+        go.transform().position(position);
+
+        auto rigidbody = go.AddComponent<Rigidbody>(RigidbodyType::kDynamic, true);
+        auto collider = go.AddComponent<BoxCollider>(extents);
+        collider->mass(1.0f);
+
+        objects_.push_back(&go);
+        bodies_.push_back(rigidbody);
+        return rigidbody;
+    }
+
+    //columns x columns stacks of unit boxes resting on each other
+    void AddStacks(uint32_t columns, uint32_t height, float spacing = 1.1f) {
+        AddGround(columns * spacing);
+        float offset = (columns - 1) * spacing * 0.5f;
+        for (uint32_t x = 0; x < columns; ++x) {
+            for (uint32_t z = 0; z < columns; ++z) {
+                for (uint32_t y = 0; y < height; ++y) {
+                    AddBox({ x * spacing - offset, y + 0.5f, z * spacing - offset }, { 0.5f, 0.5f, 0.5f });
+                }
+            }
+        }
+    }
+
+    //2d pyramid in the xy plane, base boxes at the bottom
+    void AddPyramid(uint32_t base) {
+        AddGround(base * 1.0f);
+        for (uint32_t y = 0; y < base; ++y) {
+            uint32_t count = base - y;
+            float offset = (count - 1) * 1.05f * 0.5f;
+            for (uint32_t x = 0; x < count; ++x) {
+                AddBox({ x * 1.05f - offset, y + 0.5f, 0.0f }, { 0.5f, 0.5f, 0.5f });
+            }
+        }
+    }
+
+    //running bond wall of 2x1x1 bricks, every other row shifted by half a brick
+    void AddWall(uint32_t width, uint32_t height) {
+        AddGround(width * 1.5f);
+        for (uint32_t y = 0; y < height; ++y) {
+            float offset = width * 1.0f - (y % 2 ? 0.0f : 1.0f);
+            for (uint32_t x = 0; x < width; ++x) {
+                AddBox({ x * 2.0f - offset, y + 0.5f, 0.0f }, { 1.0f, 0.5f, 0.5f });
+            }
+        }
+    }
+
+    //square pyramid, every box resting on the 4 below it: one island
+    void AddPile(uint32_t base) {
+        AddGround(base * 1.0f);
+        for (uint32_t y = 0; y < base; ++y) {
+            uint32_t count = base - y;
+            float offset = (count - 1) * 0.5f;
+            for (uint32_t x = 0; x < count; ++x) {
+                for (uint32_t z = 0; z < count; ++z) {
+                    AddBox({ x - offset, y + 0.5f, z - offset }, { 0.5f, 0.5f, 0.5f });
+                }
+            }
+        }
+    }
+
+    //per step ms
+    std::vector<double> Run(uint32_t step_count) {
+        auto world = World::Instance();
+        std::vector<double> step_times(step_count);
+        for (uint32_t i = 0; i < step_count; ++i) {
+            int64_t begin = GetBenchTime();
+            world->Step();
+            step_times[i] = ToMs(GetBenchTime() - begin);
+        }
+
+        return step_times;
+    }
+
+    //FNV-1a over the bits of every pose, equal only for bit identical simulations
+    uint64_t HashPoses() const {
+        uint64_t hash = 14695981039346656037ull;
+        auto append = [&hash](const void* data, size_t size) {
+            auto bytes = (const uint8_t*)data;
+            for (size_t i = 0; i < size; ++i) {
+                hash = (hash ^ bytes[i]) * 1099511628211ull;
+            }
+        };
+
+        for (auto body : bodies_) {
+            Vec3f position = body->transform().position();
+            Quaternion rotation = body->transform().rotation();
+            append(&position, sizeof(position));
+            append(&rotation, sizeof(rotation));
+        }
+
+        return hash;
+    }
+
+private:
+    std::vector<GameObject*> objects_;
+    std::vector<Rigidbody*> bodies_;
+};
+
+//10k boxes in 25x25 stacks of 16: every step re-tests ~20k resting pairs
+void BenchNarrowphase(BenchReport& report) {
+    constexpr uint32_t kColumns = 25;
+    constexpr uint32_t kHeight = 16;
+    constexpr uint32_t kStepCount = 60;
+
+    uint64_t hashes[2];
+    double p50[2];
+    uint32_t body_count = 0;
+    for (int parallel = 0; parallel < 2; ++parallel) {
+        World::Instance()->SetParallelNarrowphase(parallel != 0);
+
+        PhysicsScene scene;
+        scene.AddStacks(kColumns, kHeight);
+        body_count = scene.body_count();
+
+        auto step_times = scene.Run(kStepCount);
+        hashes[parallel] = scene.HashPoses();
+
+        SampleStats stats = ComputeStats(step_times);
+        p50[parallel] = stats.p50;
+        report.Add(parallel ? "physics_stacks_parallel_narrowphase" : "physics_stacks_serial_narrowphase",
+            "step_ms", stats, { { "bodies", (double)body_count }, { "steps", kStepCount } });
+    }
+
+    World::Instance()->SetParallelNarrowphase(true);
+
+    report.Add("physics_stacks_narrowphase", {
+        { "bodies", (double)body_count },
+        { "speedup_p50", p50[1] > 0.0 ? p50[0] / p50[1] : 0.0 },
+        { "bit_identical", hashes[0] == hashes[1] ? 1.0 : 0.0 },
+    });
+}
+
+//Same scene with the scalar and the simd contact solver, both on one thread
+void BenchSolver(BenchReport& report, const char* name, void(*build)(PhysicsScene& scene)) {
+    constexpr uint32_t kStepCount = 120;
+
+    World::Instance()->SetSolverThreads(1);
+
+    double p50[2];
+    uint32_t body_count = 0;
+    for (int simd = 0; simd < 2; ++simd) {
+        World::Instance()->SetSimdSolver(simd != 0);
+
+        PhysicsScene scene;
+        build(scene);
+        body_count = scene.body_count();
+
+        auto step_times = scene.Run(kStepCount);
+        SampleStats stats = ComputeStats(step_times);
+        p50[simd] = stats.p50;
+
+        std::string record = std::string(name) + (simd ? "_simd_solver" : "_scalar_solver");
+        report.Add(record.c_str(), "step_ms", stats, { { "bodies", (double)body_count }, { "steps", kStepCount } });
+    }
+
+    World::Instance()->SetSimdSolver(true);
+    World::Instance()->SetSolverThreads(0);
+
+    std::string record = std::string(name) + "_solver";
+    report.Add(record.c_str(), {
+        { "bodies", (double)body_count },
+        { "speedup_p50", p50[1] > 0.0 ? p50[0] / p50[1] : 0.0 },
+    });
+}
+
+//4900 boxes in one island solved on 1, 2, 4... job workers
+void BenchSolverScaling(BenchReport& report) {
+    constexpr uint32_t kBase = 24;
+    constexpr uint32_t kStepCount = 60;
+
+    std::vector<uint32_t> thread_counts;
+    uint32_t max_threads = std::max(1u, jobs::JobSystem::Instance()->GetThreadCount());
+    for (uint32_t count = 1; count < max_threads; count *= 2) {
+        thread_counts.push_back(count);
+    }
+    thread_counts.push_back(max_threads);
+
+    double serial_p50 = 0.0;
+    for (uint32_t thread_count : thread_counts) {
+        World::Instance()->SetSolverThreads(thread_count);
+
+        PhysicsScene scene;
+        scene.AddPile(kBase);
+
+        auto step_times = scene.Run(kStepCount);
+        SampleStats stats = ComputeStats(step_times);
+        if (thread_count == 1) {
+            serial_p50 = stats.p50;
+        }
+
+        report.Add("physics_pile_colored_solver", "step_ms", stats, {
+            { "bodies", (double)scene.body_count() },
+            { "threads", (double)thread_count },
+            { "speedup_p50", stats.p50 > 0.0 ? serial_p50 / stats.p50 : 0.0 },
+        });
+    }
+
+    World::Instance()->SetSolverThreads(0);
+}
+
+//20k boxes in 100x100 stacks of 2 left to fall asleep, then a few kicked every step:
+//only their islands are solved, the cost follows the awake bodies
+void BenchSleeping(BenchReport& report) {
+    constexpr uint32_t kColumns = 100;
+    constexpr uint32_t kHeight = 2;
+    constexpr uint32_t kSettleSteps = 120;
+    constexpr uint32_t kStepCount = 60;
+    constexpr uint32_t kKicks = 8;
+
+    PhysicsScene scene;
+    scene.AddStacks(kColumns, kHeight, 1.5f);
+    scene.Run(kSettleSteps);
+
+    auto world = World::Instance();
+    uint32_t asleep_islands = world->island_count() - world->awake_island_count();
+
+    //the same bodies for every run, spread over the scene
+    uint32_t body_count = scene.body_count();
+    uint32_t kicked = 0;
+    std::vector<double> step_times(kStepCount);
+    double awake_islands = 0.0;
+    for (uint32_t i = 0; i < kStepCount; ++i) {
+        for (uint32_t k = 0; k < kKicks; ++k) {
+            kicked = (kicked + 7919) % body_count;
+            scene.body(kicked)->ApplyForce({ 0.0f, 200.0f, 0.0f });
+        }
+
+        int64_t begin = GetBenchTime();
+        world->Step();
+        step_times[i] = ToMs(GetBenchTime() - begin);
+        awake_islands += world->awake_island_count();
+    }
+
+    report.Add("physics_sleeping_islands", "step_ms", ComputeStats(step_times), {
+        { "bodies", (double)body_count },
+        { "islands", (double)world->island_count() },
+        { "asleep_islands_settled", (double)asleep_islands },
+        { "awake_islands_avg", awake_islands / kStepCount },
+    });
+}
+
+}
+
+void RunPhysicsBench(const BenchOptions&, BenchReport& report) {
+    BenchNarrowphase(report);
+    BenchSolver(report, "physics_pyramid", [](PhysicsScene& scene) { scene.AddPyramid(60); });
+    BenchSolver(report, "physics_wall", [](PhysicsScene& scene) { scene.AddWall(40, 40); });
+    BenchSolverScaling(report);
+    BenchSleeping(report);
+}
+
+}
+}
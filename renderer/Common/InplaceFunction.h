@@ -0,0 +1,113 @@
+#pragma once
+
+#include <stddef.h>
+#include <assert.h>
+#include <new>
+#include <utility>
+#include <type_traits>
+
+namespace glacier {
+
+template<typename Signature, size_t Capacity = 48>
+class InplaceFunction;
+
+//Move-only std::function replacement that never allocates:
+//the callable is stored in place and has to fit into Capacity bytes (checked at compile time),
+//capture large state by reference or pointer.
+template<typename R, typename... Args, size_t Capacity>
+class InplaceFunction<R(Args...), Capacity> {
+public:
+    static constexpr size_t kAlignment = alignof(void*);
+
+    InplaceFunction() noexcept {}
+    InplaceFunction(std::nullptr_t) noexcept {}
+
+    template<typename F, typename = std::enable_if_t<!std::is_same<std::decay_t<F>, InplaceFunction>::value &&
+        std::is_invocable_r<R, std::decay_t<F>&, Args...>::value>>
+    InplaceFunction(F&& func) {
+        using T = std::decay_t<F>;
+        static_assert(sizeof(T) <= Capacity, "callable is too large for InplaceFunction");
+        static_assert(alignof(T) <= kAlignment, "callable is over aligned for InplaceFunction");
+        static_assert(std::is_nothrow_move_constructible<T>::value, "callable must be nothrow movable");
+
+        new (&storage_) T(std::forward<F>(func));
+        ops_ = &Ops<T>::kTable;
+    }
+
+    InplaceFunction(InplaceFunction&& other) noexcept {
+        MoveFrom(other);
+    }
+
+    InplaceFunction(const InplaceFunction&) = delete;
+    InplaceFunction& operator=(const InplaceFunction&) = delete;
+
+    ~InplaceFunction() {
+        Reset();
+    }
+
+    InplaceFunction& operator=(InplaceFunction&& other) noexcept {
+        if (this != &other) {
+            Reset();
+            MoveFrom(other);
+        }
+
+        return *this;
+    }
+
+    InplaceFunction& operator=(std::nullptr_t) noexcept {
+        Reset();
+        return *this;
+    }
+
+    explicit operator bool() const noexcept { return ops_ != nullptr; }
+
+    R operator()(Args... args) const {
+        assert(ops_);
+        return ops_->invoke(&storage_, std::forward<Args>(args)...);
+    }
+
+    void Reset() noexcept {
+        if (ops_) {
+            ops_->destroy(&storage_);
+            ops_ = nullptr;
+        }
+    }
+
+private:
+    struct OpsTable {
+        R(*invoke)(void* func, Args&&... args);
+        void(*move)(void* dst, void* src) noexcept;
+        void(*destroy)(void* func) noexcept;
+    };
+
+    template<typename T>
+    struct Ops {
+        static R Invoke(void* func, Args&&... args) {
+            return (*static_cast<T*>(func))(std::forward<Args>(args)...);
+        }
+
+        static void Move(void* dst, void* src) noexcept {
+            new (dst) T(std::move(*static_cast<T*>(src)));
+            static_cast<T*>(src)->~T();
+        }
+
+        static void Destroy(void* func) noexcept {
+            static_cast<T*>(func)->~T();
+        }
+
+        static constexpr OpsTable kTable = { &Invoke, &Move, &Destroy };
+    };
+
+    void MoveFrom(InplaceFunction& other) noexcept {
+        if (other.ops_) {
+            other.ops_->move(&storage_, &other.storage_);
+            ops_ = other.ops_;
+            other.ops_ = nullptr;
+        }
+    }
+
+    const OpsTable* ops_ = nullptr;
+    alignas(kAlignment) mutable unsigned char storage_[Capacity];
+};
+
+}
@@ -0,0 +1,340 @@
+#include "CpuTopology.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <algorithm>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace glacier {
+namespace concurrent {
+
+namespace {
+
+#if defined(__linux__)
+
+bool ReadSysFile(const std::string& path, std::string& content) {
+    FILE* file = fopen(path.c_str(), "r");
+    if (!file) {
+        return false;
+    }
+
+    char buf[4096];
+    size_t size = fread(buf, 1, sizeof(buf) - 1, file);
+    fclose(file);
+
+    buf[size] = 0;
+    content = buf;
+    while (!content.empty() && (content.back() == '\n' || content.back() == ' ')) {
+        content.pop_back();
+    }
+
+    return !content.empty();
+}
+
+bool ReadSysInt(const std::string& path, uint32_t& value) {
+    std::string content;
+    if (!ReadSysFile(path, content)) {
+        return false;
+    }
+
+    value = (uint32_t)strtoul(content.c_str(), nullptr, 10);
+    return true;
+}
+
+//"0-3,8,10-11"
+bool ReadCpuList(const std::string& path, std::vector<uint32_t>& list) {
+    std::string content;
+    if (!ReadSysFile(path, content)) {
+        return false;
+    }
+
+    list.clear();
+    const char* p = content.c_str();
+    while (*p) {
+        char* end;
+        uint32_t first = (uint32_t)strtoul(p, &end, 10);
+        if (end == p) {
+            break;
+        }
+
+        uint32_t last = first;
+        p = end;
+        if (*p == '-') {
+            last = (uint32_t)strtoul(p + 1, &end, 10);
+            p = end;
+        }
+
+        for (uint32_t i = first; i <= last; ++i) {
+            list.push_back(i);
+        }
+
+        if (*p == ',') {
+            ++p;
+        }
+    }
+
+    return !list.empty();
+}
+
+#endif
+
+}
+
+const CpuTopology& CpuTopology::Get() {
+    static CpuTopology topology;
+    return topology;
+}
+
+CpuTopology::CpuTopology() {
+    Detect();
+
+    if (cpus_.empty()) {
+        DetectFallback();
+    }
+
+    std::sort(cpus_.begin(), cpus_.end(), [](const LogicalCpu& a, const LogicalCpu& b) {
+        if (a.package != b.package) return a.package < b.package;
+        if (a.core != b.core) return a.core < b.core;
+        return a.smt_index < b.smt_index;
+    });
+
+    bool has_performance = false;
+    bool has_efficiency = false;
+    for (auto& cpu : cpus_) {
+        has_performance |= cpu.performance;
+        has_efficiency |= !cpu.performance;
+    }
+
+    //a single class of cores is all performance
+    hybrid_ = has_performance && has_efficiency;
+    if (!hybrid_) {
+        for (auto& cpu : cpus_) {
+            cpu.performance = true;
+        }
+    }
+}
+
+std::vector<uint32_t> CpuTopology::GetCpus(CoreSet set) const {
+    std::vector<uint32_t> result;
+    auto append = [this, &result](bool primary, bool performance) {
+        for (auto& cpu : cpus_) {
+            if ((cpu.smt_index == 0) == primary && cpu.performance == performance) {
+                result.push_back(cpu.id);
+            }
+        }
+    };
+
+    switch (set) {
+    case CoreSet::kAll:
+        append(true, true);
+        append(true, false);
+        append(false, true);
+        append(false, false);
+        break;
+    case CoreSet::kPerformance:
+        append(true, true);
+        break;
+    case CoreSet::kEfficiency:
+        append(true, false);
+        break;
+    case CoreSet::kSmtSiblings:
+        append(false, true);
+        append(false, false);
+        break;
+    }
+
+    return result;
+}
+
+void CpuTopology::DetectFallback() {
+    uint32_t count = std::max(1u, std::thread::hardware_concurrency());
+    cpus_.resize(count);
+    for (uint32_t i = 0; i < count; ++i) {
+        cpus_[i] = { i, i, 0, 0, true };
+    }
+
+    core_count_ = count;
+}
+
+#ifdef _WIN32
+
+void CpuTopology::Detect() {
+    auto query = [](LOGICAL_PROCESSOR_RELATIONSHIP relation, std::vector<uint8_t>& buffer) {
+        DWORD length = 0;
+        GetLogicalProcessorInformationEx(relation, nullptr, &length);
+        if (length == 0) {
+            return false;
+        }
+
+        buffer.resize(length);
+        return GetLogicalProcessorInformationEx(relation,
+            (PSYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX)buffer.data(), &length) != FALSE;
+    };
+
+    std::vector<uint8_t> packages;
+    std::vector<uint8_t> cores;
+    if (!query(RelationProcessorPackage, packages) || !query(RelationProcessorCore, cores)) {
+        return;
+    }
+
+    //package of every cpu in group 0
+    uint32_t cpu_package[64] = {};
+    uint32_t package_index = 0;
+    for (size_t offset = 0; offset < packages.size(); ++package_index) {
+        auto info = (PSYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX)(packages.data() + offset);
+        for (WORD i = 0; i < info->Processor.GroupCount; ++i) {
+            auto& group = info->Processor.GroupMask[i];
+            if (group.Group != 0) continue;
+
+            for (uint32_t cpu = 0; cpu < 64; ++cpu) {
+                if (group.Mask & (1ull << cpu)) {
+                    cpu_package[cpu] = package_index;
+                }
+            }
+        }
+
+        offset += info->Size;
+    }
+
+    //EfficiencyClass is higher on faster cores
+    BYTE max_class = 0;
+    for (size_t offset = 0; offset < cores.size();) {
+        auto info = (PSYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX)(cores.data() + offset);
+        max_class = std::max(max_class, info->Processor.EfficiencyClass);
+        offset += info->Size;
+    }
+
+    uint32_t core_index = 0;
+    for (size_t offset = 0; offset < cores.size();) {
+        auto info = (PSYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX)(cores.data() + offset);
+        offset += info->Size;
+
+        auto& group = info->Processor.GroupMask[0];
+        if (group.Group != 0) continue;
+
+        uint32_t smt_index = 0;
+        for (uint32_t cpu = 0; cpu < 64; ++cpu) {
+            if (group.Mask & (1ull << cpu)) {
+                cpus_.push_back({ cpu, core_index, cpu_package[cpu], smt_index++,
+                    info->Processor.EfficiencyClass == max_class });
+            }
+        }
+
+        ++core_index;
+    }
+
+    core_count_ = core_index;
+}
+
+bool CpuTopology::SetThreadAffinity(std::thread::native_handle_type handle, uint32_t cpu) {
+    if (cpu >= 64) {
+        return false;
+    }
+
+    return SetThreadAffinityMask((HANDLE)handle, 1ull << cpu) != 0;
+}
+
+bool CpuTopology::SetCurrentThreadAffinity(uint32_t cpu) {
+    if (cpu >= 64) {
+        return false;
+    }
+
+    return SetThreadAffinityMask(GetCurrentThread(), 1ull << cpu) != 0;
+}
+
+#elif defined(__linux__)
+
+void CpuTopology::Detect() {
+    const std::string root = "/sys/devices/system/cpu/";
+
+    std::vector<uint32_t> online;
+    if (!ReadCpuList(root + "online", online)) {
+        return;
+    }
+
+    //intel hybrid parts list their performance cores here
+    std::vector<uint32_t> core_cpus;
+    bool has_core_list = ReadCpuList("/sys/devices/cpu_core/cpus", core_cpus);
+
+    //arm big.LITTLE reports a relative capacity per cpu instead
+    std::vector<uint32_t> capacities(online.size(), 0);
+    uint32_t max_capacity = 0;
+    for (size_t i = 0; i < online.size(); ++i) {
+        ReadSysInt(root + "cpu" + std::to_string(online[i]) + "/cpu_capacity", capacities[i]);
+        max_capacity = std::max(max_capacity, capacities[i]);
+    }
+
+    std::vector<std::pair<uint32_t, uint32_t>> core_keys; //(package, core_id) -> core index
+    for (size_t i = 0; i < online.size(); ++i) {
+        uint32_t id = online[i];
+        std::string topology = root + "cpu" + std::to_string(id) + "/topology/";
+
+        uint32_t package = 0;
+        uint32_t core_id = id;
+        ReadSysInt(topology + "physical_package_id", package);
+        ReadSysInt(topology + "core_id", core_id);
+
+        auto key = std::make_pair(package, core_id);
+        auto it = std::find(core_keys.begin(), core_keys.end(), key);
+        uint32_t core = (uint32_t)(it - core_keys.begin());
+        if (it == core_keys.end()) {
+            core_keys.push_back(key);
+        }
+
+        //siblings are listed in id order, the first one is the primary thread
+        uint32_t smt_index = 0;
+        std::vector<uint32_t> siblings;
+        if (ReadCpuList(topology + "thread_siblings_list", siblings)) {
+            smt_index = (uint32_t)(std::find(siblings.begin(), siblings.end(), id) - siblings.begin());
+            if (smt_index >= siblings.size()) {
+                smt_index = 0;
+            }
+        }
+
+        bool performance = true;
+        if (has_core_list) {
+            performance = std::find(core_cpus.begin(), core_cpus.end(), id) != core_cpus.end();
+        }
+        else if (max_capacity > 0) {
+            performance = capacities[i] == max_capacity;
+        }
+
+        cpus_.push_back({ id, core, package, smt_index, performance });
+    }
+
+    core_count_ = (uint32_t)core_keys.size();
+}
+
+bool CpuTopology::SetThreadAffinity(std::thread::native_handle_type handle, uint32_t cpu) {
+    cpu_set_t cpuset;
+    CPU_ZERO(&cpuset);
+    CPU_SET(cpu, &cpuset);
+
+    return pthread_setaffinity_np(handle, sizeof(cpuset), &cpuset) == 0;
+}
+
+bool CpuTopology::SetCurrentThreadAffinity(uint32_t cpu) {
+    return SetThreadAffinity(pthread_self(), cpu);
+}
+
+#else
+
+void CpuTopology::Detect() {
+}
+
+bool CpuTopology::SetThreadAffinity(std::thread::native_handle_type, uint32_t) {
+    return false;
+}
+
+bool CpuTopology::SetCurrentThreadAffinity(uint32_t) {
+    return false;
+}
+
+#endif
+
+}
+}
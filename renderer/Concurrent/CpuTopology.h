@@ -0,0 +1,56 @@
+#pragma once
+
+#include <stdint.h>
+#include <thread>
+#include <vector>
+
+namespace glacier {
+namespace concurrent {
+
+enum class CoreSet : uint8_t {
+    kAll,           //every logical cpu: performance cores, efficiency cores, then SMT siblings
+    kPerformance,   //first hardware thread of every performance core
+    kEfficiency,    //first hardware thread of every efficiency core
+    kSmtSiblings,   //the other hardware threads of SMT cores
+};
+
+struct LogicalCpu {
+    uint32_t id;        //os index, what affinity refers to
+    uint32_t core;      //physical core, shared by SMT siblings
+    uint32_t package;
+    uint32_t smt_index; //0 for the first hardware thread of a core
+    bool performance;   //false on the efficiency cores of hybrid cpus
+};
+
+//Cpu layout, read from /sys/devices/system/cpu on linux and
+//GetLogicalProcessorInformationEx on windows (processor group 0 only)
+class CpuTopology {
+public:
+    //detected on first use
+    static const CpuTopology& Get();
+
+    const std::vector<LogicalCpu>& GetLogicalCpus() const { return cpus_; }
+    uint32_t GetLogicalCount() const { return (uint32_t)cpus_.size(); }
+    uint32_t GetCoreCount() const { return core_count_; }
+    bool IsHybrid() const { return hybrid_; }
+
+    //Logical cpu ids of the set, ordered by package and core
+    std::vector<uint32_t> GetCpus(CoreSet set) const;
+
+    static bool SetThreadAffinity(std::thread::native_handle_type handle, uint32_t cpu);
+    static bool SetCurrentThreadAffinity(uint32_t cpu);
+
+private:
+    CpuTopology();
+
+    void Detect();
+    //one core per logical cpu, when nothing better is known
+    void DetectFallback();
+
+    std::vector<LogicalCpu> cpus_;
+    uint32_t core_count_ = 0;
+    bool hybrid_ = false;
+};
+
+}
+}
@@ -6,131 +6,214 @@
 #include <atomic>
 #include <functional>
 #include "Common/Uncopyable.h"
-#include "common/bitutil.h"
-#include "spinlock.h"
+#include "Common/BitUtil.h"
+#include "SpinLock.h"
 
 namespace glacier {
 namespace concurrent {
 
 #define CACHE_LINE_SIZE 64
 
-//Single producer/Single consumer
-template<typename T, size_t Capacity>
+//Slot pool with stable addresses and indices: it grows by ChunkSize entries, up to MaxChunk chunks,
+//and chunks are never moved or freed before the buffer itself.
+//Alloc/Free are lock free: free slots form a stack whose head carries a generation bumped by
+//every push and pop, so a head popped and pushed back between a load and the CAS is not taken
+//for the one loaded (ABA). Only growing takes a lock.
+//Values are packed without padding, the free list links live in a separate array of the chunk:
+//a slot never shares its lines with the pool bookkeeping, it shares them with its neighbours
+//when sizeof(T) isn't a multiple of the cache line.
+template<typename T, size_t ChunkSize, size_t MaxChunk = 1>
 class FixedBuffer : private Uncopyable {
 public:
-    struct alignas(alignof(T)) Entry {
-        T value;
-        uint32_t index;
-        int next; //free list link
-        bool active = false;
-        char padding[CACHE_LINE_SIZE];
-    };
+    static_assert((ChunkSize & (ChunkSize - 1)) == 0, "ChunkSize must be power of 2");
+    static_assert(ChunkSize * MaxChunk < 0xFFFFFFFE, "Indices must fit in 32 bits");
 
     FixedBuffer() {
-        for (int i = 0; i < Capacity; ++i) {
-            data_[i].index = i;
-            data_[i].next = (i + 1) == Capacity ? -1 : (i + 1);
+        Grow();
+    }
+
+    ~FixedBuffer() {
+        for (size_t i = 0; i < MaxChunk; ++i) {
+            delete chunks_[i].load(std::memory_order_relaxed);
         }
     }
 
-    constexpr size_t capacity() const { return Capacity; }
+    static constexpr size_t max_capacity() { return ChunkSize * MaxChunk; }
+
+    //allocated slots
+    size_t capacity() const { return chunk_count_.load(std::memory_order_acquire) * ChunkSize; }
+    //slots in use
+    size_t size() const { return size_.load(std::memory_order_relaxed); }
+    size_t high_water() const { return high_water_.load(std::memory_order_relaxed); }
+
+    //Cap the growth below MaxChunk, chunks already allocated are kept
+    void SetChunkLimit(size_t limit) {
+        SpinLockGuard gurad(grow_lock_);
+        chunk_limit_ = limit < 1 ? 1 : (limit > MaxChunk ? MaxChunk : limit);
+    }
 
     T& operator[](size_t i) {
-        return data_[i].value;
+        return GetChunk(i)->values[i & kMask];
     }
 
     const T& operator[](size_t i) const {
-        return data_[i].value;
+        return GetChunk(i)->values[i & kMask];
     }
 
-    uint32_t GetIndex(T* v) const {
-        Entry* entry = static_cast<Entry*>(v);
-        assert(entry->index < Capacity);
-        assert(entry == &data_[entry->index]);
+    uint32_t GetIndex(const T* v) const {
+        //most pools never grow past the first chunk
+        size_t chunk_count = chunk_count_.load(std::memory_order_acquire);
+        for (size_t i = 0; i < chunk_count; ++i) {
+            Chunk* chunk = chunks_[i].load(std::memory_order_relaxed);
+            size_t offset = (uintptr_t)v - (uintptr_t)chunk->values;
+            if (offset < sizeof(chunk->values)) {
+                return (uint32_t)(i * ChunkSize + offset / sizeof(T));
+            }
+        }
 
-        return entry->index;
+        assert(false);
+        return kNil;
     }
 
     T* Alloc(const T& v) {
-        SpinLockGuard gurad(lock_);
-        T* v = nullptr;
-        if (free_ < 0) {
-            return nullptr;
-        }
-
-        auto& entry = data_[free_];
-        assert(!entry.active);
-
-        entry.value = v;
-        entry.active = true;
-
-        free_ = entry->next;
-
-        return &entry.value;
+        return Alloc([&v](T& value, uint32_t index) { value = v; });
     }
 
     T* Alloc(T&& v) {
-        SpinLockGuard gurad(lock_);
-        T* v = nullptr;
-        if (free_ < 0) {
+        return Alloc([&v](T& value, uint32_t index) { value = std::move(v); });
+    }
+
+    template<typename F>
+    T* Alloc(const F& func) {
+        uint32_t index = Pop();
+        if (index == kNil) {
             return nullptr;
         }
 
-        auto& entry = data_[free_];
-        assert(!entry.active);
+        Chunk* chunk = GetChunk(index);
+        T& value = chunk->values[index & kMask];
+        func(value, index);
 
-        entry.value = std::move(v);
-        entry.active = true;
+        size_t size = size_.fetch_add(1, std::memory_order_relaxed) + 1;
+        size_t high_water = high_water_.load(std::memory_order_relaxed);
+        while (size > high_water &&
+            !high_water_.compare_exchange_weak(high_water, size, std::memory_order_relaxed))
+        {
+        }
 
-        free_ = entry->next;
+        return &value;
+    }
 
-        return &entry.value;
+    void Free(T* v) {
+        uint32_t index = GetIndex(v);
+        assert(GetChunk(index)->links[index & kMask].load(std::memory_order_relaxed) == kActive);
+
+        size_.fetch_sub(1, std::memory_order_relaxed);
+        Push(index, index);
     }
 
+    //f(value, active), racy if slots are allocated or freed meanwhile
     template<typename F>
-    T* Alloc(const F& func) {
-        SpinLockGuard gurad(lock_);
-        T* v = nullptr;
-        if (free_ < 0) {
-            return nullptr;
-        }
-
-        auto& entry = data_[free_];
-        assert(!entry.active);
+    void Visit(size_t i, const F& f) {
+        assert(i < capacity());
+        Chunk* chunk = GetChunk(i);
+        f(chunk->values[i & kMask], chunk->links[i & kMask].load(std::memory_order_relaxed) == kActive);
+    }
 
-        func(entry.value, entry.index);
-        entry.active = true;
+protected:
+    static constexpr uint32_t kNil = 0xFFFFFFFF;
+    static constexpr uint32_t kActive = 0xFFFFFFFE; //link of a slot in use
+    static constexpr size_t kMask = ChunkSize - 1;
 
-        free_ = entry.next;
+    struct Chunk {
+        T values[ChunkSize];
+        std::atomic<uint32_t> links[ChunkSize]; //next free slot
+    };
 
-        return &entry.value;
+    //index in the low half, generation in the high half
+    static uint64_t MakeHead(uint32_t index, uint32_t generation) {
+        return ((uint64_t)generation << 32) | index;
     }
 
-    void Free(T* v) {
-        Entry* entry = (Entry*)v;
+    static uint32_t GetHeadIndex(uint64_t head) { return (uint32_t)head; }
+    static uint32_t GetHeadGeneration(uint64_t head) { return (uint32_t)(head >> 32); }
 
-        SpinLockGuard gurad(lock_);
-        assert(entry->index < Capacity);
-        assert(entry->active);
-        assert(entry == &data_[entry->index]);
+    Chunk* GetChunk(size_t i) const {
+        Chunk* chunk = chunks_[i / ChunkSize].load(std::memory_order_acquire);
+        assert(chunk);
+        return chunk;
+    }
 
-        entry->next = free_;
-        entry->active = false;
+    uint32_t Pop() {
+        uint64_t head = free_.load(std::memory_order_acquire);
+        while (true) {
+            uint32_t index = GetHeadIndex(head);
+            if (index == kNil) {
+                if (!Grow()) {
+                    return kNil;
+                }
+
+                head = free_.load(std::memory_order_acquire);
+                continue;
+            }
+
+            //stale if another thread pops it first, the generation makes the CAS fail then
+            auto& link = GetChunk(index)->links[index & kMask];
+            uint32_t next = link.load(std::memory_order_relaxed);
+            if (free_.compare_exchange_weak(head, MakeHead(next, GetHeadGeneration(head) + 1),
+                std::memory_order_acquire, std::memory_order_acquire))
+            {
+                link.store(kActive, std::memory_order_relaxed);
+                return index;
+            }
+        }
+    }
 
-        free_ = entry->index;
+    //push the free slots first..last, already linked together
+    void Push(uint32_t first, uint32_t last) {
+        auto& link = GetChunk(last)->links[last & kMask];
+        uint64_t head = free_.load(std::memory_order_relaxed);
+        do {
+            link.store(GetHeadIndex(head), std::memory_order_relaxed);
+        } while (!free_.compare_exchange_weak(head, MakeHead(first, GetHeadGeneration(head) + 1),
+            std::memory_order_release, std::memory_order_relaxed));
     }
 
-    template<typename F>
-    void Visit(size_t i, const F& f) {
-        assert(i < Capacity);
-        SpinLockGuard gurad(lock_);
-        f(data_[i]);
+    //false once the limit is reached, true if there may be free slots now
+    bool Grow() {
+        SpinLockGuard gurad(grow_lock_);
+        if (GetHeadIndex(free_.load(std::memory_order_acquire)) != kNil) {
+            return true; //freed or grown by another thread meanwhile
+        }
+
+        size_t chunk_count = chunk_count_.load(std::memory_order_relaxed);
+        if (chunk_count >= chunk_limit_) {
+            return false;
+        }
+
+        Chunk* chunk = new Chunk();
+        uint32_t base = (uint32_t)(chunk_count * ChunkSize);
+        for (uint32_t i = 0; i + 1 < ChunkSize; ++i) {
+            chunk->links[i].store(base + i + 1, std::memory_order_relaxed);
+        }
+
+        chunks_[chunk_count].store(chunk, std::memory_order_release);
+        chunk_count_.store(chunk_count + 1, std::memory_order_release);
+        Push(base, base + (uint32_t)ChunkSize - 1);
+
+        return true;
     }
 
-protected:
-    int free_ = 0; //free list
-    Entry data_[Capacity];
-    SpinLock lock_;
+    //written by every Alloc and Free, one line moving between cores instead of three
+    alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> free_ = MakeHead(kNil, 0);
+    std::atomic<size_t> size_ = 0;
+    std::atomic<size_t> high_water_ = 0;
+
+    //read mostly
+    alignas(CACHE_LINE_SIZE) std::atomic<size_t> chunk_count_ = 0;
+    std::atomic<Chunk*> chunks_[MaxChunk] = {};
+    size_t chunk_limit_ = MaxChunk;
+    SpinLock grow_lock_;
 };
 
 }
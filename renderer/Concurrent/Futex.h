@@ -0,0 +1,52 @@
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+
+#ifdef _WIN32
+//WaitOnAddress/WakeByAddress*, Synchronization.lib
+#elif defined(__linux__)
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#endif
+
+namespace glacier {
+namespace concurrent {
+
+static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t), "futex word must be a plain 32 bit integer");
+
+//Block the calling thread while value == expected.
+//May return spuriously, callers always re-check their condition.
+inline void FutexWait(std::atomic<uint32_t>& value, uint32_t expected) {
+#ifdef _WIN32
+    WaitOnAddress(&value, &expected, sizeof(expected), INFINITE);
+#elif defined(__linux__)
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(&value), FUTEX_WAIT_PRIVATE, expected, nullptr, nullptr, 0);
+#else
+    value.wait(expected, std::memory_order_acquire);
+#endif
+}
+
+inline void FutexWakeOne(std::atomic<uint32_t>& value) {
+#ifdef _WIN32
+    WakeByAddressSingle(&value);
+#elif defined(__linux__)
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(&value), FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
+#else
+    value.notify_one();
+#endif
+}
+
+inline void FutexWakeAll(std::atomic<uint32_t>& value) {
+#ifdef _WIN32
+    WakeByAddressAll(&value);
+#elif defined(__linux__)
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(&value), FUTEX_WAKE_PRIVATE, INT32_MAX, nullptr, nullptr, 0);
+#else
+    value.notify_all();
+#endif
+}
+
+}
+}
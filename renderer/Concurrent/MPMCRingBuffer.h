@@ -0,0 +1,136 @@
+#pragma once
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <assert.h>
+#include <atomic>
+#include <utility>
+#include "Common/Uncopyable.h"
+
+namespace glacier {
+namespace concurrent {
+
+#define CACHE_LINE_SIZE 64
+
+//Multi producer/Multi consumer, bounded lock-free queue (Dmitry Vyukov's algorithm).
+//Every cell carries a sequence number telling whether it is ready to be written or read,
+//producers and consumers only contend on their own position counter.
+template<typename T, size_t Capacity>
+class MPMCRingBuffer : private Uncopyable {
+public:
+    static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0, "Capacity must be power of 2");
+
+    MPMCRingBuffer() {
+        for (size_t i = 0; i < Capacity; ++i) {
+            cells_[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    constexpr size_t capacity() const { return Capacity; }
+
+    //approximate when used concurrently
+    size_t size() const {
+        size_t head = enqueue_pos_.load(std::memory_order_relaxed);
+        size_t tail = dequeue_pos_.load(std::memory_order_relaxed);
+        return head >= tail ? head - tail : 0;
+    }
+
+    bool Push(const T& v) {
+        return Push([&v](T& slot) { slot = v; });
+    }
+
+    bool Push(T&& v) {
+        return Push([&v](T& slot) { slot = std::move(v); });
+    }
+
+    //func constructs the value in place, the slot is published when it returns
+    template<typename F>
+    bool Push(const F& func) {
+        size_t pos;
+        Cell* cell = AcquireWrite(pos);
+        if (!cell) {
+            return false;
+        }
+
+        func(cell->value);
+        cell->sequence.store(pos + 1, std::memory_order_release);
+
+        return true;
+    }
+
+    bool Pop(T& v) {
+        return Pop([&v](T& slot) { std::swap(v, slot); });
+    }
+
+    //func consumes the value in place, the slot is recycled when it returns
+    template<typename F>
+    bool Pop(const F& func) {
+        size_t pos;
+        Cell* cell = AcquireRead(pos);
+        if (!cell) {
+            return false;
+        }
+
+        func(cell->value);
+        cell->sequence.store(pos + kMask + 1, std::memory_order_release);
+
+        return true;
+    }
+
+protected:
+    struct Cell {
+        std::atomic<size_t> sequence;
+        T value;
+    };
+
+    static constexpr size_t kMask = Capacity - 1;
+
+    Cell* AcquireWrite(size_t& pos) {
+        pos = enqueue_pos_.load(std::memory_order_relaxed);
+        while (true) {
+            Cell* cell = &cells_[pos & kMask];
+            size_t seq = cell->sequence.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+
+            if (diff == 0) {
+                if (enqueue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    return cell;
+                }
+            }
+            else if (diff < 0) { //full
+                return nullptr;
+            }
+            else {
+                pos = enqueue_pos_.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    Cell* AcquireRead(size_t& pos) {
+        pos = dequeue_pos_.load(std::memory_order_relaxed);
+        while (true) {
+            Cell* cell = &cells_[pos & kMask];
+            size_t seq = cell->sequence.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+
+            if (diff == 0) {
+                if (dequeue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    return cell;
+                }
+            }
+            else if (diff < 0) { //empty
+                return nullptr;
+            }
+            else {
+                pos = dequeue_pos_.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    alignas(CACHE_LINE_SIZE) std::atomic<size_t> enqueue_pos_ = 0;
+    alignas(CACHE_LINE_SIZE) std::atomic<size_t> dequeue_pos_ = 0;
+    alignas(CACHE_LINE_SIZE) Cell cells_[Capacity];
+};
+
+}
+}
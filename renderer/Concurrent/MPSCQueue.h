@@ -0,0 +1,98 @@
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include "Common/Uncopyable.h"
+
+namespace glacier {
+namespace concurrent {
+
+#define CACHE_LINE_SIZE 64
+
+//Link embedded in the items of a MPSCQueue, an item is in one queue at a time
+struct MPSCNode {
+    std::atomic<MPSCNode*> mpsc_next = nullptr;
+};
+
+//Multi producer/Single consumer, unbounded intrusive queue (Dmitry Vyukov's algorithm).
+//Push is one exchange and never fails or allocates, T derives from MPSCNode.
+//Pop and Peek belong to one consumer at a time, they may miss an item whose Push
+//is halfway through and report it on the next call.
+template<typename T>
+class MPSCQueue : private Uncopyable {
+public:
+    MPSCQueue() : head_(&stub_), tail_(&stub_) {}
+
+    void Push(T* item) {
+        Push(static_cast<MPSCNode*>(item));
+    }
+
+    //consumer only
+    T* Pop() {
+        MPSCNode* tail = SkipStub();
+        if (!tail) {
+            return nullptr;
+        }
+
+        MPSCNode* next = tail->mpsc_next.load(std::memory_order_acquire);
+        if (next) {
+            tail_ = next;
+            return static_cast<T*>(tail);
+        }
+
+        //tail is the last item, a producer swapped the head but didn't link its item yet
+        if (tail != head_.load(std::memory_order_acquire)) {
+            return nullptr;
+        }
+
+        //put the stub behind the last item so it can be unlinked
+        Push(&stub_);
+        next = tail->mpsc_next.load(std::memory_order_acquire);
+        if (next) {
+            tail_ = next;
+            return static_cast<T*>(tail);
+        }
+
+        return nullptr;
+    }
+
+    //consumer only, the item Pop returns next
+    T* Peek() {
+        MPSCNode* tail = SkipStub();
+        return tail ? static_cast<T*>(tail) : nullptr;
+    }
+
+    //approximate when used concurrently
+    bool Empty() const {
+        return tail_ == &stub_ && !stub_.mpsc_next.load(std::memory_order_acquire);
+    }
+
+private:
+    void Push(MPSCNode* node) {
+        node->mpsc_next.store(nullptr, std::memory_order_relaxed);
+        MPSCNode* prev = head_.exchange(node, std::memory_order_acq_rel);
+        prev->mpsc_next.store(node, std::memory_order_release);
+    }
+
+    MPSCNode* SkipStub() {
+        MPSCNode* tail = tail_;
+        if (tail == &stub_) {
+            MPSCNode* next = tail->mpsc_next.load(std::memory_order_acquire);
+            if (!next) {
+                return nullptr;
+            }
+
+            tail_ = next;
+            tail = next;
+        }
+
+        return tail;
+    }
+
+    alignas(CACHE_LINE_SIZE) std::atomic<MPSCNode*> head_; //producers
+    alignas(CACHE_LINE_SIZE) MPSCNode* tail_; //consumer
+    MPSCNode stub_;
+};
+
+}
+}
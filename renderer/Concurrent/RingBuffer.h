@@ -6,15 +6,16 @@
 #include <atomic>
 #include <functional>
 #include "Common/Uncopyable.h"
-#include "common/bitutil.h"
-#include "spinlock.h"
+#include "Common/BitUtil.h"
+#include "SpinLock.h"
 
 namespace glacier {
 namespace concurrent {
 
 #define CACHE_LINE_SIZE 64
 
-//Single producer/Single consumer
+//SpinLock guarded, safe for any number of producers/consumers.
+//Prefer MPMCRingBuffer/SPSCRingBuffer on hot paths.
 template<typename T, size_t Capacity>
 class RingBuffer : private Uncopyable {
 public:
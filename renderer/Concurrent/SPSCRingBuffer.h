@@ -0,0 +1,89 @@
+#pragma once
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <assert.h>
+#include <atomic>
+#include <utility>
+#include "Common/Uncopyable.h"
+
+namespace glacier {
+namespace concurrent {
+
+#define CACHE_LINE_SIZE 64
+
+//Single producer/Single consumer, wait-free bounded queue.
+//Each side owns its index and keeps a cached copy of the other one,
+//so the shared line is only touched when the cached view says full/empty.
+template<typename T, size_t Capacity>
+class SPSCRingBuffer : private Uncopyable {
+public:
+    static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0, "Capacity must be power of 2");
+
+    constexpr size_t capacity() const { return Capacity; }
+
+    //approximate when used concurrently
+    size_t size() const {
+        return head_.load(std::memory_order_acquire) - tail_.load(std::memory_order_acquire);
+    }
+
+    bool Push(const T& v) {
+        return Push([&v](T& slot) { slot = v; });
+    }
+
+    bool Push(T&& v) {
+        return Push([&v](T& slot) { slot = std::move(v); });
+    }
+
+    //Producer only
+    template<typename F>
+    bool Push(const F& func) {
+        size_t head = head_.load(std::memory_order_relaxed);
+        if (head - cached_tail_ == Capacity) {
+            cached_tail_ = tail_.load(std::memory_order_acquire);
+            if (head - cached_tail_ == Capacity) {
+                return false;
+            }
+        }
+
+        func(data_[head & kMask]);
+        head_.store(head + 1, std::memory_order_release);
+
+        return true;
+    }
+
+    bool Pop(T& v) {
+        return Pop([&v](T& slot) { std::swap(v, slot); });
+    }
+
+    //Consumer only
+    template<typename F>
+    bool Pop(const F& func) {
+        size_t tail = tail_.load(std::memory_order_relaxed);
+        if (tail == cached_head_) {
+            cached_head_ = head_.load(std::memory_order_acquire);
+            if (tail == cached_head_) {
+                return false;
+            }
+        }
+
+        func(data_[tail & kMask]);
+        tail_.store(tail + 1, std::memory_order_release);
+
+        return true;
+    }
+
+protected:
+    static constexpr size_t kMask = Capacity - 1;
+
+    alignas(CACHE_LINE_SIZE) std::atomic<size_t> head_ = 0; //written by producer
+    size_t cached_tail_ = 0;
+
+    alignas(CACHE_LINE_SIZE) std::atomic<size_t> tail_ = 0; //written by consumer
+    size_t cached_head_ = 0;
+
+    alignas(CACHE_LINE_SIZE) T data_[Capacity];
+};
+
+}
+}
@@ -3,13 +3,30 @@
 #include <atomic>
 #include "Common/Uncopyable.h"
 
+#if !defined(_WIN32) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#endif
+
 namespace glacier {
 namespace concurrent {
 
+//Hint to the core that the caller is busy waiting
+inline void CpuRelax() {
+#ifdef _WIN32
+    YieldProcessor();
+#elif defined(__x86_64__) || defined(__i386__)
+    _mm_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield");
+#endif
+}
+
 class SpinLock : private Uncopyable {
 public:
     void Lock() {
-        while (!TryLock()) {};
+        while (!TryLock()) {
+            CpuRelax();
+        }
     }
 
     bool TryLock() {
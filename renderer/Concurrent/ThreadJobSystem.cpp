@@ -1,6 +1,5 @@
-#pragma once
-
 #include "ThreadJobSystem.h"
+#include <algorithm>
 #include <thread>
 #include <string>
 
@@ -27,7 +26,9 @@ void ThreadJobSystem::Initialize(uint32_t thread_count) {
                 {
                     // no job, put thread to sleep
                     std::unique_lock<std::mutex> lock(wakeMutex);
-                    wakeCondition.wait(lock);
+                    //alive is cleared under the lock, the exit can't slip in before the wait
+                    if (alive.load())
+                        wakeCondition.wait(lock);
                 }
             }
         });
@@ -71,7 +72,19 @@ void ThreadJobSystem::Initialize(uint32_t thread_count) {
 #undef handle_error_en
 #endif // _WIN32
 
-        worker.detach();
+        workers.push_back(std::move(worker));
+    }
+}
+
+ThreadJobSystem::~ThreadJobSystem() {
+    {
+        std::lock_guard<std::mutex> lock(wakeMutex);
+        alive.store(false);
+    }
+
+    wakeCondition.notify_all();
+    for (auto& worker : workers) {
+        worker.join();
     }
 }
 
@@ -7,11 +7,13 @@
 #include <functional>
 #include <condition_variable>
 #include <mutex>
+#include <thread>
+#include <vector>
 #include "Common/Uncopyable.h"
-#include "Common/Bitutil.h"
-#include "Spinlock.h"
+#include "Common/BitUtil.h"
+#include "SpinLock.h"
 #include "Common/Singleton.h"
-#include "RingBuffer.h"
+#include "MPMCRingBuffer.h"
 
 namespace glacier {
 namespace concurrent {
@@ -35,6 +37,8 @@ public:
         uint32_t groupJobEnd;
     };
 
+    ~ThreadJobSystem();
+
     void Initialize(uint32_t thread_count);
 
     bool IsBusy();
@@ -51,9 +55,10 @@ private:
     uint32_t numThreads;
     uint32_t numCores;
     
-    RingBuffer<Job, 256> jobQueue;
+    MPMCRingBuffer<Job, 256> jobQueue;
 
     std::atomic<uint32_t> counter{ ATOMIC_FLAG_INIT };
+    std::vector<std::thread> workers;
     std::atomic_bool alive{ true };
     std::condition_variable wakeCondition;
     std::mutex wakeMutex;
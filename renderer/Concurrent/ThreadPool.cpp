@@ -1,9 +1,14 @@
-#pragma once
-
 #include "ThreadPool.h"
+#include <algorithm>
 #include <thread>
 #include <string>
 
+#if defined(__linux__)
+#include <errno.h>
+#include <stdio.h>
+#include <pthread.h>
+#endif
+
 namespace glacier {
 namespace concurrent {
 
@@ -12,14 +17,32 @@ ThreadPool::~ThreadPool() {
     JoinAll();
 }
 
-void ThreadPool::Initialize(uint32_t thread_count) {
+void ThreadPool::Initialize(uint32_t thread_count, const ThreadAffinity& affinity) {
     if (!threads_.empty())
         return;
 
+    auto& topology = CpuTopology::Get();
+    std::vector<uint32_t> cpus = topology.GetCpus(affinity.cores);
+    if (cpus.empty()) { //e.g. no SMT or no efficiency cores
+        cpus = topology.GetCpus(CoreSet::kAll);
+    }
+
+    uint32_t first_cpu = 0;
+    if (affinity.reserve_caller && cpus.size() > 1) {
+        first_cpu = 1;
+
+        if (affinity.pin_caller) {
+            CpuTopology::SetCurrentThreadAffinity(cpus[0]);
+        }
+    }
+
     thread_count = std::max(1u, thread_count);
-    num_cores_ = std::thread::hardware_concurrency();
-    uint32_t num_threads = std::min(thread_count, std::max(1u, num_cores_ - 1));
+    num_cores_ = (uint32_t)cpus.size();
+    uint32_t num_threads = std::min(thread_count, num_cores_ - first_cpu);
     threads_.reserve(num_threads);
+    if (affinity.pin) {
+        thread_cpus_.assign(cpus.begin() + first_cpu, cpus.begin() + first_cpu + num_threads);
+    }
 
     for (uint32_t thread_id = 0; thread_id < num_threads; ++thread_id) {
         threads_.emplace_back([this] {
@@ -32,16 +55,17 @@ void ThreadPool::Initialize(uint32_t thread_count) {
             }
         });
 
-        auto& worker = threads_[thread_id];
+        [[maybe_unused]] auto& worker = threads_[thread_id];
 
 #ifdef _WIN32
         // Do Windows-specific thread setup:
         HANDLE handle = (HANDLE)worker.native_handle();
 
         // Put each thread on to dedicated core:
-        DWORD_PTR affinityMask = 1ull << thread_id;
-        DWORD_PTR affinity_result = SetThreadAffinityMask(handle, affinityMask);
-        assert(affinity_result > 0);
+        if (affinity.pin) {
+            bool affinity_result = CpuTopology::SetThreadAffinity(handle, thread_cpus_[thread_id]);
+            assert(affinity_result);
+        }
 
         //// Increase thread priority:
         BOOL priority_result = SetThreadPriority(handle, THREAD_PRIORITY_ABOVE_NORMAL);
@@ -51,22 +75,16 @@ void ThreadPool::Initialize(uint32_t thread_count) {
         std::wstring wthreadname = L"glacier::ThreadPool " + std::to_wstring(thread_id);
         HRESULT hr = SetThreadDescription(handle, wthreadname.c_str());
         assert(SUCCEEDED(hr));
-#elif defined(PLATFORM_LINUX)
+#elif defined(__linux__)
 #define handle_error_en(en, msg) \
                do { errno = en; perror(msg); } while (0)
 
         int ret;
-        cpu_set_t cpuset;
-        CPU_ZERO(&cpuset);
-        size_t cpusetsize = sizeof(cpuset);
-
-        CPU_SET(thread_id, &cpuset);
-        ret = pthread_setaffinity_np(worker.native_handle(), cpusetsize, &cpuset);
-        if (ret != 0)
-            handle_error_en(ret, std::string(" pthread_setaffinity_np[" + std::to_string(thread_id) + ']').c_str());
+        if (affinity.pin && !CpuTopology::SetThreadAffinity(worker.native_handle(), thread_cpus_[thread_id]))
+            handle_error_en(EINVAL, std::string(" pthread_setaffinity_np[" + std::to_string(thread_id) + ']').c_str());
 
         // Name the thread
-        std::string thread_name = "glacier::ThreadPool " + std::to_string(thread_id);
+        std::string thread_name = "ThreadPool " + std::to_string(thread_id); // 15 chars at most
         ret = pthread_setname_np(worker.native_handle(), thread_name.c_str());
         if (ret != 0)
             handle_error_en(ret, std::string(" pthread_setname_np[" + std::to_string(thread_id) + ']').c_str());
@@ -121,6 +139,7 @@ void ThreadPool::JoinAll() {
     }
 
     threads_.clear();
+    thread_cpus_.clear();
 }
 
 void ThreadPool::Schedule(Task&& task) {
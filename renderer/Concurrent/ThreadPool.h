@@ -7,22 +7,35 @@
 #include <functional>
 #include <condition_variable>
 #include <mutex>
+#include <thread>
+#include <vector>
 #include <exception>
 #include "Common/Uncopyable.h"
-#include "Common/Bitutil.h"
-#include "Spinlock.h"
-#include "RingBuffer.h"
+#include "Common/BitUtil.h"
+#include "SpinLock.h"
+#include "MPMCRingBuffer.h"
+#include "CpuTopology.h"
 
 namespace glacier {
 namespace concurrent {
 
+//Which cpus the pool runs on, pools on different core sets
+//(performance cores for frame work, SMT siblings for background work) don't compete
+struct ThreadAffinity {
+    CoreSet cores = CoreSet::kAll;
+    bool pin = true; //one thread per logical cpu of the set, otherwise the os schedules them
+    bool reserve_caller = true; //leave the first cpu of the set to the thread calling Initialize
+    bool pin_caller = false; //and pin that thread to it
+};
+
 class ThreadPool : private Uncopyable {
 public:
     using Task = std::function<void()>;
 
     ~ThreadPool();
 
-    void Initialize(uint32_t thread_count);
+    //At most one thread per cpu of the set
+    void Initialize(uint32_t thread_count, const ThreadAffinity& affinity = {});
 
     bool IsBusy() noexcept;
     bool IsRunning() noexcept;
@@ -30,7 +43,9 @@ public:
     void WaitUntilFinish();
     void JoinAll();
 
-    size_t GetThreadCount() { return threads_.size(); }
+    size_t GetThreadCount() const { return threads_.size(); }
+    //logical cpu of every thread, empty if not pinned
+    const std::vector<uint32_t>& GetThreadCpus() const { return thread_cpus_; }
 
     void Schedule(Task&& task);
 
@@ -41,9 +56,10 @@ private:
 
     uint32_t num_cores_;
     std::vector<std::thread> threads_;
-    RingBuffer<Task, 256> task_queue_;
+    std::vector<uint32_t> thread_cpus_;
+    MPMCRingBuffer<Task, 256> task_queue_;
 
-    RingBuffer<std::exception_ptr, 64> thread_exceptions_;
+    MPMCRingBuffer<std::exception_ptr, 64> thread_exceptions_;
 
     std::atomic<uint32_t> counter_{ ATOMIC_FLAG_INIT };
     std::atomic_bool alive_{ true };
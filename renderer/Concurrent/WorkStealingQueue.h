@@ -0,0 +1,104 @@
+#pragma once
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <assert.h>
+#include <atomic>
+#include <type_traits>
+#include "Common/Uncopyable.h"
+
+namespace glacier {
+namespace concurrent {
+
+#define CACHE_LINE_SIZE 64
+
+//Bounded Chase-Lev deque (see "Correct and Efficient Work-Stealing for Weak Memory Models", Le et al.)
+//Single owner pushes/pops at the bottom without contention, any thread may steal from the top.
+template<typename T, size_t Capacity>
+class WorkStealingQueue : private Uncopyable {
+public:
+    static_assert((Capacity & (Capacity - 1)) == 0, "Capacity must be power of 2");
+    static_assert(std::is_trivially_copyable<T>::value, "T must be trivially copyable");
+
+    constexpr size_t capacity() const { return Capacity; }
+
+    size_t size() const {
+        int64_t b = bottom_.load(std::memory_order_relaxed);
+        int64_t t = top_.load(std::memory_order_relaxed);
+        return b > t ? (size_t)(b - t) : 0;
+    }
+
+    bool empty() const { return size() == 0; }
+
+    //Owner only
+    bool Push(T v) {
+        int64_t b = bottom_.load(std::memory_order_relaxed);
+        int64_t t = top_.load(std::memory_order_acquire);
+        if (b - t >= (int64_t)Capacity) {
+            return false;
+        }
+
+        data_[b & kMask].store(v, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        bottom_.store(b + 1, std::memory_order_relaxed);
+
+        return true;
+    }
+
+    //Owner only, LIFO
+    bool Pop(T& v) {
+        int64_t b = bottom_.load(std::memory_order_relaxed) - 1;
+        bottom_.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t t = top_.load(std::memory_order_relaxed);
+
+        if (t > b) { //empty
+            bottom_.store(b + 1, std::memory_order_relaxed);
+            return false;
+        }
+
+        T x = data_[b & kMask].load(std::memory_order_relaxed);
+        if (t == b) { //last one, race against thieves
+            bool won = top_.compare_exchange_strong(t, t + 1,
+                std::memory_order_seq_cst, std::memory_order_relaxed);
+            bottom_.store(b + 1, std::memory_order_relaxed);
+            if (!won) {
+                return false;
+            }
+        }
+
+        v = x;
+        return true;
+    }
+
+    //Any thread, FIFO
+    bool Steal(T& v) {
+        int64_t t = top_.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t b = bottom_.load(std::memory_order_acquire);
+
+        if (t >= b) {
+            return false;
+        }
+
+        T x = data_[t & kMask].load(std::memory_order_relaxed);
+        if (!top_.compare_exchange_strong(t, t + 1,
+            std::memory_order_seq_cst, std::memory_order_relaxed))
+        {
+            return false;
+        }
+
+        v = x;
+        return true;
+    }
+
+protected:
+    static constexpr int64_t kMask = Capacity - 1;
+
+    alignas(CACHE_LINE_SIZE) std::atomic<int64_t> top_ = 0;
+    alignas(CACHE_LINE_SIZE) std::atomic<int64_t> bottom_ = 0;
+    alignas(CACHE_LINE_SIZE) std::atomic<T> data_[Capacity];
+};
+
+}
+}
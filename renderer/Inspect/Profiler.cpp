@@ -2,11 +2,149 @@
 #include <float.h>
 #include <string.h>
 #include <stdarg.h>
+#include <stdio.h>
+#include <math.h>
+#include <atomic>
 #include "Math/Util.h"
 #include "Common/Log.h"
+#include "Jobs/JobSystem.h"
+
+#if defined(__linux__)
+#include <unistd.h>
+#include <sys/syscall.h>
+#endif
 
 namespace glacier {
 
+namespace {
+
+enum class SampleEventType : uint8_t {
+    kBegin,
+    kEnd,
+};
+
+struct SampleEvent {
+    Profiler::TimePoint time;
+    const char* name;
+    const char* context; //job the sample began in, top level samples only
+    SampleEventType type;
+};
+
+uint32_t GetOsThreadId() {
+#ifdef _WIN32
+    return (uint32_t)GetCurrentThreadId();
+#elif defined(__linux__)
+    return (uint32_t)syscall(SYS_gettid);
+#else
+    return 0;
+#endif
+}
+
+constexpr double kNanoToMilli = Profiler::Node::kNanoToMilli;
+
+void AppendJsonString(std::string& json, const char* str) {
+    json += '"';
+    for (; *str; ++str) {
+        char c = *str;
+        if (c == '"' || c == '\\') {
+            json += '\\';
+            json += c;
+        }
+        else if ((unsigned char)c >= 0x20) {
+            json += c;
+        }
+    }
+    json += '"';
+}
+
+void AppendNumber(std::string& json, double value) {
+    char buf[64];
+    snprintf(buf, sizeof(buf), "%.4f", isfinite(value) ? value : 0.0);
+    json += buf;
+}
+
+//"key": {"avg": , "p50": , "p95": , "p99": , "max": , "history": [...]}
+void AppendStats(std::string& json, const Statistic& stats) {
+    json += "\"avg\": ";
+    AppendNumber(json, stats.average());
+    json += ", \"p50\": ";
+    AppendNumber(json, stats.p50());
+    json += ", \"p95\": ";
+    AppendNumber(json, stats.p95());
+    json += ", \"p99\": ";
+    AppendNumber(json, stats.p99());
+    json += ", \"max\": ";
+    AppendNumber(json, stats.samples() > 0 ? stats.max() : 0.0);
+    json += ", \"history\": [";
+    for (uint32_t i = 0; i < stats.history_count(); ++i) {
+        json += i > 0 ? ", " : "";
+        AppendNumber(json, stats.history(i));
+    }
+    json += "]";
+}
+
+std::string GetScopeName(const Profiler::Node& node) {
+    return node.IsJobContext() ? std::string("[job] ") + node.name() : std::string(node.name());
+}
+
+//"Render/Lighting Pass"
+std::string GetScopePath(const Profiler::Node& node) {
+    std::string path = GetScopeName(node);
+    for (auto parent = node.parent(); parent && !parent->IsRoot(); parent = parent->parent()) {
+        path = GetScopeName(*parent) + "/" + path;
+    }
+
+    return path;
+}
+
+bool WriteFile(const char* path, const std::string& content) {
+    FILE* file = fopen(path, "wb");
+    if (!file) {
+        return false;
+    }
+
+    bool result = fwrite(content.data(), 1, content.size(), file) == content.size();
+    fclose(file);
+
+    return result;
+}
+
+}
+
+//Single producer (the owner thread)/single consumer (Merge) ring of events
+struct Profiler::SampleBuffer {
+    static constexpr uint32_t kMask = kBufferCapacity - 1;
+    static_assert((kBufferCapacity & kMask) == 0, "kBufferCapacity must be power of 2");
+
+    SampleBuffer(uint32_t tid, uint32_t worker) : tree(tid, worker) {}
+
+    //reserve: free slots required, so the ends of the samples already pushed always fit
+    bool Push(const SampleEvent& event, uint32_t reserve) {
+        uint32_t write = write_index.load(std::memory_order_relaxed);
+        uint32_t read = read_index.load(std::memory_order_acquire);
+        if (write - read + reserve > kBufferCapacity) {
+            return false;
+        }
+
+        events[write & kMask] = event;
+        write_index.store(write + 1, std::memory_order_release);
+        return true;
+    }
+
+    SampleEvent events[kBufferCapacity];
+    alignas(64) std::atomic<uint32_t> write_index = 0;
+    alignas(64) std::atomic<uint32_t> read_index = 0;
+    std::atomic<uint64_t> dropped = 0;
+
+    //owner only
+    alignas(64) uint32_t depth = 0; //open samples
+    uint32_t pushed_depth = 0; //open samples whose begin is in the buffer
+    uint32_t drop_depth = 0; //depth of the first dropped open sample, 0 if none
+
+    //merging thread only
+    ThreadTree tree;
+};
+
 Profiler::Node::Node(const char* name, Node* parent) :
     name_(name),
     total_calls_(0),
@@ -17,25 +155,16 @@ Profiler::Node::Node(const char* name, Node* parent) :
 {
 }
 
-Profiler::Node* Profiler::Node::GetChild(const char* name) {
-    for (auto it = children_.begin(); it != children_.end(); ++it) {
-        if (it->name_ == name) {
-            return &(*it);
-        }
-    }
-
-    children_.emplace_back(name, this);
-    return &children_.back();
-}
-
-void Profiler::Node::BeginSample() {
+void Profiler::Node::BeginSample(TimePoint time) {
     ++total_calls_;
-    begin_time_ = ClockType::now();
+    ++frame_calls_;
+    begin_time_ = time;
 }
 
-void Profiler::Node::EndSample() {
-    auto diff = ClockType::now() - begin_time_;
+void Profiler::Node::EndSample(TimePoint time) {
+    auto diff = time - begin_time_;
     total_time_ += diff;
+    frame_time_ += diff;
 
     if (diff > max_time_) {
         max_time_ = diff;
@@ -55,25 +184,332 @@ double Profiler::Node::total_time() const {
     }
 }
 
-Profiler::Profiler() : root_("Root", nullptr) {
-    current_node_ = &root_;
-    current_node_->BeginSample();
+Profiler::ThreadTree::ThreadTree(uint32_t tid, uint32_t worker) :
+    tid_(tid),
+    worker_(worker),
+    root_("Root", nullptr)
+{
+    if (worker == jobs::kInvalidWorker) {
+        snprintf(name_, sizeof(name_), "thread %u", tid);
+    }
+    else {
+        snprintf(name_, sizeof(name_), "job worker %u (thread %u)", worker, tid);
+    }
+
+    current_ = &root_;
+    root_.BeginSample(ClockType::now());
+}
+
+Profiler::Node* Profiler::ThreadTree::GetChild(Node* parent, const char* name, bool job_context) {
+    ChildKey key{ parent, name, job_context };
+    auto it = child_table_.find(key);
+    if (it != child_table_.end()) {
+        return it->second;
+    }
+
+    Node& node = nodes_.emplace_back(name, parent);
+    node.job_context_ = job_context;
+    parent->children_.push_back(&node);
+    child_table_.emplace(key, &node);
+
+    return &node;
+}
+
+Profiler::Profiler() {
+    frame_begin_ = ClockType::now();
+    GetThreadBuffer();
+}
+
+Profiler::~Profiler() {
+}
+
+Profiler::SampleBuffer*& Profiler::GetThreadBufferRef() {
+    static thread_local SampleBuffer* buffer = nullptr;
+    return buffer;
+}
+
+//fibers move between threads, the thread local must be looked up again after every switch
+FIBER_NOINLINE Profiler::SampleBuffer* Profiler::GetThreadBuffer() {
+    SampleBuffer*& buffer = GetThreadBufferRef();
+    if (!buffer) {
+        std::lock_guard<std::mutex> guard(registry_lock_);
+        buffer = new SampleBuffer(GetOsThreadId(), jobs::JobSystem::GetCurrentWorker());
+        buffers_.emplace_back(buffer);
+    }
+
+    return buffer;
 }
 
 void Profiler::BeginSample(const char* name) {
-    current_node_ = current_node_->GetChild(name);
-    current_node_->BeginSample();
+    SampleBuffer* buffer = GetThreadBuffer();
+    ++buffer->depth;
+
+    //children of a dropped sample are dropped with it
+    if (buffer->drop_depth > 0) {
+        buffer->dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    const char* context = nullptr;
+    if (buffer->depth == 1) {
+        const jobs::Job* job = jobs::JobSystem::Instance()->GetCurrentJob();
+        if (job) {
+            context = job->name ? job->name : "job";
+        }
+    }
+
+    SampleEvent event{ ClockType::now(), name, context, SampleEventType::kBegin };
+    if (buffer->Push(event, buffer->pushed_depth + 2)) {
+        ++buffer->pushed_depth;
+    }
+    else {
+        buffer->drop_depth = buffer->depth;
+        buffer->dropped.fetch_add(1, std::memory_order_relaxed);
+    }
 }
 
 void Profiler::EndSample() {
-    assert(current_node_ != &root_);
+    SampleBuffer* buffer = GetThreadBuffer();
+    assert(buffer->depth > 0);
+    if (buffer->depth == 0) {
+        return;
+    }
 
-    current_node_->EndSample();
-    current_node_ = current_node_->parent();
+    if (buffer->drop_depth > 0) {
+        if (buffer->drop_depth == buffer->depth) {
+            buffer->drop_depth = 0;
+        }
+    }
+    else {
+        SampleEvent event{ ClockType::now(), nullptr, nullptr, SampleEventType::kEnd };
+        bool pushed = buffer->Push(event, 1);
+        assert(pushed);
+        --buffer->pushed_depth;
+    }
+
+    --buffer->depth;
+}
+
+void Profiler::Merge() {
+    //threads sampling for the first time wait for the merge, the others never take the lock
+    std::lock_guard<std::mutex> guard(registry_lock_);
+    MergeLocked();
+}
+
+void Profiler::MergeLocked() {
+    trees_.resize(buffers_.size());
+    for (size_t i = 0; i < buffers_.size(); ++i) {
+        MergeBuffer(*buffers_[i]);
+        trees_[i] = &buffers_[i]->tree;
+    }
+}
+
+void Profiler::MergeBuffer(SampleBuffer& buffer) {
+    ThreadTree& tree = buffer.tree;
+
+    uint32_t read = buffer.read_index.load(std::memory_order_relaxed);
+    uint32_t write = buffer.write_index.load(std::memory_order_acquire);
+    for (; read != write; ++read) {
+        const SampleEvent& event = buffer.events[read & SampleBuffer::kMask];
+        if (event.type == SampleEventType::kBegin) {
+            if (event.context) {
+                tree.current_ = tree.GetChild(tree.current_, event.context, true);
+                tree.current_->BeginSample(event.time);
+            }
+
+            tree.current_ = tree.GetChild(tree.current_, event.name, false);
+            tree.current_->BeginSample(event.time);
+        }
+        else {
+            assert(tree.current_ != &tree.root_);
+
+            tree.current_->EndSample(event.time);
+            tree.current_ = tree.current_->parent();
+
+            if (tree.current_->job_context_) {
+                tree.current_->EndSample(event.time);
+                tree.current_ = tree.current_->parent();
+            }
+        }
+    }
+
+    buffer.read_index.store(write, std::memory_order_release);
+}
+
+void Profiler::EndFrame() {
+    std::lock_guard<std::mutex> guard(registry_lock_);
+    MergeLocked();
+
+    TimePoint now = ClockType::now();
+    double frame_time = (now - frame_begin_).count() * kNanoToMilli;
+    frame_begin_ = now;
+
+    //against the frames before, a long hitch must not raise its own bar
+    if (frame_stats_.history_count() >= kHitchWarmup) {
+        double median_time = frame_stats_.p50();
+        if (frame_time > median_time * hitch_config_.factor &&
+            frame_time - median_time > hitch_config_.min_time)
+        {
+            CaptureHitch(frame_time, median_time);
+        }
+    }
+
+    frame_stats_.Sample(frame_time);
+    ++frame_count_;
+
+    for (auto tree : trees_) {
+        for (auto& node : tree->nodes_) {
+            node.frame_stats_.Sample(node.frame_time_.count() * kNanoToMilli);
+            node.frame_time_ = TimeDuration{ 0 };
+            node.frame_calls_ = 0;
+        }
+    }
+}
+
+void Profiler::CaptureHitch(double frame_time, double median_time) {
+    if (hitches_.size() >= kMaxHitchCaptures) {
+        hitches_.pop_front();
+    }
+
+    HitchCapture& capture = hitches_.emplace_back();
+    capture.frame = frame_count_;
+    capture.frame_time = frame_time;
+    capture.median_time = median_time;
+
+    for (auto tree : trees_) {
+        CaptureRecursively(*tree, tree->root_, std::string(), 0, capture);
+    }
+
+    LOG_LOG("hitch at frame {}: {:.3f} ms, median {:.3f} ms", capture.frame, frame_time, median_time);
+}
+
+void Profiler::CaptureRecursively(const ThreadTree& tree, const Node& node, const std::string& path,
+    uint32_t depth, HitchCapture& capture)
+{
+    for (auto child : node.children_) {
+        if (child->frame_calls_ == 0) {
+            continue;
+        }
+
+        std::string child_path = path.empty() ? GetScopeName(*child) : path + "/" + GetScopeName(*child);
+        capture.scopes.push_back({ tree.name_, child_path, depth, child->frame_calls_,
+            child->frame_time_.count() * kNanoToMilli });
+
+        CaptureRecursively(tree, *child, child_path, depth + 1, capture);
+    }
+}
+
+bool Profiler::DumpCsv(const char* path) {
+    std::lock_guard<std::mutex> guard(registry_lock_);
+
+    std::string csv = "thread,scope,frame,time_ms\n";
+    char buf[64];
+
+    //frame indices are absolute, the histories all end at the last frame
+    auto append_history = [&](const char* thread, const std::string& scope, const Statistic& stats) {
+        uint64_t first = frame_count_ - stats.history_count();
+        for (uint32_t i = 0; i < stats.history_count(); ++i) {
+            snprintf(buf, sizeof(buf), ",%llu,%.4f\n", (unsigned long long)(first + i), stats.history(i));
+            csv += thread;
+            csv += ",\"" + scope + "\"";
+            csv += buf;
+        }
+    };
+
+    append_history("", "Frame", frame_stats_);
+
+    for (auto tree : trees_) {
+        for (auto& node : tree->nodes_) {
+            std::string scope = GetScopePath(node);
+
+            append_history(tree->name_, scope, node.frame_stats_);
+        }
+    }
+
+    return WriteFile(path, csv);
+}
+
+bool Profiler::DumpJson(const char* path) {
+    std::lock_guard<std::mutex> guard(registry_lock_);
+
+    std::string json = "{\n  \"frames\": ";
+    json += std::to_string(frame_count_);
+    json += ",\n  \"frame\": {";
+    AppendStats(json, frame_stats_);
+    json += "},\n  \"scopes\": [\n";
+
+    bool first = true;
+    for (auto tree : trees_) {
+        for (auto& node : tree->nodes_) {
+            std::string scope = GetScopePath(node);
+
+            json += first ? "    {\"thread\": " : ",\n    {\"thread\": ";
+            first = false;
+            AppendJsonString(json, tree->name_);
+            json += ", \"path\": ";
+            AppendJsonString(json, scope.c_str());
+            json += ", \"calls\": ";
+            json += std::to_string(node.total_calls_);
+            json += ", ";
+            AppendStats(json, node.frame_stats_);
+            json += "}";
+        }
+    }
+
+    json += "\n  ],\n  \"hitches\": [\n";
+    for (size_t i = 0; i < hitches_.size(); ++i) {
+        auto& hitch = hitches_[i];
+        json += "    {\"frame\": ";
+        json += std::to_string(hitch.frame);
+        json += ", \"frame_time\": ";
+        AppendNumber(json, hitch.frame_time);
+        json += ", \"median_time\": ";
+        AppendNumber(json, hitch.median_time);
+        json += ", \"scopes\": [";
+        for (size_t j = 0; j < hitch.scopes.size(); ++j) {
+            auto& scope = hitch.scopes[j];
+            json += j > 0 ? ", {\"thread\": " : "{\"thread\": ";
+            AppendJsonString(json, scope.thread.c_str());
+            json += ", \"path\": ";
+            AppendJsonString(json, scope.path.c_str());
+            json += ", \"calls\": ";
+            json += std::to_string(scope.calls);
+            json += ", \"time\": ";
+            AppendNumber(json, scope.time);
+            json += "}";
+        }
+        json += i + 1 < hitches_.size() ? "]},\n" : "]}\n";
+    }
+
+    json += "  ]\n}\n";
+    return WriteFile(path, json);
+}
+
+uint64_t Profiler::GetDroppedCount() const {
+    std::lock_guard<std::mutex> guard(registry_lock_);
+
+    uint64_t count = 0;
+    for (auto& buffer : buffers_) {
+        count += buffer->dropped.load(std::memory_order_relaxed);
+    }
+
+    return count;
 }
 
 void Profiler::PrintAll() {
-    PrintRecursively(root_, 0);
+    Merge();
+
+    for (auto tree : trees_) {
+        Indent(0);
+        Printf("%s :: %.3f ms", tree->name(), tree->root().total_time());
+        PrintRecursively(tree->root(), 2);
+    }
+
+    uint64_t dropped = GetDroppedCount();
+    if (dropped > 0) {
+        Indent(0);
+        Printf("%llu samples dropped, buffers full", (unsigned long long)dropped);
+    }
 }
 
 void Profiler::PrintRecursively(const Node& node, int spacing) {
@@ -81,18 +517,18 @@ void Profiler::PrintRecursively(const Node& node, int spacing) {
     double parent_time = node.total_time();
     auto& children = node.GetChildren();
 
-    for (auto it = children.begin(); it != children.end(); ++it) {
-        double sample_time = it->total_time();
-        int sample_count = it->total_calls();
+    for (auto child : children) {
+        double sample_time = child->total_time();
+        int sample_count = child->total_calls();
         total_sample_time += sample_time;
 
         double percent = parent_time > math::kEpsilon ? (sample_time / parent_time) * 100 : 0.0;
         Indent(spacing);
-        Printf("%s (%.2f%%) :: %.3f ms  %d calls  %.3f ms(avg) %.3f ms(max) %.3f ms(min)",
-            it->name(), percent,
+        Printf("%s%s (%.2f%%) :: %.3f ms  %d calls  %.3f ms(avg) %.3f ms(max) %.3f ms(min)",
+            child->IsJobContext() ? "[job] " : "", child->name(), percent,
             sample_time, sample_count,
-            it->avg_time(), it->max_time(), it->min_time());
-        PrintRecursively(*it, spacing + 2);
+            child->avg_time(), child->max_time(), child->min_time());
+        PrintRecursively(*child, spacing + 2);
     }
 
     Indent(spacing);
@@ -1,14 +1,25 @@
 #pragma once
 
+#include <stdint.h>
 #include <string>
-#include <list>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <mutex>
 #include <chrono>
-#include <array>
+#include <unordered_map>
 #include "Common/Uncopyable.h"
 #include "Common/Singleton.h"
+#include "Statistic.h"
 
 namespace glacier {
 
+//Hierarchical sampling profiler usable from any thread, job workers included.
+//Samples are appended to a lock free buffer owned by the calling thread and merged into
+//a tree per thread by Merge (once per frame), the trees are only touched by the merging thread.
+//Samples taken at the top of a job are grouped under a node named after the job.
+//EndFrame keeps the time of every scope over the last frames and captures the scope tree
+//of the frames much slower than the median (hitches), both can be dumped as csv or json.
 class Profiler : public Singleton<Profiler> {
 public:
     using ClockType = std::conditional<std::chrono::high_resolution_clock::is_steady,
@@ -17,6 +28,32 @@ public:
     using TimePoint = ClockType::time_point;
     using TimeDuration = std::chrono::nanoseconds;
 
+    static constexpr uint32_t kBufferCapacity = 8 * 1024; //pending events per thread
+    static constexpr uint32_t kFrameHistory = 300; //frames kept per scope
+    static constexpr uint32_t kMaxHitchCaptures = 16;
+    static constexpr uint32_t kHitchWarmup = 30; //frames before hitches are detected
+
+    //a hitch is a frame slower than factor times the median frame and at least min_time ms slower
+    struct HitchConfig {
+        double factor = 2.0;
+        double min_time = 4.0;
+    };
+
+    struct ScopeCapture {
+        std::string thread;
+        std::string path; //"Render/Lighting Pass", jobs as "[job] name"
+        uint32_t depth;
+        int calls;
+        double time; //ms in the frame
+    };
+
+    struct HitchCapture {
+        uint64_t frame;
+        double frame_time; //ms
+        double median_time;
+        std::vector<ScopeCapture> scopes; //sampled in the frame, depth first
+    };
+
     class Node : private Uncopyable {
     public:
 
@@ -37,14 +74,21 @@ public:
         double avg_time() const { return total_calls_ > 0 ? total_time() / total_calls_ : 0.0; }
 
         bool IsRoot() const { return parent_ == nullptr; }
+        //job the samples below were taken in, see Profiler
+        bool IsJobContext() const { return job_context_; }
+
+        //ms spent in the scope in each of the last frames, 0 for frames it wasn't sampled in
+        const Statistic& frame_stats() const { return frame_stats_; }
 
-        Node* GetChild(const char* name);
-        const std::list<Node>& GetChildren() const { return children_; }
+        //in order of first sample
+        const std::vector<Node*>& GetChildren() const { return children_; }
 
-        void BeginSample();
-        void EndSample();
+        void BeginSample(TimePoint time);
+        void EndSample(TimePoint time);
 
     protected:
+        friend class Profiler;
+
         const char* name_;
         int total_calls_ = 0;
         TimeDuration total_time_;
@@ -54,24 +98,116 @@ public:
         TimeDuration max_time_;
 
         Node* parent_;
-        std::list<Node> children_;
+        std::vector<Node*> children_;
+        bool job_context_ = false;
+
+        TimeDuration frame_time_{ 0 };
+        int frame_calls_ = 0;
+        Statistic frame_stats_{ kFrameHistory };
+    };
+
+    //Merged samples of one thread
+    class ThreadTree : private Uncopyable {
+    public:
+        ThreadTree(uint32_t tid, uint32_t worker);
+
+        uint32_t tid() const { return tid_; } //os thread id
+        uint32_t worker() const { return worker_; } //jobs::kInvalidWorker outside the job system
+        const char* name() const { return name_; }
+        const Node& root() const { return root_; }
+
+    private:
+        friend class Profiler;
+
+        struct ChildKey {
+            const Node* parent;
+            const char* name;
+            bool job_context; //a job and a sample may share a name
+
+            bool operator==(const ChildKey& other) const {
+                return parent == other.parent && name == other.name && job_context == other.job_context;
+            }
+        };
+
+        struct ChildKeyHash {
+            size_t operator()(const ChildKey& key) const {
+                return std::hash<const void*>()(key.parent) ^ (std::hash<const void*>()(key.name) * 31) ^
+                    (size_t)key.job_context;
+            }
+        };
+
+        Node* GetChild(Node* parent, const char* name, bool job_context);
+
+        uint32_t tid_;
+        uint32_t worker_;
+        char name_[48];
+
+        Node root_;
+        Node* current_;
+        std::deque<Node> nodes_; //stable addresses
+        std::unordered_map<ChildKey, Node*, ChildKeyHash> child_table_;
     };
 
     Profiler();
+    ~Profiler();
 
+    //Any thread. A sample must end on the thread it began on: inside a job it must not
+    //span a wait, the fiber may resume on another thread.
     void BeginSample(const char* name);
     void EndSample();
 
-    Node* GetCurrentNode() { return current_node_; }
+    //Fold the samples buffered by every thread into the trees, one thread at a time.
+    //Samples still open are folded once they end.
+    void Merge();
+
+    //Merge and close the frame, once per frame
+    void EndFrame();
+
+    uint64_t GetFrameCount() const { return frame_count_; }
+    //ms between EndFrame calls
+    const Statistic& GetFrameStats() const { return frame_stats_; }
+    //the last kMaxHitchCaptures hitches, oldest first
+    const std::deque<HitchCapture>& GetHitches() const { return hitches_; }
+    void SetHitchConfig(const HitchConfig& config) { hitch_config_ = config; }
+
+    //Frame histories of every scope and the hitches for offline analysis.
+    //csv: one "thread,scope,frame,time_ms" row per scope and frame kept
+    bool DumpCsv(const char* path);
+    bool DumpJson(const char* path);
+
+    //after Merge, in order of the first sample of each thread
+    const std::vector<ThreadTree*>& GetThreadTrees() const { return trees_; }
+    //samples lost to full buffers
+    uint64_t GetDroppedCount() const;
+
+    //Merge and print every tree
     void PrintAll();
 
 private:
+    struct SampleBuffer;
+
+    static SampleBuffer*& GetThreadBufferRef();
+    SampleBuffer* GetThreadBuffer();
+    void MergeBuffer(SampleBuffer& buffer);
+    void MergeLocked();
+    void CaptureHitch(double frame_time, double median_time);
+    void CaptureRecursively(const ThreadTree& tree, const Node& node, const std::string& path,
+        uint32_t depth, HitchCapture& capture);
+
     void PrintRecursively(const Node& node, int spacing);
     void Indent(int spacing);
     void Printf(const char* fmt, ...);
 
-    Node root_;
-    Node* current_node_;
+    mutable std::mutex registry_lock_; //held by Merge too
+    std::vector<std::unique_ptr<SampleBuffer>> buffers_;
+    std::vector<ThreadTree*> trees_;
+
+    uint64_t frame_count_ = 0;
+    TimePoint frame_begin_;
+    Statistic frame_stats_{ kFrameHistory };
+    HitchConfig hitch_config_;
+    std::deque<HitchCapture> hitches_;
+
     int ident_ = 0;
 };
 
@@ -1,12 +1,14 @@
 #include "statistic.h"
+#include <algorithm>
 
 namespace glacier {
 
-Statistic::Statistic() :
+Statistic::Statistic(uint32_t history_size) :
     total_(0.0),
     num_samples_(0.0),
     min_(std::numeric_limits<double>::max()),
-    max_(std::numeric_limits<double>::lowest())
+    max_(std::numeric_limits<double>::lowest()),
+    history_(history_size, 0.0)
 {
 }
 
@@ -17,6 +19,11 @@ void Statistic::Reset() {
     max_ = std::numeric_limits<double>::lowest();
 }
 
+void Statistic::ClearHistory() {
+    history_count_ = 0;
+    history_next_ = 0;
+}
+
 void Statistic::Sample(double value) {
     total_ += value;
     num_samples_++;
@@ -27,6 +34,37 @@ void Statistic::Sample(double value) {
     if (value < min_) {
         min_ = value;
     }
+
+    if (!history_.empty()) {
+        history_[history_next_] = value;
+        history_next_ = (history_next_ + 1) % (uint32_t)history_.size();
+        if (history_count_ < history_.size()) {
+            ++history_count_;
+        }
+    }
+}
+
+double Statistic::history(uint32_t i) const {
+    assert(i < history_count_);
+    uint32_t size = (uint32_t)history_.size();
+    return history_[(history_next_ + size - history_count_ + i) % size];
+}
+
+double Statistic::Percentile(double percentile) const {
+    if (history_count_ == 0) {
+        return 0.0;
+    }
+
+    sorted_.resize(history_count_);
+    for (uint32_t i = 0; i < history_count_; ++i) {
+        sorted_[i] = history(i);
+    }
+
+    size_t rank = (size_t)(percentile * (history_count_ - 1) + 0.5);
+    rank = std::min(rank, sorted_.size() - 1);
+    std::nth_element(sorted_.begin(), sorted_.begin() + rank, sorted_.end());
+
+    return sorted_[rank];
 }
 
 }
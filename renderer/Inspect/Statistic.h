@@ -1,12 +1,19 @@
 #pragma once
 
+#include <stdint.h>
+#include <vector>
+
 namespace glacier {
 
 class Statistic
 {
 public:
-    Statistic();
+    //history_size: how many of the last samples are kept for percentiles, none by default
+    Statistic(uint32_t history_size = 0);
+
+    //min, max and average restart, the history is kept
     void Reset();
+    void ClearHistory();
 
     void Sample(double value);
 
@@ -14,7 +21,7 @@ public:
     double min() const { return min_; }
     double max() const { return max_; }
 
-    double average() {
+    double average() const {
         if (num_samples_ > 0.0) {
             return total_ / num_samples_;
         }
@@ -22,11 +29,28 @@ public:
         return 0.0;
     }
 
+    uint32_t history_size() const { return (uint32_t)history_.size(); }
+    uint32_t history_count() const { return history_count_; }
+    //i-th kept sample, oldest first
+    double history(uint32_t i) const;
+    double last() const { return history_count_ > 0 ? history(history_count_ - 1) : 0.0; }
+
+    //nearest rank percentile (0..1) of the history, 0 if empty
+    double Percentile(double percentile) const;
+    double p50() const { return Percentile(0.50); }
+    double p95() const { return Percentile(0.95); }
+    double p99() const { return Percentile(0.99); }
+
 private:
     double total_;
     double num_samples_;
     double min_;
     double max_;
+
+    std::vector<double> history_; //ring
+    uint32_t history_count_ = 0;
+    uint32_t history_next_ = 0;
+    mutable std::vector<double> sorted_;
 };
 
 }
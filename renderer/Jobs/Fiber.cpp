@@ -1,45 +1,90 @@
 #include "Fiber.h"
+#include <assert.h>
+
+#ifdef _WIN32
+#include "Exception/Exception.h"
+#else
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <vector>
+#include <system_error>
+#endif
 
 namespace glacier {
 namespace jobs {
 
-Fiber::Fiber(LPVOID address) : address_(address)
-{
-    
+namespace {
+
+//Fibers migrate between threads, the accessors are kept out of line so that
+//the address of a thread local is never cached across a fiber switch
+thread_local Fiber* tls_thread_fiber = nullptr;
+
+#ifndef _WIN32
+thread_local Fiber* tls_current_fiber = nullptr;
+#endif
+
 }
 
 Fiber::~Fiber() {
     Release();
 }
 
-void Fiber::Init(const Delegate& callback, void* param) {
-    assert(!address_);
+void Fiber::Init(const Delegate& callback, void* param, size_t stack_size) {
+    assert(!IsValid());
 
     callback_ = callback;
     param_ = param;
+    stack_size_ = stack_size;
 
-    address_ = CreateFiber(0, &EntryPoint, this);
-    state_ = ExecutionState::PENDING;
-    ThrowIfLastExcept("CreateFiber(...)");
+    Create();
 }
 
-void Fiber::Init(Delegate&& callback, void* param) {
-    assert(!address_);
+void Fiber::Init(Delegate&& callback, void* param, size_t stack_size) {
+    assert(!IsValid());
 
     callback_ = std::move(callback);
     param_ = param;
+    stack_size_ = stack_size;
+
+    Create();
+}
 
-    address_ = CreateFiber(0, &EntryPoint, this);
+void Fiber::Run() {
+    callback_(param_);
+
+    //The callback must not fall off the fiber, it would terminate the thread (Win32)
+    //or the process (ucontext without successor), so give control back to the thread
+    Fiber* thread_fiber = GetThreadFiber();
+    assert(thread_fiber && thread_fiber != this);
+    thread_fiber->SwitchTo();
+}
+
+#ifdef _WIN32
+
+//the reserve ends with guard pages, running into them raises EXCEPTION_STACK_OVERFLOW
+void Fiber::Create() {
+    address_ = CreateFiberEx(0, stack_size_, FIBER_FLAG_FLOAT_SWITCH, &EntryPoint, this);
     state_ = ExecutionState::PENDING;
     ThrowIfLastExcept("CreateFiber(...)");
 }
 
-void Fiber::Init(LPVOID address) {
-    assert(!address_);
+void Fiber::InitFromThread() {
+    assert(!IsValid());
 
-    address_ = address;
+    address_ = ConvertThreadToFiber(NULL);
     state_ = ExecutionState::PENDING;
-    ThrowIfLastExcept("CreateFiber(...)");
+    ThrowIfLastExcept("ConvertThreadToFiber(...)");
+
+    tls_thread_fiber = this;
+}
+
+void Fiber::ReleaseThread() noexcept {
+    assert(GetThreadFiber() == this);
+
+    ConvertFiberToThread();
+    address_ = NULL;
+    tls_thread_fiber = nullptr;
 }
 
 void Fiber::Release() noexcept {
@@ -49,10 +94,252 @@ void Fiber::Release() noexcept {
     }
 }
 
+bool Fiber::IsValid() const noexcept {
+    return address_ != nullptr;
+}
+
+size_t Fiber::GetStackHighWater() const noexcept {
+    uint8_t* stack_top = stack_top_.load(std::memory_order_acquire);
+    if (!stack_top) {
+        return 0;
+    }
+
+    //the stack commits down page by page and never shrinks: from the bottom of the reserve,
+    //skip the reserved and guard regions up to the lowest committed one
+    MEMORY_BASIC_INFORMATION info;
+    if (VirtualQuery(stack_top - 1, &info, sizeof(info)) == 0) {
+        return 0;
+    }
+
+    uint8_t* address = (uint8_t*)info.AllocationBase;
+    while (address < stack_top) {
+        if (VirtualQuery(address, &info, sizeof(info)) == 0) {
+            return 0;
+        }
+
+        if (info.State == MEM_COMMIT && !(info.Protect & PAGE_GUARD)) {
+            return stack_top - (uint8_t*)info.BaseAddress;
+        }
+
+        address = (uint8_t*)info.BaseAddress + info.RegionSize;
+    }
+
+    return 0;
+}
+
+void Fiber::SwitchTo() {
+    assert(IsValid());
+    SwitchToFiber(address_);
+}
+
+FIBER_NOINLINE Fiber* Fiber::GetThreadFiber() noexcept {
+    return tls_thread_fiber;
+}
+
 void WINAPI Fiber::EntryPoint(LPVOID _In_ lpParameter) {
     Fiber* fiber = (Fiber*)lpParameter;
-    fiber->callback_(fiber->param_);
+    fiber->stack_top_.store((uint8_t*)&lpParameter, std::memory_order_release);
+    fiber->Run();
+}
+
+void FiberLocal::Alloc() {
+    assert(index_ == FLS_OUT_OF_INDEXES);
+
+    index_ = FlsAlloc(NULL);
+    ThrowAssert(index_ != FLS_OUT_OF_INDEXES, "FlsAlloc(...)");
+}
+
+void FiberLocal::Free() noexcept {
+    if (index_ != FLS_OUT_OF_INDEXES) {
+        FlsFree(index_);
+        index_ = FLS_OUT_OF_INDEXES;
+    }
+}
+
+void* FiberLocal::Get() const noexcept {
+    return FlsGetValue(index_);
+}
+
+void FiberLocal::Set(void* value) noexcept {
+    FlsSetValue(index_, value);
+}
+
+#else
+
+std::atomic_uint FiberLocal::slot_mask_ = 0;
+
+static size_t GetPageSize() {
+    static size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+    return page_size;
+}
+
+Fiber::Context::~Context() {
+    if (mapping) {
+        munmap(mapping, mapping_size);
+    }
+}
+
+void Fiber::Create() {
+    size_t page_size = GetPageSize();
+    stack_size_ = (stack_size_ + page_size - 1) & ~(page_size - 1);
+
+    context_ = std::make_unique<Context>();
+    context_->mapping_size = stack_size_ + page_size;
+
+    //pages are only backed once touched
+    void* mapping = mmap(nullptr, context_->mapping_size, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (mapping == MAP_FAILED) {
+        context_.reset();
+        throw std::system_error(errno, std::system_category(), "mmap(...)");
+    }
+
+    context_->mapping = (uint8_t*)mapping;
+    if (mprotect(context_->mapping, page_size, PROT_NONE) != 0) {
+        context_.reset();
+        throw std::system_error(errno, std::system_category(), "mprotect(...)");
+    }
+
+    auto& uc = context_->ucontext;
+    if (getcontext(&uc) != 0) {
+        throw std::system_error(errno, std::system_category(), "getcontext(...)");
+    }
+
+    uc.uc_stack.ss_sp = context_->mapping + page_size;
+    uc.uc_stack.ss_size = stack_size_;
+    uc.uc_link = nullptr;
+
+    //makecontext only forwards int arguments, split the pointer in two halves
+    auto ptr = reinterpret_cast<uintptr_t>(this);
+    makecontext(&uc, (void(*)())&EntryPoint, 2, (uint32_t)ptr, (uint32_t)((uint64_t)ptr >> 32));
+
+    state_ = ExecutionState::PENDING;
+}
+
+void Fiber::InitFromThread() {
+    assert(!IsValid());
+
+    context_ = std::make_unique<Context>();
+    state_ = ExecutionState::PENDING;
+
+    tls_thread_fiber = this;
+    SetCurrent(this);
+}
+
+void Fiber::ReleaseThread() noexcept {
+    assert(GetThreadFiber() == this);
+
+    context_.reset();
+    tls_thread_fiber = nullptr;
+    SetCurrent(nullptr);
+}
+
+void Fiber::Release() noexcept {
+    if (context_ && callback_) { // release fibers by Init(callback)
+        context_.reset();
+    }
+}
+
+bool Fiber::IsValid() const noexcept {
+    return context_ != nullptr;
+}
+
+size_t Fiber::GetStackHighWater() const noexcept {
+    if (!context_ || !context_->mapping) {
+        return 0;
+    }
+
+    //the stack grows down, the lowest resident page is the deepest one touched
+    size_t page_size = GetPageSize();
+    uint8_t* stack = context_->mapping + page_size;
+    size_t page_count = stack_size_ / page_size;
+
+    std::vector<unsigned char> resident(page_count);
+    if (mincore(stack, stack_size_, resident.data()) != 0) {
+        return 0;
+    }
+
+    for (size_t i = 0; i < page_count; ++i) {
+        if (resident[i] & 1) {
+            return (page_count - i) * page_size;
+        }
+    }
+
+    return 0;
 }
 
+void Fiber::SwitchTo() {
+    assert(IsValid());
+
+    Fiber* from = GetCurrent();
+    assert(from && from != this);
+
+    SetCurrent(this);
+    swapcontext(&from->context_->ucontext, &context_->ucontext);
+}
+
+FIBER_NOINLINE Fiber* Fiber::GetThreadFiber() noexcept {
+    return tls_thread_fiber;
+}
+
+FIBER_NOINLINE Fiber* Fiber::GetCurrent() noexcept {
+    return tls_current_fiber;
+}
+
+FIBER_NOINLINE void Fiber::SetCurrent(Fiber* fiber) noexcept {
+    tls_current_fiber = fiber;
+}
+
+void Fiber::EntryPoint(uint32_t lo, uint32_t hi) {
+    Fiber* fiber = reinterpret_cast<Fiber*>((uintptr_t)(((uint64_t)hi << 32) | lo));
+    fiber->Run();
+}
+
+void FiberLocal::Alloc() {
+    assert(index_ == kInvalidIndex);
+
+    //slots come back with Free, a reused one may still hold the value the last owner set
+    uint32_t mask = slot_mask_.load(std::memory_order_relaxed);
+    while (true) {
+        uint32_t index = 0;
+        while (index < Fiber::kMaxLocalSlot && (mask & (1u << index))) {
+            ++index;
+        }
+
+        if (index == Fiber::kMaxLocalSlot) {
+            throw std::system_error(ENOMEM, std::system_category(), "FiberLocal::Alloc(...)");
+        }
+
+        if (slot_mask_.compare_exchange_weak(mask, mask | (1u << index), std::memory_order_acq_rel)) {
+            index_ = index;
+            return;
+        }
+    }
+}
+
+void FiberLocal::Free() noexcept {
+    if (index_ != kInvalidIndex) {
+        slot_mask_.fetch_and(~(1u << index_), std::memory_order_acq_rel);
+        index_ = kInvalidIndex;
+    }
+}
+
+void* FiberLocal::Get() const noexcept {
+    assert(index_ < Fiber::kMaxLocalSlot);
+
+    Fiber* fiber = Fiber::GetCurrent();
+    return fiber ? fiber->locals_[index_] : nullptr;
+}
+
+void FiberLocal::Set(void* value) noexcept {
+    assert(index_ < Fiber::kMaxLocalSlot);
+
+    Fiber* fiber = Fiber::GetCurrent();
+    assert(fiber);
+    fiber->locals_[index_] = value;
+}
+
+#endif
+
 }
 }
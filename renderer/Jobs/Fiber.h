@@ -2,9 +2,27 @@
 
 #include <functional>
 #include <atomic>
-#include "Exception/Exception.h"
+#include <memory>
+#include <array>
+#include <limits>
+#include <stdint.h>
 #include "Common/Uncopyable.h"
 
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <Windows.h>
+#else
+#include <ucontext.h>
+#endif
+
+#ifdef _MSC_VER
+#define FIBER_NOINLINE __declspec(noinline)
+#else
+#define FIBER_NOINLINE __attribute__((noinline))
+#endif
+
 namespace glacier {
 namespace jobs {
 
@@ -16,44 +34,118 @@ enum class ExecutionState {
     FORCE_TERMINATED,
 };
 
+//Platform layer of the job system:
+//Win32 fibers on Windows, ucontext with a private stack everywhere else.
+//Stacks are reserved up front and committed as they are touched, the page below
+//the stack is a guard page so an overflow faults right away instead of corrupting memory.
 class Fiber : private Uncopyable {
 public:
     using Delegate = std::function<void(void*)>;
 
+    static constexpr size_t kDefaultStackSize = 1024 * 1024;
+    static constexpr uint32_t kMaxLocalSlot = 8;
+
     Fiber() {}
-    Fiber(LPVOID address);
     ~Fiber();
 
     Fiber& operator=(Fiber&& other) {
         if (this != &other) {
             std::swap(state_, other.state_);
-            std::swap(address_, other.address_);
             std::swap(callback_, other.callback_);
             std::swap(param_, other.param_);
+            std::swap(stack_size_, other.stack_size_);
+#ifdef _WIN32
+            std::swap(address_, other.address_);
+            uint8_t* stack_top = stack_top_.load(std::memory_order_acquire);
+            stack_top_.store(other.stack_top_.load(std::memory_order_acquire), std::memory_order_release);
+            other.stack_top_.store(stack_top, std::memory_order_release);
+#else
+            std::swap(context_, other.context_);
+            std::swap(locals_, other.locals_);
+#endif
         }
 
         return *this;
     }
 
-    void Init(const Delegate& callback, void* param);
-    void Init(Delegate&& callback, void* param);
-    void Init(LPVOID address);
+    void Init(const Delegate& callback, void* param, size_t stack_size = kDefaultStackSize);
+    void Init(Delegate&& callback, void* param, size_t stack_size = kDefaultStackSize);
+
+    //Convert the calling thread into a fiber, it becomes the thread fiber of the thread
+    void InitFromThread();
+    //Convert the calling thread back, must be called on the fiber made by InitFromThread
+    void ReleaseThread() noexcept;
 
     void Release() noexcept;
 
-    LPVOID GetAddress() const noexcept { return address_; }
-    operator LPVOID() const { return address_; }
+    bool IsValid() const noexcept;
+
+    //Switch from the running fiber of the calling thread to this one
+    void SwitchTo();
+
+    size_t GetStackSize() const { return stack_size_; }
+    //Deepest stack use so far, page granular: the committed (windows) or resident (linux) part of the stack
+    size_t GetStackHighWater() const noexcept;
+
+    //The fiber made by InitFromThread on the calling thread
+    static Fiber* GetThreadFiber() noexcept;
 
 private:
+    friend class FiberLocal;
+
+#ifdef _WIN32
     static void WINAPI EntryPoint(_In_ LPVOID lpParameter);
+#else
+    struct Context {
+        ~Context();
+
+        ucontext_t ucontext;
+        uint8_t* mapping = nullptr; //guard page followed by the stack
+        size_t mapping_size = 0;
+    };
+
+    static void EntryPoint(uint32_t lo, uint32_t hi);
+    static Fiber* GetCurrent() noexcept;
+    static void SetCurrent(Fiber* fiber) noexcept;
+#endif
+
+    void Create();
+    void Run();
 
     ExecutionState state_ = ExecutionState::INVALID;
+
+#ifdef _WIN32
     LPVOID address_ = nullptr;
-    
+    std::atomic<uint8_t*> stack_top_ = nullptr; //recorded by the fiber when it starts, read by any thread
+#else
+    std::unique_ptr<Context> context_;
+    std::array<void*, kMaxLocalSlot> locals_ = {};
+#endif
+
     Delegate callback_;
     void* param_ = nullptr;
+    size_t stack_size_ = 0;
+};
+
+//Fiber local storage, follows the fiber when it migrates between threads
+class FiberLocal : private Uncopyable {
+public:
+    void Alloc();
+    void Free() noexcept;
+
+    void* Get() const noexcept;
+    void Set(void* value) noexcept;
+
+private:
+#ifdef _WIN32
+    DWORD index_ = FLS_OUT_OF_INDEXES;
+#else
+    static std::atomic_uint slot_mask_; //bit per slot in use
+    uint32_t index_ = kInvalidIndex;
+#endif
+
+    static constexpr uint32_t kInvalidIndex = std::numeric_limits<uint32_t>::max();
 };
 
 }
 }
-
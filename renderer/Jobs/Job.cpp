@@ -1,8 +1,6 @@
 #include "Job.h"
-#include "Exception/Exception.h"
-#include "Inspect/Timer.h"
 #include "JobSystem.h"
-#include "Common/Log.h"
+#include "JobTrace.h"
 
 namespace glacier {
 namespace jobs {
@@ -12,94 +10,230 @@ bool JobHandle::IsComplete() const {
 }
 
 void JobHandle::WaitComplete() const {
-    while (!JobSystem::Instance()->IsComplete(*this)) {
-        JobSystem::Instance()->YieldJob();
+    JobSystem::Instance()->WaitComplete(*this);
+}
+
+void Job::SetTask(JobDelegate&& delegate) {
+    ResetPayload();
+    if (!delegate) return;
+
+    new (&task) JobDelegate(std::move(delegate));
+    kind = JobKind::kTask;
+}
+
+void Job::SetParallelTask(ParallelJobDelegate&& delegate) {
+    ResetPayload();
+    new (&parallel_task) ParallelJobDelegate(std::move(delegate));
+    kind = JobKind::kParallel;
+}
+
+void Job::SetBatch(Job* owner, uint32_t begin, uint32_t end) {
+    assert(owner->kind == JobKind::kParallel);
+
+    ResetPayload();
+    parent = owner;
+    name = owner->name;
+    batch_begin = begin;
+    batch_end = end;
+    kind = JobKind::kBatch;
+}
+
+void Job::SetRangeTask(RangeJobDelegate&& delegate, uint32_t grain) {
+    ResetPayload();
+    new (&range_task) RangeJobDelegate(std::move(delegate));
+    grain_size = grain > 0 ? grain : 1;
+    kind = JobKind::kRange;
+}
+
+void Job::SetChunk(Job* owner, uint32_t begin, uint32_t end) {
+    assert(owner->kind == JobKind::kRange);
+
+    ResetPayload();
+    parent = owner;
+    name = owner->name;
+    batch_begin = begin;
+    batch_end = end;
+    kind = JobKind::kChunk;
+}
+
+void Job::ResetPayload() noexcept {
+    switch (kind) {
+    case JobKind::kTask:
+        task.~JobDelegate();
+        break;
+    case JobKind::kParallel:
+        parallel_task.~ParallelJobDelegate();
+        break;
+    case JobKind::kRange:
+        range_task.~RangeJobDelegate();
+        break;
+    default:
+        break;
     }
+
+    kind = JobKind::kEmpty;
 }
 
-bool Job::HasDependency() const {
-    return dependancy_counter.load(std::memory_order_relaxed) > 0 ||
-        !wait_handle.IsComplete();
+void Job::Execute() {
+    if (kind == JobKind::kTask) {
+        task();
+    }
+    else if (kind == JobKind::kBatch) {
+        //the owner outlives its batches, they hold a dependency on it
+        auto& delegate = parent->parallel_task;
+        for (uint32_t i = batch_begin; i < batch_end; ++i) {
+            delegate(i);
+        }
+    }
 }
 
 bool Job::IsComplete(uint32_t ver) const {
-    return version.load(std::memory_order_relaxed) != ver;
+    return version.load(std::memory_order_acquire) != ver;
 }
 
 JobFiberPool::JobFiberPool() {
 }
 
-void JobFiberPool::Release() {
-    for (auto& entry : job_fibers_) {
-        entry.fiber.Release();
+void JobFiberPool::Initialize(uint32_t worker_count, const JobStackConfig (&configs)[(size_t)JobStackSize::kCount]) {
+    for (size_t i = 0; i < stacks_.size(); ++i) {
+        stacks_[i].stack_size = configs[i].stack_size;
+        stacks_[i].max_fiber_count = std::min(configs[i].max_fiber_count, kMaxJobFiber);
     }
+
+    //workers loop on small fibers
+    auto& small = stacks_[(size_t)JobStackSize::kSmall];
+    small.max_fiber_count = std::max(small.max_fiber_count, std::min(worker_count, kMaxJobFiber));
+
+    active_fibers_.Initialize(worker_count);
 }
 
-void JobFiberPool::Create(uint32_t fiber_count, const Fiber::Delegate& callback) {
-    fiber_count = std::min(fiber_count, (uint32_t)job_fibers_.size() - used_slot);
+void JobFiberPool::Release() {
+    concurrent::SpinLockGuard guard(grow_lock_);
+    for (size_t n = 0; n < chunks_.size(); ++n) {
+        for (uint32_t i = 0; i < chunk_sizes_[n].second; ++i) {
+            chunks_[n][i].fiber.Release();
+        }
+    }
+}
 
-    for (uint32_t i = 0; i < fiber_count; ++i) {
-        auto& job_fiber = job_fibers_[used_slot++];
+size_t JobFiberPool::GetStackHighWater(JobStackSize stack) const {
+    //chunks live as long as the pool, only the list is copied under the lock:
+    //the scan of every stack would hold up Grow on the scheduling path
+    std::vector<std::pair<const JobFiber*, uint32_t>> chunks;
+    {
+        concurrent::SpinLockGuard guard(grow_lock_);
+        for (size_t n = 0; n < chunks_.size(); ++n) {
+            if (chunk_sizes_[n].first == stack) {
+                chunks.emplace_back(chunks_[n].get(), chunk_sizes_[n].second);
+            }
+        }
+    }
 
-        job_fiber.fiber.Init(callback, &job_fiber);
-        idle_fibers_.Push(&job_fiber);
+    size_t high_water = 0;
+    for (auto& chunk : chunks) {
+        for (uint32_t i = 0; i < chunk.second; ++i) {
+            high_water = std::max(high_water, chunk.first[i].fiber.GetStackHighWater());
+        }
     }
+
+    return high_water;
 }
 
-JobFiber* JobFiberPool::Create(PVOID address) {
-    if (used_slot >= job_fibers_.size()) {
-        return nullptr;
+void JobFiberPool::Create(uint32_t fiber_count, const Fiber::Delegate& callback) {
+    concurrent::SpinLockGuard guard(grow_lock_);
+    callback_ = callback;
+    Grow(JobStackSize::kSmall, fiber_count);
+}
+
+bool JobFiberPool::Grow(JobStackSize stack, uint32_t count) {
+    auto& stack_class = stacks_[(size_t)stack];
+    uint32_t fiber_count = stack_class.fiber_count.load(std::memory_order_relaxed);
+    count = std::min(count, stack_class.max_fiber_count - fiber_count);
+    if (count == 0) {
+        return false;
     }
 
-    auto& slot = job_fibers_[used_slot++];
-    slot.fiber.Init(address);
-    idle_fibers_.Push(&slot);
+    for (uint32_t created = 0; created < count; created += kFiberChunkSize) {
+        auto chunk = std::make_unique<JobFiber[]>(kFiberChunkSize);
+        uint32_t chunk_count = std::min(kFiberChunkSize, count - created);
+        for (uint32_t i = 0; i < chunk_count; ++i) {
+            auto& job_fiber = chunk[i];
+            job_fiber.stack = stack;
+            job_fiber.fiber.Init(callback_, &job_fiber, stack_class.stack_size);
+            stack_class.idle_fibers.Push(&job_fiber);
+        }
 
-    return &slot;
+        chunks_.emplace_back(std::move(chunk));
+        chunk_sizes_.emplace_back(stack, chunk_count);
+        stack_class.fiber_count.fetch_add(chunk_count, std::memory_order_relaxed);
+    }
+
+    return true;
 }
 
 JobFiber* JobFiberPool::AllocFiber(Job* job) {
+    JobStackSize stack = job ? job->stack : JobStackSize::kSmall;
+    auto& stack_class = stacks_[(size_t)stack];
+
     JobFiber* ptr = nullptr;
-    if (idle_fibers_.Pop(ptr)) {
-        ptr->job = job;
-        active_fibers_[(int)ptr->job->priority].Push(ptr);
+    while (!stack_class.idle_fibers.Pop(ptr)) {
+        concurrent::SpinLockGuard guard(grow_lock_);
+        //another thread may have grown the pool or freed a fiber meanwhile
+        if (stack_class.idle_fibers.Pop(ptr)) {
+            break;
+        }
+
+        if (!Grow(stack, kFiberChunkSize)) {
+            return nullptr;
+        }
     }
 
-    assert(ptr);
+    ptr->job = job;
+
+    uint32_t used = stack_class.used_count.fetch_add(1, std::memory_order_relaxed) + 1;
+    uint32_t high_water = stack_class.high_water.load(std::memory_order_relaxed);
+    while (used > high_water &&
+        !stack_class.high_water.compare_exchange_weak(high_water, used, std::memory_order_relaxed)) {}
+
     return ptr;
 }
 
-bool JobFiberPool::FreeFiber(JobFiber* fiber) {
-    fiber->job = nullptr;
-    return idle_fibers_.Push(fiber);
-}
+void JobFiberPool::FreeFiber(JobFiber* fiber) {
+    auto& stack_class = stacks_[(size_t)fiber->stack];
 
-JobFiber* JobFiberPool::TakeOne() {
-    JobFiber* fiber = nullptr;
-    for (int i = 0; i < (int)JobPriority::kCount; ++i) {
-        if (active_fibers_[i].Pop(fiber)) {
-            break;
-        }
+    fiber->job = nullptr;
+    stack_class.used_count.fetch_sub(1, std::memory_order_relaxed);
+    while (!stack_class.idle_fibers.Push(fiber)) {
+        std::this_thread::yield();
     }
+}
 
-    return fiber;
+JobFiber* JobFiberPool::TakeOne(uint32_t worker) {
+    return active_fibers_.TakeOne(worker);
 }
 
-void JobFiberPool::Suspend(JobFiber* fiber) {
-    auto& buffer = active_fibers_[(int)fiber->job->priority];
-    buffer.Push(fiber);
+void JobFiberPool::Suspend(JobFiber* fiber, uint32_t worker) {
+    active_fibers_.Push(fiber, fiber->job->priority, worker);
 }
 
 JobQueue::JobQueue() {
 
 }
 
-Job* JobQueue::TakeOne() {
-    Job* job = nullptr;
-    for (int i = 0; i < (int)JobPriority::kCount; ++i) {
-        if (priority_queue_[i].Pop(job)) {
-            break;
-        }
+void JobQueue::Initialize(uint32_t worker_count, uint32_t max_job_count) {
+    job_collection_.SetChunkLimit((std::min(max_job_count, kMaxJob) + kJobChunkSize - 1) / kJobChunkSize);
+    priority_queue_.Initialize(worker_count);
+}
+
+Job* JobQueue::TakeOne(uint32_t worker) {
+    if (!JobTrace::IsEnabled()) {
+        return priority_queue_.TakeOne(worker);
+    }
+
+    uint32_t victim = kInvalidWorker;
+    Job* job = priority_queue_.TakeOne(worker, &victim);
+    if (job && victim != kInvalidWorker) {
+        JobTrace::Record(JobTraceEvent::kSteal, job, GetIndex(job), victim);
     }
 
     return job;
@@ -107,21 +241,58 @@ Job* JobQueue::TakeOne() {
 
 bool JobQueue::IsComplete(uint32_t index, uint32_t version) {
     auto& job = job_collection_[index];
-    return job.version.load(std::memory_order_relaxed) != version;
+    return job.version.load(std::memory_order_acquire) != version;
 }
 
-void JobQueue::Suspend(Job* job) {
-    auto& queue = priority_queue_[(int)job->priority];
-    queue.Push(job);
+void JobQueue::Push(Job* job, uint32_t worker) {
+    priority_queue_.Push(job, job->priority, worker);
 }
 
-void JobQueue::Free(Job* job) {
-    job->task = nullptr;
-    job->parallel_task = nullptr;
-    job->version.fetch_add(1, std::memory_order_relaxed);
-    //job->dependancy_counter.store(0, std::memory_order_relaxed);
+bool JobQueue::AddSuccessor(const JobHandle& handle, Job* successor) {
+    if (handle.index == JobHandle::kInvalidIndex) return false;
+
+    //version is bumped under the lock by Complete, a recycled slot can't be mistaken for the job
+    auto& job = job_collection_[handle.index];
+    concurrent::SpinLockGuard guard(job.lock);
+    if (job.IsComplete(handle.version)) {
+        return false;
+    }
+
+    successor->next_successor = job.successors;
+    job.successors = successor;
+
+    return true;
+}
+
+bool JobQueue::AddWaitingFiber(const JobHandle& handle, JobFiber* fiber) {
+    if (handle.index == JobHandle::kInvalidIndex) return false;
+
+    auto& job = job_collection_[handle.index];
+    concurrent::SpinLockGuard guard(job.lock);
+    if (job.IsComplete(handle.version)) {
+        return false;
+    }
+
+    fiber->next_waiter = job.waiting_fibers;
+    job.waiting_fibers = fiber;
+
+    return true;
+}
+
+void JobQueue::Complete(Job* job, Job*& successors, JobFiber*& waiting_fibers) {
+    job->ResetPayload();
     job->parent = nullptr;
-    job->wait_handle.index = JobHandle::kInvalidIndex;
+    job->stack = JobStackSize::kSmall;
+
+    {
+        concurrent::SpinLockGuard guard(job->lock);
+        job->version.fetch_add(1, std::memory_order_release);
+
+        successors = job->successors;
+        waiting_fibers = job->waiting_fibers;
+        job->successors = nullptr;
+        job->waiting_fibers = nullptr;
+    }
 
     job_collection_.Free(job);
     job_count_.fetch_sub(1, std::memory_order_relaxed);
@@ -1,10 +1,18 @@
 #pragma once
 
 #include <array>
+#include <vector>
+#include <limits>
+#include <memory>
+#include <thread>
 #include "Fiber.h"
+#include "Common/InplaceFunction.h"
 #include "Concurrent/ThreadPool.h"
 #include "Common/Singleton.h"
+#include "Concurrent/SpinLock.h"
 #include "Concurrent/FixedBuffer.h"
+#include "Concurrent/WorkStealingQueue.h"
+#include "Concurrent/MPMCRingBuffer.h"
 
 namespace glacier {
 namespace jobs {
@@ -37,73 +45,286 @@ struct JobHandle {
     void WaitComplete() const;
 };
 
-using JobDelegate = std::function<void()>;
-using ParallelJobDelegate = std::function<void(uint32_t)>;
+//Stored in place in the job, lambdas capturing more than 48 bytes don't compile
+using JobDelegate = InplaceFunction<void()>;
+using ParallelJobDelegate = InplaceFunction<void(uint32_t)>;
+using RangeJobDelegate = InplaceFunction<void(uint32_t, uint32_t)>; //[begin, end)
 
 struct JobFiber;
 
-struct Job {
-    JobDelegate task;
-    ParallelJobDelegate parallel_task;
-    uint32_t batch_id;
-    uint32_t batch_begin;
-    uint32_t batch_end;
-    JobPriority priority;
+//Stack class of the fiber a job runs on, deep call chains (physics, scripts) ask for a large one
+enum class JobStackSize : uint8_t {
+    kSmall,
+    kLarge,
+    kCount,
+};
+
+enum class JobKind : uint8_t {
+    kEmpty,     //no payload, completes as soon as its dependencies did
+    kTask,      //runs task
+    kParallel,  //owns parallel_task, completes with its last batch
+    kBatch,     //runs parent->parallel_task over [batch_begin, batch_end)
+    kRange,     //owns range_task, completes with its last chunk
+    kChunk,     //runs parent->range_task over [batch_begin, batch_end), splits on demand
+};
+
+//Scheduling state fills the first cache line, the payload the second one
+struct alignas(CACHE_LINE_SIZE) Job {
+    Job() {}
+    ~Job() { ResetPayload(); }
 
     std::atomic_uint version = 0;
+    //unfinished prerequisites (children, waited-on jobs), the job is queued when it drops to 0
     std::atomic_uint dependancy_counter = 0;
+    //guards successors/waiting_fibers
+    concurrent::SpinLock lock;
+    JobPriority priority;
+    JobKind kind = JobKind::kEmpty;
+    JobStackSize stack = JobStackSize::kSmall;
+    uint32_t grain_size; //kRange only
+    uint32_t batch_begin;
+    uint32_t batch_end;
     Job* parent = nullptr;
-    JobHandle wait_handle;
 
-    bool HasDependency() const;
+    //jobs and fibers released when this job completes
+    Job* successors = nullptr;
+    JobFiber* waiting_fibers = nullptr;
+    Job* next_successor = nullptr; //link in the successors list of a prerequisite
+    const char* name = nullptr; //set while tracing, see JobTraceScope
+
+    union {
+        alignas(CACHE_LINE_SIZE) JobDelegate task;
+        ParallelJobDelegate parallel_task;
+        RangeJobDelegate range_task;
+    };
+
+    void SetTask(JobDelegate&& delegate);
+    void SetParallelTask(ParallelJobDelegate&& delegate);
+    void SetBatch(Job* owner, uint32_t begin, uint32_t end);
+    void SetRangeTask(RangeJobDelegate&& delegate, uint32_t grain);
+    void SetChunk(Job* owner, uint32_t begin, uint32_t end);
+    void ResetPayload() noexcept;
+
+    bool IsRunnable() const {
+        return kind == JobKind::kTask || kind == JobKind::kBatch || kind == JobKind::kChunk;
+    }
+
+    void Execute();
+
     bool IsComplete(uint32_t ver) const;
 };
 
+static_assert(sizeof(Job) == 2 * CACHE_LINE_SIZE, "Job should fit in two cache lines");
+
 struct JobFiber {
     Fiber fiber;
     Job* job = nullptr;
+    JobFiber* next_waiter = nullptr; //link in the waiting_fibers list of a job
+    JobStackSize stack = JobStackSize::kSmall;
+};
+
+constexpr uint32_t kInvalidWorker = std::numeric_limits<uint32_t>::max();
+
+//Per worker work-stealing deques for every priority, local push/pop are contention-free.
+//Threads outside the job system and overflowing items go through the shared rings,
+//which hold Capacity items (the most that can exist) so a push never waits for room.
+template<typename T, size_t Capacity, size_t LocalCapacity = Capacity>
+class JobWorkQueue : private Uncopyable {
+public:
+    void Initialize(uint32_t worker_count) {
+        worker_count_ = worker_count;
+        workers_ = std::make_unique<Worker[]>(worker_count);
+        for (uint32_t i = 0; i < worker_count; ++i) {
+            workers_[i].seed = 0x9E3779B9u * (i + 1);
+        }
+    }
+
+    void Push(T v, JobPriority pri, uint32_t worker) {
+        if (worker < worker_count_ && workers_[worker].deques[(int)pri].Push(v)) {
+            return;
+        }
+
+        PushShared(v, pri);
+    }
+
+    void PushShared(T v, JobPriority pri) {
+        //the ring may report full while a preempted consumer still holds a cell of the previous lap
+        while (!shared_[(int)pri].Push(v)) {
+            std::this_thread::yield();
+        }
+    }
+
+    //Nothing left in the local deque for thieves to take
+    bool IsLocalEmpty(JobPriority pri, uint32_t worker) const {
+        return worker >= worker_count_ || workers_[worker].deques[(int)pri].empty();
+    }
+
+    //approximate when used concurrently
+    bool HasWork() const {
+        for (int i = 0; i < (int)JobPriority::kCount; ++i) {
+            if (shared_[i].size() > 0) return true;
+
+            for (uint32_t n = 0; n < worker_count_; ++n) {
+                if (!workers_[n].deques[i].empty()) return true;
+            }
+        }
+
+        return false;
+    }
+
+    //victim is set to the worker v was stolen from
+    T TakeOne(uint32_t worker, uint32_t* victim = nullptr) {
+        T v = nullptr;
+        for (int i = 0; i < (int)JobPriority::kCount; ++i) {
+            if (worker < worker_count_ && workers_[worker].deques[i].Pop(v)) {
+                break;
+            }
+
+            if (shared_[i].Pop(v) || Steal(i, worker, v, victim)) {
+                break;
+            }
+        }
+
+        return v;
+    }
+
+private:
+    struct alignas(CACHE_LINE_SIZE) Worker {
+        std::array<concurrent::WorkStealingQueue<T, LocalCapacity>, (size_t)JobPriority::kCount> deques;
+        uint32_t seed; //owner only
+    };
+
+    //start from a random victim so thieves spread over the workers
+    bool Steal(int pri, uint32_t worker, T& v, uint32_t* victim_worker) {
+        uint32_t start = 0;
+        if (worker < worker_count_) {
+            uint32_t& seed = workers_[worker].seed;
+            seed ^= seed << 13;
+            seed ^= seed >> 17;
+            seed ^= seed << 5;
+            start = seed % worker_count_;
+        }
+
+        for (uint32_t n = 0; n < worker_count_; ++n) {
+            uint32_t victim = (start + n) % worker_count_;
+            if (victim != worker && workers_[victim].deques[pri].Steal(v)) {
+                if (victim_worker) {
+                    *victim_worker = victim;
+                }
+
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    uint32_t worker_count_ = 0;
+    std::unique_ptr<Worker[]> workers_;
+    std::array<concurrent::MPMCRingBuffer<T, Capacity>, (size_t)JobPriority::kCount> shared_;
 };
 
+struct JobStackConfig {
+    size_t stack_size;
+    uint32_t max_fiber_count;
+};
+
+//Fibers of every stack class are created in chunks when its idle list runs dry, up to the configured limit
 class JobFiberPool {
 public:
-    static constexpr uint32_t kMaxJobFiber = 256;
+    static constexpr uint32_t kMaxJobFiber = 1024; //hard limit per stack class, sizes the queues
+    static constexpr uint32_t kFiberChunkSize = 16;
 
     JobFiberPool();
+    void Initialize(uint32_t worker_count, const JobStackConfig (&configs)[(size_t)JobStackSize::kCount]);
     void Release();
 
     void Create(uint32_t fiber_count, const Fiber::Delegate& callback);
-    JobFiber* Create(PVOID address);
 
+    //A fiber of the stack class job asks for (small without job),
+    //nullptr once all fibers of the class up to the limit are in use
     JobFiber* AllocFiber(Job* job);
-    bool FreeFiber(JobFiber* job);
+    void FreeFiber(JobFiber* job);
 
-    JobFiber* TakeOne();
-    void Suspend(JobFiber* fiber);
+    JobFiber* TakeOne(uint32_t worker);
+    void Suspend(JobFiber* fiber, uint32_t worker);
+    bool HasWork() const { return active_fibers_.HasWork(); }
+
+    uint32_t GetFiberCount(JobStackSize stack = JobStackSize::kSmall) const {
+        return stacks_[(size_t)stack].fiber_count.load(std::memory_order_relaxed);
+    }
+
+    uint32_t GetHighWater(JobStackSize stack = JobStackSize::kSmall) const {
+        return stacks_[(size_t)stack].high_water.load(std::memory_order_relaxed);
+    }
+
+    size_t GetStackSize(JobStackSize stack) const { return stacks_[(size_t)stack].stack_size; }
+    //deepest stack use of any fiber of the class
+    size_t GetStackHighWater(JobStackSize stack) const;
 
 private:
-    std::atomic_uint used_slot = 0;
-    std::array<JobFiber, kMaxJobFiber> job_fibers_;
+    struct StackClass {
+        size_t stack_size = Fiber::kDefaultStackSize;
+        uint32_t max_fiber_count = kMaxJobFiber;
+
+        std::atomic_uint fiber_count = 0;
+        std::atomic_uint used_count = 0;
+        std::atomic_uint high_water = 0;
+
+        concurrent::MPMCRingBuffer<JobFiber*, kMaxJobFiber> idle_fibers;
+    };
 
-    concurrent::RingBuffer<JobFiber*, kMaxJobFiber> idle_fibers_;
-    std::array<concurrent::RingBuffer<JobFiber*, kMaxJobFiber>, (size_t)JobPriority::kCount> active_fibers_;
+    bool Grow(JobStackSize stack, uint32_t count);
+
+    mutable concurrent::SpinLock grow_lock_;
+    Fiber::Delegate callback_;
+    std::vector<std::unique_ptr<JobFiber[]>> chunks_;
+    std::vector<std::pair<JobStackSize, uint32_t>> chunk_sizes_; //fibers created in every chunk
+
+    std::array<StackClass, (size_t)JobStackSize::kCount> stacks_;
+    JobWorkQueue<JobFiber*, kMaxJobFiber * (size_t)JobStackSize::kCount> active_fibers_;
 };
 
+//Jobs are allocated in chunks of kJobChunkSize up to the configured limit,
+//handle indices stay valid since chunks never move
 class JobQueue {
 public:
-    constexpr static uint32_t kMaxJob = 2048;
+    constexpr static uint32_t kJobChunkSize = 1024;
+    constexpr static uint32_t kMaxJob = 32 * 1024; //hard limit, sizes the shared queues
+    constexpr static uint32_t kMaxLocalJob = 2048;
 
     JobQueue();
+    void Initialize(uint32_t worker_count, uint32_t max_job_count);
 
     uint32_t GetJobCount() const { return job_count_.load(std::memory_order_relaxed); }
+    uint32_t GetCapacity() const { return (uint32_t)job_collection_.capacity(); }
+    uint32_t GetHighWater() const { return (uint32_t)job_collection_.high_water(); }
 
-    Job* TakeOne();
+    Job* TakeOne(uint32_t worker);
     bool IsComplete(uint32_t index, uint32_t version);
 
-    void Suspend(Job* job);
-    void Free(Job* job);
+    //Queue a job whose dependencies are all satisfied
+    void Push(Job* job, uint32_t worker);
+    bool IsLocalEmpty(JobPriority pri, uint32_t worker) const {
+        return priority_queue_.IsLocalEmpty(pri, worker);
+    }
+
+    bool HasWork() const { return priority_queue_.HasWork(); }
 
+    Job* GetJob(uint32_t index) { return &job_collection_[index]; }
+    uint32_t GetIndex(Job* job) const { return job_collection_.GetIndex(job); }
+
+    //Register successor/fiber to be released when the job of handle completes,
+    //returns false if it has already completed
+    bool AddSuccessor(const JobHandle& handle, Job* successor);
+    bool AddWaitingFiber(const JobHandle& handle, JobFiber* fiber);
+
+    //Retire the job and detach everything waiting on it, the slot may be reused right after
+    void Complete(Job* job, Job*& successors, JobFiber*& waiting_fibers);
+
+    //Allocate a job without queueing it
     template<typename F>
-    Job* Push(const F& func) {
+    Job* Alloc(const F& func) {
         Job* job = job_collection_.Alloc(func);
         if (!job) {
             return nullptr;
@@ -111,18 +332,14 @@ public:
         
         job_count_.fetch_add(1, std::memory_order_relaxed);
 
-        auto& queue = priority_queue_[(int)job->priority];
-        queue.Push(job);
-
         return job;
     }
 
 private:
     std::atomic_uint job_count_ = 0;
-    concurrent::FixedBuffer<Job, kMaxJob> job_collection_;
-    //concurrent::FixedBuffer<Job*, kMaxJob> waiting_list_;
+    concurrent::FixedBuffer<Job, kJobChunkSize, kMaxJob / kJobChunkSize> job_collection_;
 
-    std::array<concurrent::RingBuffer<Job*, kMaxJob>, (size_t)JobPriority::kCount> priority_queue_;
+    JobWorkQueue<Job*, kMaxJob, kMaxLocalJob> priority_queue_;
 };
 
 }
@@ -0,0 +1,199 @@
+#include "JobSchedule.h"
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+#include <algorithm>
+
+namespace glacier {
+namespace jobs {
+
+namespace {
+
+constexpr uint32_t kLogMagic = 0x4C534A47; //GJSL
+constexpr uint32_t kLogVersion = 1;
+constexpr uint64_t kRootKey = 0x9E3779B97F4A7C15ull;
+
+uint64_t MixKey(uint64_t key, uint64_t value) {
+    //splitmix64 finalizer
+    uint64_t z = key ^ (value + 0x9E3779B97F4A7C15ull + (key << 6) + (key >> 2));
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+int64_t GetScheduleTime() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+}
+
+void JobScheduleLog::Reset(uint32_t capacity) {
+    entries_.resize(capacity);
+    count_.store(0, std::memory_order_relaxed);
+}
+
+void JobScheduleLog::Add(uint64_t key, uint32_t worker, int64_t begin, int64_t duration) {
+    uint32_t slot = count_.fetch_add(1, std::memory_order_relaxed);
+    if (slot < entries_.size()) {
+        entries_[slot] = { key, worker, 0, begin, duration };
+    }
+}
+
+uint32_t JobScheduleLog::size() const {
+    return std::min(count_.load(std::memory_order_relaxed), (uint32_t)entries_.size());
+}
+
+uint32_t JobScheduleLog::GetDroppedCount() const {
+    return count_.load(std::memory_order_relaxed) - size();
+}
+
+bool JobScheduleLog::Save(const char* path) const {
+    FILE* file = fopen(path, "wb");
+    if (!file) {
+        return false;
+    }
+
+    uint32_t header[3] = { kLogMagic, kLogVersion, size() };
+    bool result = fwrite(header, sizeof(header), 1, file) == 1;
+    if (result && header[2] > 0) {
+        result = fwrite(entries_.data(), sizeof(Entry), header[2], file) == header[2];
+    }
+
+    fclose(file);
+    return result;
+}
+
+bool JobScheduleLog::Load(const char* path) {
+    FILE* file = fopen(path, "rb");
+    if (!file) {
+        return false;
+    }
+
+    uint32_t header[3];
+    bool result = fread(header, sizeof(header), 1, file) == 1 &&
+        header[0] == kLogMagic && header[1] == kLogVersion;
+
+    if (result) {
+        entries_.resize(header[2]);
+        result = header[2] == 0 || fread(entries_.data(), sizeof(Entry), header[2], file) == header[2];
+        count_.store(result ? header[2] : 0, std::memory_order_relaxed);
+    }
+
+    fclose(file);
+    return result;
+}
+
+void JobScheduler::Configure(const JobScheduleConfig& config) {
+    if (config.mode != JobScheduleMode::kNormal && !keys_) {
+        keys_ = std::make_unique<JobKey[]>(JobQueue::kMaxJob);
+    }
+
+    root_spawn_count_.store(0, std::memory_order_relaxed);
+    log_.Reset(config.mode != JobScheduleMode::kNormal ? config.log_capacity : 0);
+    log_begin_ = GetScheduleTime();
+
+    ready_jobs_.clear();
+    replay_log_ = config.mode == JobScheduleMode::kReplay ? config.replay_log : nullptr;
+    replay_slots_.clear();
+    replay_used_.clear();
+    replay_cursor_ = 0;
+    if (replay_log_) {
+        uint32_t log_size = replay_log_->size();
+        replay_used_.resize(log_size, false);
+        replay_slots_.reserve(log_size);
+        for (uint32_t i = log_size; i > 0; --i) {
+            replay_slots_[(*replay_log_)[i - 1].key] = i - 1;
+        }
+    }
+    divergence_count_ = 0;
+    random_state_ = config.seed ? config.seed : kRootKey;
+
+    mode_.store(config.mode, std::memory_order_release);
+}
+
+void JobScheduler::AssignKey(const Job* job, uint32_t index, uint32_t parent, uint32_t creator) {
+    uint64_t key;
+    if (parent != JobHandle::kInvalidIndex) {
+        //splitting depends on timing, the range doesn't
+        key = MixKey(keys_[parent].key, ((uint64_t)job->batch_begin << 32) | job->batch_end);
+    }
+    else if (creator != JobHandle::kInvalidIndex) {
+        //a job runs on one thread at a time
+        key = MixKey(keys_[creator].key, keys_[creator].spawn_count++);
+    }
+    else {
+        key = MixKey(kRootKey, root_spawn_count_.fetch_add(1, std::memory_order_relaxed));
+    }
+
+    keys_[index] = { key, 0 };
+}
+
+void JobScheduler::RecordPick(uint32_t index, uint32_t worker, int64_t begin, int64_t end) {
+    log_.Add(keys_[index].key, worker, begin - log_begin_, end - begin);
+}
+
+void JobScheduler::Push(Job* job, uint32_t index) {
+    uint64_t key = keys_[index].key;
+    uint32_t slot = kNoSlot;
+    if (replay_log_) {
+        auto it = replay_slots_.find(key);
+        if (it != replay_slots_.end()) {
+            slot = it->second;
+        }
+    }
+
+    concurrent::SpinLockGuard guard(ready_lock_);
+    ready_jobs_.push_back({ job, key, slot });
+}
+
+Job* JobScheduler::Take() {
+    concurrent::SpinLockGuard guard(ready_lock_);
+    if (ready_jobs_.empty()) {
+        return nullptr;
+    }
+
+    size_t pick = ready_jobs_.size();
+    if (replay_log_) {
+        //the ready job logged first, jobs the recording ran before it aren't ready yet
+        uint32_t first_slot = kNoSlot;
+        for (size_t i = 0; i < ready_jobs_.size(); ++i) {
+            if (ready_jobs_[i].slot < first_slot) {
+                first_slot = ready_jobs_[i].slot;
+                pick = i;
+            }
+        }
+
+        while (replay_cursor_ < replay_used_.size() && replay_used_[replay_cursor_]) {
+            ++replay_cursor_;
+        }
+
+        if (first_slot != replay_cursor_) {
+            ++divergence_count_;
+        }
+
+        if (first_slot != kNoSlot) {
+            replay_used_[first_slot] = true;
+        }
+    }
+
+    if (pick == ready_jobs_.size()) {
+        pick = NextRandom() % ready_jobs_.size();
+    }
+
+    //keep the order of the others, the seeded pick depends on it
+    Job* job = ready_jobs_[pick].job;
+    ready_jobs_.erase(ready_jobs_.begin() + pick);
+
+    return job;
+}
+
+uint32_t JobScheduler::NextRandom() {
+    random_state_ ^= random_state_ << 13;
+    random_state_ ^= random_state_ >> 7;
+    random_state_ ^= random_state_ << 17;
+    return (uint32_t)(random_state_ >> 32);
+}
+
+}
+}
@@ -0,0 +1,119 @@
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+#include "Job.h"
+
+namespace glacier {
+namespace jobs {
+
+enum class JobScheduleMode : uint8_t {
+    kNormal,
+    kRecord,        //log every job picked, the worker it ran on and its duration
+    kReplay,        //run jobs one at a time on the waiting thread, in the order of a recording
+    kDeterministic, //run jobs one at a time on the waiting thread, in a seeded order
+};
+
+//Jobs picked in order. A job is identified by a key derived from the job that scheduled it
+//and how many jobs that one scheduled before, so the same program gets the same keys
+//in every run whatever the timing (batches and chunks are keyed by their range).
+class JobScheduleLog {
+public:
+    struct Entry {
+        uint64_t key;
+        uint32_t worker; //kInvalidWorker for threads outside the job system
+        uint32_t reserved;
+        int64_t begin; //ns since the log was reset
+        int64_t duration; //ns
+    };
+
+    void Reset(uint32_t capacity);
+
+    //thread safe, entries past the capacity are dropped
+    void Add(uint64_t key, uint32_t worker, int64_t begin, int64_t duration);
+
+    uint32_t size() const;
+    const Entry& operator[](uint32_t i) const { return entries_[i]; }
+    uint32_t GetDroppedCount() const;
+
+    bool Save(const char* path) const;
+    bool Load(const char* path);
+
+private:
+    std::vector<Entry> entries_;
+    std::atomic<uint32_t> count_ = 0;
+};
+
+struct JobScheduleConfig {
+    JobScheduleMode mode = JobScheduleMode::kNormal;
+    uint64_t seed = 0; //kDeterministic, and kReplay once it diverged
+    uint32_t log_capacity = 1024 * 1024;
+    const JobScheduleLog* replay_log = nullptr; //kReplay, must outlive the replay
+};
+
+//Bookkeeping of the modes other than kNormal: job keys, the pick log,
+//and the ready list of the serial modes (kReplay, kDeterministic).
+//Nothing here is touched in kNormal mode.
+class JobScheduler {
+public:
+    void Configure(const JobScheduleConfig& config);
+
+    JobScheduleMode GetMode() const { return mode_.load(std::memory_order_relaxed); }
+    bool IsEnabled() const { return GetMode() != JobScheduleMode::kNormal; }
+    bool IsSerial() const {
+        auto mode = GetMode();
+        return mode == JobScheduleMode::kReplay || mode == JobScheduleMode::kDeterministic;
+    }
+
+    //creator is the index of the running job scheduling it, kInvalidIndex outside jobs
+    void AssignKey(const Job* job, uint32_t index, uint32_t parent, uint32_t creator);
+    uint64_t GetKey(uint32_t index) const { return keys_[index].key; }
+
+    void RecordPick(uint32_t index, uint32_t worker, int64_t begin, int64_t end);
+
+    //Serial modes: jobs wait here instead of the worker queues
+    void Push(Job* job, uint32_t index);
+    Job* Take();
+
+    const JobScheduleLog& GetLog() const { return log_; }
+    //picks that didn't follow the replayed log
+    uint32_t GetDivergenceCount() const { return divergence_count_; }
+
+private:
+    struct JobKey {
+        uint64_t key;
+        uint32_t spawn_count; //jobs scheduled by the job so far
+    };
+
+    static constexpr uint32_t kNoSlot = 0xFFFFFFFF;
+
+    struct ReadyJob {
+        Job* job;
+        uint64_t key;
+        uint32_t slot; //first entry of the key in the replayed log
+    };
+
+    uint32_t NextRandom();
+
+    std::atomic<JobScheduleMode> mode_ = JobScheduleMode::kNormal;
+    std::unique_ptr<JobKey[]> keys_; //by job index
+    std::atomic<uint32_t> root_spawn_count_ = 0;
+
+    JobScheduleLog log_;
+    int64_t log_begin_ = 0;
+
+    concurrent::SpinLock ready_lock_;
+    std::vector<ReadyJob> ready_jobs_;
+    const JobScheduleLog* replay_log_ = nullptr;
+    std::unordered_map<uint64_t, uint32_t> replay_slots_;
+    std::vector<bool> replay_used_;
+    uint32_t replay_cursor_ = 0; //first log entry not replayed yet
+    uint32_t divergence_count_ = 0;
+    uint64_t random_state_ = 0;
+};
+
+}
+}
@@ -0,0 +1,159 @@
+#include "JobSync.h"
+#include "JobSystem.h"
+
+namespace glacier {
+namespace jobs {
+
+void JobWaitList::Push(JobFiber* fiber) {
+    fiber->next_waiter = nullptr;
+    if (tail) {
+        tail->next_waiter = fiber;
+    }
+    else {
+        head = fiber;
+    }
+
+    tail = fiber;
+}
+
+JobFiber* JobWaitList::Pop() {
+    JobFiber* fiber = head;
+    if (fiber) {
+        head = fiber->next_waiter;
+        if (!head) {
+            tail = nullptr;
+        }
+
+        fiber->next_waiter = nullptr;
+    }
+
+    return fiber;
+}
+
+JobFiber* JobWaitList::TakeAll() {
+    JobFiber* fibers = head;
+    head = nullptr;
+    tail = nullptr;
+
+    return fibers;
+}
+
+bool JobSemaphore::TryAcquire() {
+    uint32_t count = count_.load(std::memory_order_relaxed);
+    while (count > 0) {
+        if (count_.compare_exchange_weak(count, count - 1,
+            std::memory_order_acquire, std::memory_order_relaxed))
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void JobSemaphore::Acquire() {
+    if (TryAcquire()) {
+        return;
+    }
+
+    auto job_system = JobSystem::Instance();
+    while (true) {
+        //once resumed the fiber either took a permit in ParkWaiter or was handed one by Release
+        if (job_system->ParkFiber(&JobSemaphore::ParkWaiter, this)) {
+            return;
+        }
+
+        if (TryAcquire()) {
+            return;
+        }
+
+        job_system->YieldJob();
+    }
+}
+
+void JobSemaphore::Release(uint32_t count) {
+    JobFiber* resumed = nullptr;
+    {
+        concurrent::SpinLockGuard guard(lock_);
+        while (count > 0 && !waiters_.IsEmpty()) {
+            JobFiber* fiber = waiters_.Pop();
+            fiber->next_waiter = resumed;
+            resumed = fiber;
+            --count;
+        }
+
+        if (count > 0) {
+            count_.fetch_add(count, std::memory_order_release);
+        }
+    }
+
+    auto job_system = JobSystem::Instance();
+    while (resumed) {
+        JobFiber* next = resumed->next_waiter;
+        resumed->next_waiter = nullptr;
+        job_system->ResumeFiber(resumed);
+        resumed = next;
+    }
+}
+
+//runs on the next fiber, after the waiter switched away
+bool JobSemaphore::ParkWaiter(void* context, JobFiber* fiber) {
+    auto semaphore = (JobSemaphore*)context;
+
+    concurrent::SpinLockGuard guard(semaphore->lock_);
+    if (semaphore->TryAcquire()) {
+        return false;
+    }
+
+    semaphore->waiters_.Push(fiber);
+    return true;
+}
+
+void JobEvent::Set() {
+    JobFiber* resumed;
+    {
+        concurrent::SpinLockGuard guard(lock_);
+        set_.store(true, std::memory_order_release);
+        resumed = waiters_.TakeAll();
+    }
+
+    auto job_system = JobSystem::Instance();
+    while (resumed) {
+        JobFiber* next = resumed->next_waiter;
+        resumed->next_waiter = nullptr;
+        job_system->ResumeFiber(resumed);
+        resumed = next;
+    }
+}
+
+void JobEvent::Reset() {
+    concurrent::SpinLockGuard guard(lock_);
+    set_.store(false, std::memory_order_relaxed);
+}
+
+void JobEvent::Wait() {
+    auto job_system = JobSystem::Instance();
+    while (!IsSet()) {
+        //resumed only by Set, even if a Reset came in before the fiber runs again
+        if (job_system->ParkFiber(&JobEvent::ParkWaiter, this)) {
+            return;
+        }
+
+        job_system->YieldJob();
+    }
+}
+
+bool JobEvent::ParkWaiter(void* context, JobFiber* fiber) {
+    auto event = (JobEvent*)context;
+
+    concurrent::SpinLockGuard guard(event->lock_);
+    if (event->set_.load(std::memory_order_relaxed)) {
+        return false;
+    }
+
+    event->waiters_.Push(fiber);
+    return true;
+}
+
+}
+}
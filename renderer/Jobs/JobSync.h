@@ -0,0 +1,90 @@
+#pragma once
+
+#include <atomic>
+#include "Job.h"
+#include "Concurrent/SpinLock.h"
+#include "Common/Uncopyable.h"
+
+namespace glacier {
+namespace jobs {
+
+//FIFO list of parked fibers, linked through JobFiber::next_waiter
+struct JobWaitList {
+    void Push(JobFiber* fiber);
+    JobFiber* Pop();
+    //detach every fiber
+    JobFiber* TakeAll();
+    bool IsEmpty() const { return head == nullptr; }
+
+    JobFiber* head = nullptr;
+    JobFiber* tail = nullptr;
+};
+
+//Counting semaphore for jobs: a job that can't acquire parks its fiber and the worker
+//moves on to other jobs, Release hands permits straight to the parked fibers in FIFO order.
+//Threads outside of jobs (or when the fiber pool is exhausted) fall back to polling.
+class JobSemaphore : private Uncopyable {
+public:
+    explicit JobSemaphore(uint32_t count = 0) : count_(count) {}
+
+    bool TryAcquire();
+    void Acquire();
+    void Release(uint32_t count = 1);
+
+    uint32_t GetCount() const { return count_.load(std::memory_order_relaxed); }
+
+private:
+    static bool ParkWaiter(void* context, JobFiber* fiber);
+
+    std::atomic<uint32_t> count_;
+    concurrent::SpinLock lock_; //guards waiters_, held by Release so a parking fiber can't miss a permit
+    JobWaitList waiters_;
+};
+
+//Mutex that parks the waiting fiber instead of blocking the worker, not recursive.
+//Ownership may move to another thread as the fiber can resume on any worker.
+class JobMutex : private Uncopyable {
+public:
+    JobMutex() : semaphore_(1) {}
+
+    void Lock() { semaphore_.Acquire(); }
+    bool TryLock() { return semaphore_.TryAcquire(); }
+    void Unlock() { semaphore_.Release(); }
+
+private:
+    JobSemaphore semaphore_;
+};
+
+struct JobMutexGuard : private Uncopyable {
+    JobMutexGuard(JobMutex& mutex) : mutex(mutex) {
+        mutex.Lock();
+    }
+
+    ~JobMutexGuard() {
+        mutex.Unlock();
+    }
+
+    JobMutex& mutex;
+};
+
+//Manual reset event, Set resumes every parked fiber and lets later Wait calls through until Reset
+class JobEvent : private Uncopyable {
+public:
+    explicit JobEvent(bool set = false) : set_(set) {}
+
+    void Set();
+    void Reset();
+    bool IsSet() const { return set_.load(std::memory_order_acquire); }
+
+    void Wait();
+
+private:
+    static bool ParkWaiter(void* context, JobFiber* fiber);
+
+    std::atomic_bool set_;
+    concurrent::SpinLock lock_; //guards waiters_
+    JobWaitList waiters_;
+};
+
+}
+}
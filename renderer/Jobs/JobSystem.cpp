@@ -1,11 +1,50 @@
 #include "JobSystem.h"
+#include <stdio.h>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include "Concurrent/Futex.h"
+#include "JobTrace.h"
+
+#ifdef _WIN32
 #include "Exception/Exception.h"
-#include "Inspect/Timer.h"
+#else
+#include <time.h>
+#endif
 
 namespace glacier {
 namespace jobs {
 
+namespace {
+
+thread_local FiberTransfer tls_fiber_transfer;
+
+FIBER_NOINLINE FiberTransfer& GetFiberTransfer() {
+    return tls_fiber_transfer;
+}
+
+thread_local uint32_t tls_worker_index = kInvalidWorker;
+thread_local Job* tls_nested_job = nullptr;
+
+//job run nested on the stack of a thread outside the job system
+FIBER_NOINLINE Job*& GetNestedJob() {
+    return tls_nested_job;
+}
+
+//index of the worker running the calling thread, kInvalidWorker outside the job system
+FIBER_NOINLINE uint32_t GetWorkerIndex() {
+    return tls_worker_index;
+}
+
+int64_t GetTimestamp() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+}
+
 static double GetThreadTime() {
+#ifdef _WIN32
     DWORD tid = GetCurrentThreadId();
     HANDLE thread = OpenThread(THREAD_QUERY_INFORMATION, FALSE, tid);
 
@@ -14,16 +53,80 @@ static double GetThreadTime() {
     uint64_t t1 = (uint64_t(kern.dwHighDateTime) << 32) | kern.dwLowDateTime;
     uint64_t t2 = (uint64_t(user.dwHighDateTime) << 32) | user.dwLowDateTime;
     return (t1 + t2) / 1e7;
+#else
+    timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+#endif
+}
+
+template<typename F>
+Job* JobSystem::AllocJob(const F& func) {
+    while (true) {
+        Job* job = job_queue_.Alloc(func);
+        if (job) {
+            //batches and chunks took the name of their owner
+            if (!job->parent) {
+                job->name = JobTrace::IsEnabled() ? GetTraceName() : nullptr;
+            }
+
+            if (scheduler_.IsEnabled()) {
+                AssignScheduleKey(job);
+            }
+
+            return job;
+        }
+
+        if (pool_policy_.run_inline_when_full) {
+            return nullptr;
+        }
+
+        uint32_t worker = GetWorkerIndex();
+        if (worker == kInvalidWorker) {
+            //workers always make progress, a slot frees up eventually
+            std::this_thread::yield();
+            continue;
+        }
+
+        //help with a queued job, or run inline when there is none:
+        //jobs waiting for slots held by jobs that schedule would deadlock otherwise
+        Job* other = job_queue_.TakeOne(worker);
+        if (!other) {
+            return nullptr;
+        }
+
+        if (!CanRunNested(other)) {
+            PushJob(other);
+            return nullptr;
+        }
+
+        ExecuteJob(other);
+        FinishJob(other);
+    }
 }
 
-void JobSystem::Initialize(uint32_t thread_count) {
-    job_fiber_cookie_ = FlsAlloc(NULL);
-    ThrowAssert(job_fiber_cookie_, "FlsAlloc(...)");
+void JobSystem::Initialize(uint32_t thread_count, const JobIdlePolicy& idle_policy,
+    const JobPoolPolicy& pool_policy, const JobThreadPolicy& thread_policy)
+{
+    job_fiber_local_.Alloc();
+    idle_policy_ = idle_policy;
+    pool_policy_ = pool_policy;
+    help_on_wait_.store(thread_policy.help_on_wait, std::memory_order_relaxed);
 
-    thread_pool_.Initialize(thread_count);
+    thread_pool_.Initialize(thread_count, thread_policy.affinity);
     thread_count = thread_pool_.GetThreadCount();
 
-    fiber_pool_.Create(JobFiberPool::kMaxJobFiber - thread_count,
+    worker_states_ = std::make_unique<WorkerState[]>(thread_count);
+
+    job_queue_.Initialize(thread_count, pool_policy.max_job_count);
+
+    JobStackConfig stack_configs[(size_t)JobStackSize::kCount];
+    stack_configs[(size_t)JobStackSize::kSmall] = { pool_policy.small_stack_size, pool_policy.max_fiber_count };
+    stack_configs[(size_t)JobStackSize::kLarge] = { pool_policy.large_stack_size, pool_policy.max_large_fiber_count };
+    fiber_pool_.Initialize(thread_count, stack_configs);
+
+    //a loop fiber per thread plus a chunk, more are created on demand
+    fiber_pool_.Create(thread_count + JobFiberPool::kFiberChunkSize,
         [this](void* param) {
             JobFiber* fiber = (JobFiber*)param;
             FiberLoop(fiber);
@@ -31,6 +134,13 @@ void JobSystem::Initialize(uint32_t thread_count) {
         }
     );
 
+    //reserved up front, a thread starting late could find the pool exhausted
+    loop_fibers_.resize(thread_count);
+    for (auto& fiber : loop_fibers_) {
+        fiber = fiber_pool_.AllocFiber(nullptr);
+        assert(fiber);
+    }
+
     for (uint32_t i = 0; i < thread_count; ++i) {
         thread_pool_.Schedule([this]() {
             ThreadLoop();
@@ -44,7 +154,7 @@ void JobSystem::Shutdown() {
     thread_pool_.JoinAll();
     fiber_pool_.Release();
 
-    FlsFree(job_fiber_cookie_);
+    job_fiber_local_.Free();
 }
 
 bool JobSystem::IsComplete(const JobHandle& handle) {
@@ -57,22 +167,34 @@ uint32_t JobSystem::DispatchGroupCount(uint32_t job_count, uint32_t batch_size)
     return (job_count + batch_size - 1) / batch_size;
 }
 
-JobHandle JobSystem::Schedule(JobDelegate&& task, JobPriority pri) {
+JobHandle JobSystem::Schedule(JobDelegate&& task, JobPriority pri, JobStackSize stack) {
     JobHandle handle;
     handle.priority = pri;
 
-    job_queue_.Push([&task, &handle, pri](Job& job, uint32_t index) {
-        job.task = std::move(task);
+    Job* job = AllocJob([&task, &handle, pri, stack](Job& job, uint32_t index) {
+        job.SetTask(std::move(task));
         job.priority = pri;
+        job.stack = stack;
+        job.dependancy_counter.store(1, std::memory_order_relaxed); //released below
 
         handle.index = index;
         handle.version = job.version.load(std::memory_order_relaxed);
     });
 
+    if (!job) {
+        RunInline(task, nullptr, 0);
+        handle.index = JobHandle::kInvalidIndex;
+        return handle;
+    }
+
+    ReleaseDependency(job);
+
     return handle;
 }
 
-JobHandle JobSystem::Schedule(JobDelegate&& task, const JobHandle& wait_handle, JobPriority pri) {
+JobHandle JobSystem::Schedule(JobDelegate&& task, const JobHandle& wait_handle, JobPriority pri,
+    JobStackSize stack)
+{
     JobHandle handle;
     handle.priority = pri;
 
@@ -80,75 +202,196 @@ JobHandle JobSystem::Schedule(JobDelegate&& task, const JobHandle& wait_handle,
         handle.priority = wait_handle.priority;
     }
 
-    job_queue_.Push([&task, &handle, &wait_handle](Job& job, uint32_t index) {
-        job.task = std::move(task);
+    Job* job = AllocJob([&task, &handle, stack](Job& job, uint32_t index) {
+        job.SetTask(std::move(task));
         job.priority = handle.priority;
-        job.wait_handle = wait_handle;
+        job.stack = stack;
+        job.dependancy_counter.store(1, std::memory_order_relaxed); //released below
 
         handle.index = index;
         handle.version = job.version.load(std::memory_order_relaxed);
     });
 
+    if (!job) {
+        RunInline(task, &wait_handle, 1);
+        handle.index = JobHandle::kInvalidIndex;
+        return handle;
+    }
+
+    AddDependency(job, wait_handle);
+    ReleaseDependency(job);
+
     return handle;
 }
 
-JobHandle JobSystem::Schedule(const ParallelJobDelegate& task, uint32_t job_count,
-    uint32_t batch_size, JobPriority pri)
+JobHandle JobSystem::Schedule(JobDelegate&& task, const JobHandle* wait_handles, uint32_t wait_count,
+    JobPriority pri, JobStackSize stack)
 {
     JobHandle handle;
     handle.priority = pri;
 
+    for (uint32_t i = 0; i < wait_count; ++i) {
+        if ((int)handle.priority < (int)wait_handles[i].priority) {
+            handle.priority = wait_handles[i].priority;
+        }
+    }
+
+    Job* job = AllocJob([&task, &handle, wait_count, stack](Job& job, uint32_t index) {
+        job.SetTask(std::move(task));
+        job.priority = handle.priority;
+        job.stack = stack;
+        job.dependancy_counter.store(wait_count + 1, std::memory_order_relaxed); //guard released below
+
+        handle.index = index;
+        handle.version = job.version.load(std::memory_order_relaxed);
+    });
+
+    if (!job) {
+        RunInline(task, wait_handles, wait_count);
+        handle.index = JobHandle::kInvalidIndex;
+        return handle;
+    }
+
+    for (uint32_t i = 0; i < wait_count; ++i) {
+        if (!job_queue_.AddSuccessor(wait_handles[i], job)) {
+            //the guard is still held, can't drop to 0 here
+            job->dependancy_counter.fetch_sub(1, std::memory_order_relaxed);
+        }
+    }
+
+    ReleaseDependency(job);
+
+    return handle;
+}
+
+JobHandle JobSystem::Schedule(ParallelJobDelegate&& task, uint32_t job_count,
+    uint32_t batch_size, JobPriority pri, JobStackSize stack)
+{
+    JobHandle wait_handle;
+    wait_handle.priority = pri;
+
+    return Schedule(std::move(task), job_count, batch_size, wait_handle, pri, stack);
+}
+
+JobHandle JobSystem::Schedule(ParallelJobDelegate&& task, uint32_t job_count, uint32_t batch_size,
+    const JobHandle& wait_handle, JobPriority pri, JobStackSize stack)
+{
+    JobHandle handle;
     uint32_t dispatch_count = 0;
+
     if (batch_size == 0) {
-        dispatch_count = thread_pool_.GetThreadCount();
-    }
-    else {
-        dispatch_count = DispatchGroupCount(job_count, batch_size);
+        //one batch per thread
+        uint32_t thread_count = GetThreadCount();
+        batch_size = std::max(1u, (job_count + thread_count - 1) / thread_count);
     }
 
+    dispatch_count = DispatchGroupCount(job_count, batch_size);
+
     if (dispatch_count == 0) {
         handle.index = JobHandle::kInvalidIndex;
         return handle;
     }
 
-    Job* parent = job_queue_.Push([&handle, dispatch_count, pri](Job& job, uint32_t index) {
-        job.dependancy_counter.store(dispatch_count, std::memory_order_relaxed);
-        job.priority = pri;
+    if ((int)pri < (int)wait_handle.priority) {
+        pri = wait_handle.priority;
+    }
+
+    handle.priority = pri;
+
+    //the parent owns the delegate and completes as soon as its last batch does
+    Job* parent = AllocJob([&task, &handle, dispatch_count, stack](Job& job, uint32_t index) {
+        job.SetParallelTask(std::move(task));
+        job.dependancy_counter.store(dispatch_count + 1, std::memory_order_relaxed);
+        job.priority = handle.priority;
+        job.stack = stack;
 
         handle.index = index;
         handle.version = job.version.load(std::memory_order_relaxed);
     });
 
-    assert(parent);
+    if (!parent) {
+        RunInline([&task, job_count]() {
+            for (uint32_t i = 0; i < job_count; ++i) {
+                task(i);
+            }
+        }, &wait_handle, 1);
+
+        handle.index = JobHandle::kInvalidIndex;
+        return handle;
+    }
 
     for (uint32_t i = 0; i < dispatch_count; ++i) {
-        job_queue_.Push([&task, parent, pri, job_count, batch_size, i](Job& job, uint32_t index) {
-            job.parallel_task = task;
+        auto batch_begin = i * batch_size;
+        auto batch_end = std::min(batch_begin + batch_size, job_count);
+        Job* job = AllocJob([parent, pri, stack, batch_begin, batch_end](Job& job, uint32_t) {
+            job.SetBatch(parent, batch_begin, batch_end);
             job.priority = pri;
-            job.parent = parent;
-            job.batch_id = i;
-            job.batch_begin = i * batch_size;
-            job.batch_end = std::min(job.batch_begin + batch_size, job_count);
+            job.stack = stack;
+            job.dependancy_counter.store(1, std::memory_order_relaxed);
         });
+
+        if (!job) {
+            RunInline([parent, batch_begin, batch_end]() {
+                for (uint32_t i = batch_begin; i < batch_end; ++i) {
+                    parent->parallel_task(i);
+                }
+            }, &wait_handle, 1);
+
+            ReleaseDependency(parent);
+            continue;
+        }
+
+        AddDependency(job, wait_handle);
+        ReleaseDependency(job);
     }
 
+    ReleaseDependency(parent);
+
     return handle;
 }
 
-JobHandle JobSystem::Schedule(const ParallelJobDelegate& task, uint32_t job_count, uint32_t batch_size,
-    const JobHandle& wait_handle, JobPriority pri)
-{
+JobHandle JobSystem::CreateManualHandle(JobPriority pri) {
     JobHandle handle;
-    uint32_t dispatch_count = 0;
+    handle.priority = pri;
 
-    if (batch_size == 0) {
-        dispatch_count = thread_pool_.GetThreadCount();
-    }
-    else {
-        dispatch_count = DispatchGroupCount(job_count, batch_size);
+    auto init = [&handle](Job& job, uint32_t index) {
+        job.priority = handle.priority;
+        job.dependancy_counter.store(1, std::memory_order_relaxed); //released by CompleteManualHandle
+
+        handle.index = index;
+        handle.version = job.version.load(std::memory_order_relaxed);
+    };
+
+    //the handle is needed, never fall back to inline here,
+    //AllocJob names it for the trace and keys it for record and replay like any other job
+    while (!AllocJob(init)) {
+        YieldJob();
     }
 
-    if (dispatch_count == 0) {
+    return handle;
+}
+
+void JobSystem::CompleteManualHandle(const JobHandle& handle) {
+    Job* job = job_queue_.GetJob(handle.index);
+    assert(job->kind == JobKind::kEmpty && !job->IsComplete(handle.version));
+
+    ReleaseDependency(job);
+}
+
+JobHandle JobSystem::ParallelFor(RangeJobDelegate&& task, uint32_t count, uint32_t grain_size, JobPriority pri,
+    JobStackSize stack)
+{
+    JobHandle wait_handle;
+    wait_handle.priority = pri;
+
+    return ParallelFor(std::move(task), count, grain_size, wait_handle, pri, stack);
+}
+
+JobHandle JobSystem::ParallelFor(RangeJobDelegate&& task, uint32_t count, uint32_t grain_size,
+    const JobHandle& wait_handle, JobPriority pri, JobStackSize stack)
+{
+    JobHandle handle;
+    if (count == 0) {
         handle.index = JobHandle::kInvalidIndex;
         return handle;
     }
@@ -159,35 +402,317 @@ JobHandle JobSystem::Schedule(const ParallelJobDelegate& task, uint32_t job_coun
 
     handle.priority = pri;
 
-    Job* parent = job_queue_.Push([&handle, dispatch_count](Job& job, uint32_t index) {
-        job.dependancy_counter.store(dispatch_count, std::memory_order_relaxed);
+    //the owner keeps the delegate, chunks split off from the first one all hold a dependency on it
+    Job* owner = AllocJob([&task, &handle, grain_size, stack](Job& job, uint32_t index) {
+        job.SetRangeTask(std::move(task), grain_size);
         job.priority = handle.priority;
+        job.stack = stack;
+        job.dependancy_counter.store(2, std::memory_order_relaxed); //first chunk + guard
 
         handle.index = index;
         handle.version = job.version.load(std::memory_order_relaxed);
     });
 
-    assert(parent);
+    if (!owner) {
+        RunInline([&task, count]() { task(0, count); }, &wait_handle, 1);
+        handle.index = JobHandle::kInvalidIndex;
+        return handle;
+    }
 
-    for (uint32_t i = 0; i < dispatch_count; ++i) {
-        auto batch_begin = i * batch_size;
-        auto batch_end = std::min(batch_begin + batch_size, job_count);
-        job_queue_.Push([&task, parent, &wait_handle, pri, batch_begin, batch_end, i](Job& job, uint32_t index) {
-            job.parallel_task = task;
-            job.priority = pri;
-            job.wait_handle = wait_handle;
-            job.parent = parent;
-            job.batch_id = i;
-            job.batch_begin = batch_begin;
-            job.batch_end = batch_end;
-        });
+    Job* chunk = AllocJob([owner, pri, count](Job& job, uint32_t) {
+        job.SetChunk(owner, 0, count);
+        job.priority = pri;
+        job.stack = owner->stack;
+        job.dependancy_counter.store(1, std::memory_order_relaxed);
+    });
+
+    if (chunk) {
+        AddDependency(chunk, wait_handle);
+        ReleaseDependency(chunk);
     }
+    else {
+        RunInline([owner, count]() { owner->range_task(0, count); }, &wait_handle, 1);
+        ReleaseDependency(owner);
+    }
+
+    ReleaseDependency(owner);
 
     return handle;
 }
 
+void JobSystem::GetScanBlocks(uint32_t count, uint32_t grain_size, uint32_t& block_count, uint32_t& block_size) const {
+    constexpr uint32_t kBlocksPerThread = 4;
+
+    grain_size = std::max(1u, grain_size);
+    block_count = std::min((count + grain_size - 1) / grain_size, GetThreadCount() * kBlocksPerThread);
+    block_size = block_count > 0 ? (count + block_count - 1) / block_count : 0;
+    block_count = block_size > 0 ? (count + block_size - 1) / block_size : 0;
+}
+
+void JobSystem::RunInline(const JobDelegate& task, const JobHandle* wait_handles, uint32_t wait_count) {
+    inline_job_count_.fetch_add(1, std::memory_order_relaxed);
+
+    for (uint32_t i = 0; i < wait_count; ++i) {
+        WaitComplete(wait_handles[i]);
+    }
+
+    if (task) {
+        task();
+    }
+}
+
+JobPoolStats JobSystem::GetPoolStats() const {
+    JobPoolStats stats;
+    stats.job_count = job_queue_.GetJobCount();
+    stats.job_capacity = job_queue_.GetCapacity();
+    stats.job_high_water = job_queue_.GetHighWater();
+    stats.fiber_count = fiber_pool_.GetFiberCount(JobStackSize::kSmall) + fiber_pool_.GetFiberCount(JobStackSize::kLarge);
+    stats.fiber_high_water = fiber_pool_.GetHighWater(JobStackSize::kSmall) + fiber_pool_.GetHighWater(JobStackSize::kLarge);
+    stats.inline_job_count = inline_job_count_.load(std::memory_order_relaxed);
+
+    return stats;
+}
+
+JobStackStats JobSystem::GetStackStats(JobStackSize stack) const {
+    JobStackStats stats;
+    stats.stack_size = fiber_pool_.GetStackSize(stack);
+    stats.stack_high_water = fiber_pool_.GetStackHighWater(stack);
+    stats.fiber_count = fiber_pool_.GetFiberCount(stack);
+    stats.fiber_high_water = fiber_pool_.GetHighWater(stack);
+
+    return stats;
+}
+
+void JobSystem::AddDependency(Job* job, const JobHandle& wait_handle) {
+    //count first, wait_handle may complete and release job as soon as it is registered
+    job->dependancy_counter.fetch_add(1, std::memory_order_relaxed);
+    if (!job_queue_.AddSuccessor(wait_handle, job)) {
+        job->dependancy_counter.fetch_sub(1, std::memory_order_relaxed);
+    }
+}
+
+void JobSystem::ReleaseDependency(Job* job) {
+    if (job->dependancy_counter.fetch_sub(1, std::memory_order_acq_rel) != 1) {
+        return;
+    }
+
+    if (job->IsRunnable()) {
+        PushJob(job);
+    }
+    else {
+        FinishJob(job);
+    }
+}
+
+void JobSystem::ExecuteJob(Job* job) {
+    if (JobTrace::IsEnabled()) {
+        TraceJob(JobTraceEvent::kJobBegin, job,
+            job->parent ? job_queue_.GetIndex(job->parent) : JobHandle::kInvalidIndex);
+    }
+
+    int64_t begin = scheduler_.IsEnabled() ? GetTimestamp() : 0;
+
+    if (job->kind == JobKind::kChunk) {
+        ExecuteChunk(job);
+    }
+    else {
+        job->Execute();
+    }
+
+    if (begin) {
+        //the worker it started on, a suspended job may end elsewhere
+        scheduler_.RecordPick(job_queue_.GetIndex(job), GetWorkerIndex(), begin, GetTimestamp());
+    }
+
+    TraceJob(JobTraceEvent::kJobEnd, job);
+}
+
+//Lazy binary splitting (Tzannes et al.): the range is only halved when the local deque is empty,
+//that is when thieves took everything offered so far, so idle workers get work on demand
+//while a busy system runs the range mostly unsplit
+void JobSystem::ExecuteChunk(Job* job) {
+    Job* owner = job->parent;
+    auto& delegate = owner->range_task;
+    uint32_t grain_size = owner->grain_size;
+    uint32_t worker = GetWorkerIndex();
+
+    uint32_t begin = job->batch_begin;
+    uint32_t end = job->batch_end;
+    while (begin < end) {
+        //recorded and serial runs split the same way whatever the timing, down to grain_size
+        if (end - begin > grain_size && (scheduler_.IsEnabled() || job_queue_.IsLocalEmpty(job->priority, worker))) {
+            uint32_t mid = begin + (end - begin) / 2;
+            if (SpawnChunk(owner, mid, end, job->priority)) {
+                end = mid;
+                continue;
+            }
+        }
+
+        uint32_t chunk_end = std::min(end, begin + grain_size);
+        delegate(begin, chunk_end);
+        begin = chunk_end;
+    }
+}
+
+bool JobSystem::SpawnChunk(Job* owner, uint32_t begin, uint32_t end, JobPriority pri) {
+    Job* chunk = job_queue_.Alloc([owner, pri, begin, end](Job& job, uint32_t) {
+        job.SetChunk(owner, begin, end);
+        job.priority = pri;
+        job.stack = owner->stack;
+        job.dependancy_counter.store(0, std::memory_order_relaxed);
+    });
+
+    if (!chunk) {
+        return false;
+    }
+
+    if (scheduler_.IsEnabled()) {
+        AssignScheduleKey(chunk);
+    }
+
+    //the running chunk still holds the owner, it can't complete in between
+    owner->dependancy_counter.fetch_add(1, std::memory_order_relaxed);
+    PushJob(chunk);
+
+    return true;
+}
+
+void JobSystem::FinishJob(Job* job) {
+    Job* parent = job->parent;
+    Job* successors;
+    JobFiber* waiting_fibers;
+
+    job_queue_.Complete(job, successors, waiting_fibers);
+
+    while (successors) {
+        Job* next = successors->next_successor;
+        successors->next_successor = nullptr;
+        ReleaseDependency(successors);
+        successors = next;
+    }
+
+    while (waiting_fibers) {
+        JobFiber* next = waiting_fibers->next_waiter;
+        waiting_fibers->next_waiter = nullptr;
+        ResumeFiber(waiting_fibers);
+        waiting_fibers = next;
+    }
+
+    if (parent) {
+        ReleaseDependency(parent);
+    }
+}
+
 void JobSystem::Exit() noexcept {
     keep_running_.store(false, std::memory_order_relaxed);
+    NotifyAllWorkers();
+}
+
+void JobSystem::PushJob(Job* job) {
+    TraceJob(JobTraceEvent::kJobQueue, job);
+    if (scheduler_.IsSerial()) {
+        scheduler_.Push(job, job_queue_.GetIndex(job));
+        return;
+    }
+
+    job_queue_.Push(job, GetWorkerIndex());
+    NotifyWorker();
+}
+
+void JobSystem::ResumeFiber(JobFiber* fiber) {
+    fiber_pool_.Suspend(fiber, GetWorkerIndex());
+    NotifyWorker();
+}
+
+void JobSystem::Idle(uint32_t& idle_rounds) {
+    if (idle_rounds < idle_policy_.spin_count) {
+        ++idle_rounds;
+        concurrent::CpuRelax();
+    }
+    else if (!idle_policy_.park || idle_rounds < idle_policy_.spin_count + idle_policy_.yield_count) {
+        ++idle_rounds;
+        std::this_thread::yield();
+    }
+    else {
+        Park();
+        idle_rounds = 0;
+    }
+}
+
+void JobSystem::Park() {
+    uint32_t worker = GetWorkerIndex();
+    if (worker == kInvalidWorker) {
+        std::this_thread::yield();
+        return;
+    }
+
+    auto& state = worker_states_[worker];
+    state.park_state.store(kParked, std::memory_order_relaxed);
+    parked_count_.fetch_add(1, std::memory_order_seq_cst);
+
+    //pairs with the fence in NotifyWorker: either the pusher sees this worker parked
+    //or this worker sees what was pushed
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (keep_running_.load(std::memory_order_relaxed) && !job_queue_.HasWork() && !fiber_pool_.HasWork()) {
+        ++state.park_count;
+        JobTrace::Record(JobTraceEvent::kIdleBegin);
+        while (state.park_state.load(std::memory_order_acquire) == kParked) {
+            concurrent::FutexWait(state.park_state, kParked);
+        }
+        JobTrace::Record(JobTraceEvent::kIdleEnd);
+    }
+
+    uint32_t expected = kParked;
+    if (!state.park_state.compare_exchange_strong(expected, kRunning, std::memory_order_acq_rel)) {
+        //woken up by a push
+        int64_t wake_time = state.wake_time.exchange(0, std::memory_order_relaxed);
+        if (wake_time > 0) {
+            double latency = (GetTimestamp() - wake_time) / 1e3;
+            ++state.wake_count;
+            state.wake_latency += latency;
+            state.max_wake_latency = std::max(state.max_wake_latency, latency);
+        }
+
+        state.park_state.store(kRunning, std::memory_order_relaxed);
+    }
+
+    parked_count_.fetch_sub(1, std::memory_order_relaxed);
+}
+
+void JobSystem::NotifyWorker() {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (parked_count_.load(std::memory_order_relaxed) == 0) {
+        return;
+    }
+
+    //wake a single parked worker, the next one after the caller so wakeups spread
+    uint32_t count = GetThreadCount();
+    uint32_t worker = GetWorkerIndex();
+    uint32_t start = worker < count ? worker + 1 : 0;
+    for (uint32_t n = 0; n < count; ++n) {
+        auto& state = worker_states_[(start + n) % count];
+        uint32_t expected = kParked;
+        if (state.park_state.load(std::memory_order_relaxed) == kParked &&
+            state.park_state.compare_exchange_strong(expected, kNotified, std::memory_order_acq_rel))
+        {
+            state.wake_time.store(GetTimestamp(), std::memory_order_relaxed);
+            concurrent::FutexWakeOne(state.park_state);
+            return;
+        }
+    }
+}
+
+void JobSystem::NotifyAllWorkers() {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (!worker_states_) return;
+
+    for (uint32_t i = 0; i < GetThreadCount(); ++i) {
+        auto& state = worker_states_[i];
+        uint32_t expected = kParked;
+        if (state.park_state.compare_exchange_strong(expected, kNotified, std::memory_order_acq_rel)) {
+            concurrent::FutexWakeOne(state.park_state);
+        }
+    }
 }
 
 void JobSystem::WaitUntilFinish() {
@@ -203,6 +728,11 @@ void JobSystem::WaitUntilFinish() {
             break;
         }
 
+        //nobody else runs the jobs of a serial mode
+        if (scheduler_.IsSerial() && RunNestedJob()) {
+            continue;
+        }
+
         std::this_thread::sleep_for(std::chrono::milliseconds(1));
     }
 
@@ -213,92 +743,271 @@ void JobSystem::WaitUntilFinish() {
     }
 }
 
+void JobSystem::WaitComplete(const JobHandle& handle) {
+    JobFiber* self_fiber = (JobFiber*)job_fiber_local_.Get();
+
+    while (!IsComplete(handle)) {
+        if (self_fiber) {
+            //park on the job, FinishJob puts this fiber back on the active list
+            JobFiber* next_fiber = PullActiveJob();
+            if (!next_fiber) {
+                next_fiber = fiber_pool_.AllocFiber(nullptr);
+            }
+
+            if (next_fiber) {
+                SwitchFiber(self_fiber, next_fiber, FiberTransfer::kWait, &handle);
+                continue;
+            }
+
+            //out of fibers, run a job nested on this stack so the awaited one can make progress
+            if (RunNestedJob()) {
+                continue;
+            }
+        }
+        else if (IsHelpingOnWait() && RunNestedJob()) {
+            continue;
+        }
+
+        std::this_thread::yield();
+    }
+}
+
+const char* JobSystem::GetTraceName() {
+    const char* name = JobTrace::GetScopeName();
+    if (!name) {
+        JobFiber* fiber = (JobFiber*)job_fiber_local_.Get();
+        if (fiber && fiber->job) {
+            name = fiber->job->name;
+        }
+    }
+
+    return name;
+}
+
+bool JobSystem::RunNestedJob() {
+    Job* job = scheduler_.IsSerial() ? scheduler_.Take() : job_queue_.TakeOne(GetWorkerIndex());
+    if (!job) {
+        return false;
+    }
+
+    if (!CanRunNested(job)) {
+        PushJob(job);
+        return false;
+    }
+
+    Job*& nested_job = GetNestedJob();
+    Job* outer_job = nested_job;
+    nested_job = job;
+
+    ExecuteJob(job);
+
+    GetNestedJob() = outer_job;
+    FinishJob(job);
+    return true;
+}
+
+uint32_t JobSystem::GetCurrentWorker() {
+    return GetWorkerIndex();
+}
+
+Job* JobSystem::GetRunningJob() {
+    JobFiber* fiber = (JobFiber*)job_fiber_local_.Get();
+    return fiber ? fiber->job : GetNestedJob();
+}
+
+void JobSystem::AssignScheduleKey(Job* job) {
+    Job* creator = job->parent ? nullptr : GetRunningJob();
+    scheduler_.AssignKey(job, job_queue_.GetIndex(job),
+        job->parent ? job_queue_.GetIndex(job->parent) : JobHandle::kInvalidIndex,
+        creator ? job_queue_.GetIndex(creator) : JobHandle::kInvalidIndex);
+}
+
+void JobSystem::SetScheduleConfig(const JobScheduleConfig& config) {
+    assert(job_queue_.GetJobCount() == 0);
+    scheduler_.Configure(config);
+}
+
+bool JobSystem::CanRunNested(Job* job) {
+    if (job->stack == JobStackSize::kSmall) {
+        return true;
+    }
+
+    //threads outside the job system run on their own stack
+    JobFiber* self_fiber = (JobFiber*)job_fiber_local_.Get();
+    return !self_fiber || self_fiber->stack == job->stack;
+}
+
 void JobSystem::YieldJob() {
-    JobFiber* self_fiber = (JobFiber*)FlsGetValue(job_fiber_cookie_);
+    JobFiber* self_fiber = (JobFiber*)job_fiber_local_.Get();
     if (self_fiber) {
         JobFiber* next_fiber = PullActiveJob();
 
-        if (next_fiber) {
-            assert(next_fiber->job);
-            if (!next_fiber->job->HasDependency()) {
-                fiber_pool_.Suspend(self_fiber);
-                SwitchToFiber(next_fiber->fiber.GetAddress());
-                return;
-            }
-            fiber_pool_.Suspend(next_fiber);
-        }
-        else {
-            Job* job = job_queue_.TakeOne();
+        if (!next_fiber) {
+            Job* job = job_queue_.TakeOne(GetWorkerIndex());
             if (job) {
-                if (!job->HasDependency()) {
-                    next_fiber = fiber_pool_.AllocFiber(job);
-                    if (next_fiber) {
-                        fiber_pool_.Suspend(self_fiber);
-                        SwitchToFiber(next_fiber->fiber.GetAddress());
-                        return;
-                    }
+                next_fiber = fiber_pool_.AllocFiber(job);
+                if (!next_fiber) {
+                    PushJob(job);
                 }
-                job_queue_.Suspend(job);
             }
         }
+
+        if (next_fiber) {
+            SwitchFiber(self_fiber, next_fiber, FiberTransfer::kSuspend);
+            return;
+        }
+    }
+    else if (IsHelpingOnWait() && RunNestedJob()) {
+        return;
     }
+
     std::this_thread::yield();
 }
 
+bool JobSystem::ParkFiber(FiberTransfer::ParkFunc park_func, void* context) {
+    JobFiber* self_fiber = (JobFiber*)job_fiber_local_.Get();
+    if (!self_fiber) {
+        return false;
+    }
+
+    JobFiber* next_fiber = PullActiveJob();
+    if (!next_fiber) {
+        next_fiber = fiber_pool_.AllocFiber(nullptr);
+        if (!next_fiber) {
+            return false;
+        }
+    }
+
+    FiberTransfer transfer;
+    transfer.fiber = self_fiber;
+    transfer.action = FiberTransfer::kPark;
+    transfer.park_func = park_func;
+    transfer.park_context = context;
+
+    SwitchFiber(next_fiber, transfer);
+    return true;
+}
+
 void JobSystem::ThreadLoop() {
+#ifdef _WIN32
     ThrowIfFailed(CoInitialize(NULL), "CoInitialize(...)");
+#endif
 
     double start_thread = GetThreadTime();
     auto start = std::chrono::high_resolution_clock::now();
 
-    auto thread_fiber = ConvertThreadToFiber(NULL);
-    auto ptr = fiber_pool_.Create(thread_fiber);
+    tls_worker_index = worker_count_.fetch_add(1, std::memory_order_relaxed);
+
+    char thread_name[32];
+    snprintf(thread_name, sizeof(thread_name), "job worker %u", tls_worker_index);
+    JobTrace::SetThreadName(thread_name);
+
+    //The thread fiber only parks the thread, jobs always run on pooled fibers
+    //which switch back here once the job system stops running
+    Fiber thread_fiber;
+    thread_fiber.InitFromThread();
 
-    FiberLoop(ptr);
+    JobFiber* loop_fiber = loop_fibers_[tls_worker_index];
+    SwitchFiber(nullptr, loop_fiber, FiberTransfer::kFree);
 
-    ConvertFiberToThread();
+    thread_fiber.ReleaseThread();
 
     double end_thread = GetThreadTime();
     double duration = (std::chrono::high_resolution_clock::now() - start).count() / 1e9;
     double cpuUsage = 100 * (end_thread - start_thread) / duration;
-    
+
+    auto& state = worker_states_[tls_worker_index];
+    double avg_latency = state.wake_count > 0 ? state.wake_latency / state.wake_count : 0.0;
+    tls_worker_index = kInvalidWorker;
+
     char buf[1024];
-    snprintf(buf, 1024, "cpu usage: %.1lf\n", cpuUsage);
+    snprintf(buf, 1024, "cpu usage: %.1lf, parked %llu times, wake latency: %.1lf us(avg) %.1lf us(max)\n",
+        cpuUsage, (unsigned long long)state.park_count, avg_latency, state.max_wake_latency);
     
+#ifdef _WIN32
     OutputDebugStringA(buf);
 
     CoUninitialize();
+#else
+    fputs(buf, stderr);
+#endif
 }
 
 JobFiber* JobSystem::PullActiveJob() {
-    JobFiber* fiber = fiber_pool_.TakeOne();
+    JobFiber* fiber = fiber_pool_.TakeOne(GetWorkerIndex());
     return fiber;
 }
 
+void JobSystem::SwitchFiber(JobFiber* self_fiber, JobFiber* next_fiber,
+    FiberTransfer::Action action, const JobHandle* wait_handle)
+{
+    FiberTransfer transfer;
+    transfer.fiber = self_fiber;
+    transfer.action = action;
+    transfer.wait_handle = wait_handle;
+
+    SwitchFiber(next_fiber, transfer);
+}
+
+void JobSystem::SwitchFiber(JobFiber* next_fiber, const FiberTransfer& transfer) {
+    Job* self_job = transfer.fiber ? transfer.fiber->job : nullptr;
+    if (self_job) {
+        TraceJob(JobTraceEvent::kJobSuspend, self_job, transfer.action);
+    }
+
+    GetFiberTransfer() = transfer;
+
+    next_fiber->fiber.SwitchTo();
+
+    //may be resumed by another thread
+    CompleteFiberSwitch();
+
+    if (self_job) {
+        TraceJob(JobTraceEvent::kJobResume, self_job);
+    }
+}
+
+void JobSystem::CompleteFiberSwitch() {
+    auto& transfer = GetFiberTransfer();
+    JobFiber* prev_fiber = transfer.fiber;
+    if (!prev_fiber) {
+        return;
+    }
+
+    transfer.fiber = nullptr;
+    switch (transfer.action) {
+    case FiberTransfer::kFree:
+        fiber_pool_.FreeFiber(prev_fiber);
+        break;
+    case FiberTransfer::kSuspend:
+        fiber_pool_.Suspend(prev_fiber, GetWorkerIndex());
+        break;
+    case FiberTransfer::kWait:
+        if (!job_queue_.AddWaitingFiber(*transfer.wait_handle, prev_fiber)) {
+            fiber_pool_.Suspend(prev_fiber, GetWorkerIndex());
+        }
+        break;
+    case FiberTransfer::kPark:
+        if (!transfer.park_func(transfer.park_context, prev_fiber)) {
+            fiber_pool_.Suspend(prev_fiber, GetWorkerIndex());
+        }
+        break;
+    }
+}
+
 void JobSystem::FiberLoop(JobFiber* self_fiber) {
-    FlsSetValue(job_fiber_cookie_, self_fiber);
-    
-    Timer timer;
+    CompleteFiberSwitch();
+    job_fiber_local_.Set(self_fiber);
+
+    uint32_t idle_rounds = 0;
     while (keep_running_.load(std::memory_order_relaxed)) {
         auto self_job = self_fiber->job;
         if (self_job) {
-            if (self_job->task) {
-                self_job->task();
-            }
-            else if (self_job->parallel_task) {
-                for (int i = self_job->batch_begin; i < self_job->batch_end; ++i) {
-                    self_job->parallel_task(i);
-                }
-            }
-
-            //TODO: resume parent job immediately
-            if (self_job->parent) { //parent job shoudn't be binded with fiber
-                self_job->parent->dependancy_counter.fetch_sub(1, std::memory_order_relaxed);
-            }
+            ExecuteJob(self_job);
 
             self_fiber->job = nullptr;
-            job_queue_.Free(self_job);
-            timer.Mark();
+            FinishJob(self_job);
+            idle_rounds = 0;
 
             continue;
         }
@@ -306,33 +1015,32 @@ void JobSystem::FiberLoop(JobFiber* self_fiber) {
             JobFiber* next_fiber = PullActiveJob();
 
             if (next_fiber) {
-                assert(next_fiber->job);
-                if (!next_fiber->job->HasDependency()) {
-                    fiber_pool_.FreeFiber(self_fiber);
-                    SwitchToFiber(next_fiber->fiber.GetAddress());
-                    timer.Mark();
-                    continue;
-                }
-                
-                fiber_pool_.Suspend(next_fiber);
+                SwitchFiber(self_fiber, next_fiber, FiberTransfer::kFree);
+                idle_rounds = 0;
+                continue;
             }
             else {
-                Job* job = job_queue_.TakeOne();
+                Job* job = job_queue_.TakeOne(GetWorkerIndex());
                 if (job) {
-                    if (!job->HasDependency()) {
+                    if (job->stack == self_fiber->stack) {
                         self_fiber->job = job;
                         continue;
                     }
-                    
-                    job_queue_.Suspend(job);
+
+                    //hand the job to a fiber of its stack class, this one goes back idle
+                    JobFiber* job_fiber = fiber_pool_.AllocFiber(job);
+                    if (job_fiber) {
+                        SwitchFiber(self_fiber, job_fiber, FiberTransfer::kFree);
+                        idle_rounds = 0;
+                        continue;
+                    }
+
+                    PushJob(job);
                 }
             }
         }
 
-        if (timer.DeltaTime() > 0.015f) {
-            std::this_thread::sleep_for(std::chrono::milliseconds(1));
-            timer.Mark();
-        }
+        Idle(idle_rounds);
     }
 }
 
@@ -1,52 +1,320 @@
 #pragma once
 
 #include <array>
+#include <vector>
+#include <algorithm>
 #include "Fiber.h"
 #include "Job.h"
+#include "JobTrace.h"
+#include "JobSchedule.h"
 #include "Common/Singleton.h"
 
 namespace glacier {
 namespace jobs {
 
+//What the fiber switched away from becomes once the switch completed
+struct FiberTransfer {
+    enum Action : uint8_t {
+        kFree,      //back to the idle pool
+        kSuspend,   //runnable, back to the active list
+        kWait,      //parked until wait_handle completes
+        kPark,      //handed over to park_func
+    };
+
+    //Takes the fiber that switched away, returns false if it didn't keep it (the fiber is resumed).
+    //Whoever keeps it hands it back through JobSystem::ResumeFiber
+    using ParkFunc = bool(*)(void* context, JobFiber* fiber);
+
+    JobFiber* fiber = nullptr;
+    Action action = kFree;
+    const JobHandle* wait_handle = nullptr;
+    ParkFunc park_func = nullptr;
+    void* park_context = nullptr;
+};
+
+//How an idle worker waits for work: poll with a cpu pause, then poll with a thread yield,
+//then block until a push wakes it up
+struct JobIdlePolicy {
+    uint32_t spin_count = 64;
+    uint32_t yield_count = 16;
+    bool park = true; //keep yielding forever if false
+};
+
+//The job and fiber pools grow on demand up to these limits
+struct JobPoolPolicy {
+    uint32_t max_job_count = JobQueue::kMaxJob;
+    uint32_t max_fiber_count = 256; //small stack fibers
+    uint32_t max_large_fiber_count = 32;
+    size_t small_stack_size = 256 * 1024;
+    size_t large_stack_size = Fiber::kDefaultStackSize;
+    //a job that finds the pool exhausted runs inline on the scheduling thread,
+    //otherwise workers help with queued jobs first (inline only when none is left)
+    //and other threads wait for a slot
+    bool run_inline_when_full = true;
+};
+
+//Where the workers run and what the thread waiting on a handle does
+struct JobThreadPolicy {
+    //one worker per performance core, the first one is left to the main thread
+    concurrent::ThreadAffinity affinity = { concurrent::CoreSet::kPerformance };
+    //threads outside the job system (the main thread) run queued jobs on their own stack
+    //while waiting in WaitComplete instead of yielding
+    bool help_on_wait = false;
+};
+
+struct JobPoolStats {
+    uint32_t job_count;
+    uint32_t job_capacity;
+    uint32_t job_high_water;
+    uint32_t fiber_count; //all stack classes
+    uint32_t fiber_high_water;
+    uint64_t inline_job_count; //ran inline because the pool was exhausted
+};
+
+struct JobStackStats {
+    size_t stack_size;
+    size_t stack_high_water; //deepest use by any fiber, page granular
+    uint32_t fiber_count;
+    uint32_t fiber_high_water;
+};
+
 class JobSystem : public Singleton<JobSystem> {
 public:
-    static constexpr uint32_t kMaxJobFiber = 256;
-
-    void Initialize(uint32_t thread_count);
+    void Initialize(uint32_t thread_count, const JobIdlePolicy& idle_policy = {},
+        const JobPoolPolicy& pool_policy = {}, const JobThreadPolicy& thread_policy = {});
 
     bool IsComplete(const JobHandle& handle);
 
-    JobHandle Schedule(JobDelegate&& task, JobPriority pri = JobPriority::kNormal);
-    JobHandle Schedule(JobDelegate&& task, const JobHandle& wait_handle, JobPriority pri = JobPriority::kNormal);
+    //stack picks the fiber stack class the task runs on
+    JobHandle Schedule(JobDelegate&& task, JobPriority pri = JobPriority::kNormal,
+        JobStackSize stack = JobStackSize::kSmall);
+    JobHandle Schedule(JobDelegate&& task, const JobHandle& wait_handle, JobPriority pri = JobPriority::kNormal,
+        JobStackSize stack = JobStackSize::kSmall);
+    //Run task once all of wait_handles completed, an empty task makes a join handle
+    JobHandle Schedule(JobDelegate&& task, const JobHandle* wait_handles, uint32_t wait_count,
+        JobPriority pri = JobPriority::kNormal, JobStackSize stack = JobStackSize::kSmall);
+
+    JobHandle Schedule(ParallelJobDelegate&& task, uint32_t job_count, uint32_t batch_size = 0,
+        JobPriority pri = JobPriority::kNormal, JobStackSize stack = JobStackSize::kSmall);
+
+    JobHandle Schedule(ParallelJobDelegate&& task, uint32_t job_count, uint32_t batch_size,
+        const JobHandle& wait_handle, JobPriority pri = JobPriority::kNormal,
+        JobStackSize stack = JobStackSize::kSmall);
+
+    //A job without payload completed by CompleteManualHandle, lets work running outside
+    //of jobs (coroutines, io callbacks) take part in dependencies
+    JobHandle CreateManualHandle(JobPriority pri = JobPriority::kNormal);
+    void CompleteManualHandle(const JobHandle& handle);
+
+    //Adaptive parallel for over [0, count): the range is halved lazily, only when the
+    //running worker has nothing left in its deque for others to steal, down to grain_size
+    //split off chunks run on the stack class of the first one
+    JobHandle ParallelFor(RangeJobDelegate&& task, uint32_t count, uint32_t grain_size = 1,
+        JobPriority pri = JobPriority::kNormal, JobStackSize stack = JobStackSize::kSmall);
+    JobHandle ParallelFor(RangeJobDelegate&& task, uint32_t count, uint32_t grain_size,
+        const JobHandle& wait_handle, JobPriority pri = JobPriority::kNormal,
+        JobStackSize stack = JobStackSize::kSmall);
 
-    JobHandle Schedule(const ParallelJobDelegate& task, uint32_t job_count, uint32_t batch_size = 0,
-        JobPriority pri = JobPriority::kNormal);
+    //reduce(begin, end) -> T folds a range, combine(T, T) -> T must be associative,
+    //partial results are combined in index order so the result doesn't depend on scheduling
+    template<typename T, typename Reduce, typename Combine>
+    T ParallelReduce(uint32_t count, uint32_t grain_size, const T& identity,
+        const Reduce& reduce, const Combine& combine, JobPriority pri = JobPriority::kNormal);
 
-    JobHandle Schedule(const ParallelJobDelegate& task, uint32_t job_count, uint32_t batch_size,
-        const JobHandle& wait_handle, JobPriority pri = JobPriority::kNormal);
+    //Two pass prefix scan: reduce(begin, end) -> T folds a range, then
+    //scan(begin, end, prefix) processes it given the combination of everything before begin
+    template<typename T, typename Reduce, typename Scan, typename Combine>
+    void ParallelScan(uint32_t count, uint32_t grain_size, const T& identity,
+        const Reduce& reduce, const Scan& scan, const Combine& combine, JobPriority pri = JobPriority::kNormal);
+
+    //Switch between normal, recording and serial (replay, deterministic) scheduling,
+    //only while no job is in flight. The serial modes run every job on the thread waiting
+    //for it (WaitComplete, YieldJob, WaitUntilFinish), the workers stay idle.
+    void SetScheduleConfig(const JobScheduleConfig& config);
+    JobScheduleMode GetScheduleMode() const { return scheduler_.GetMode(); }
+    //jobs picked since the mode was set
+    const JobScheduleLog& GetScheduleLog() const { return scheduler_.GetLog(); }
+    uint32_t GetReplayDivergenceCount() const { return scheduler_.GetDivergenceCount(); }
+
+    JobPoolStats GetPoolStats() const;
+    //walks every fiber of the class, not meant for every frame
+    JobStackStats GetStackStats(JobStackSize stack) const;
+    uint32_t GetThreadCount() const { return (uint32_t)thread_pool_.GetThreadCount(); }
+    const std::vector<uint32_t>& GetThreadCpus() const { return thread_pool_.GetThreadCpus(); }
+    void SetHelpOnWait(bool help) { help_on_wait_.store(help, std::memory_order_relaxed); }
+
+    //index of the worker running the calling thread, kInvalidWorker outside the job system
+    static uint32_t GetCurrentWorker();
+    //job running on the calling thread, nullptr outside jobs
+    const Job* GetCurrentJob() { return GetRunningJob(); }
 
     void WaitUntilFinish();
+    void WaitComplete(const JobHandle& handle);
     void YieldJob();
     void Exit() noexcept;
 
+    //Park the running fiber with park_func once it switched away, so a synchronization
+    //primitive can queue it without a lost wakeup. Returns false without calling park_func
+    //outside of a job fiber or if no fiber is left to switch to, the caller has to poll then.
+    bool ParkFiber(FiberTransfer::ParkFunc park_func, void* context);
+    //Make a fiber kept by a park_func runnable again
+    void ResumeFiber(JobFiber* fiber);
+
 protected:
     void Shutdown();
 
     uint32_t DispatchGroupCount(uint32_t job_count, uint32_t batch_size);
     JobFiber* PullActiveJob();
 
+    //nullptr if the pool is exhausted and jobs run inline
+    template<typename F>
+    Job* AllocJob(const F& func);
+    void RunInline(const JobDelegate& task, const JobHandle* wait_handles, uint32_t wait_count);
+    //Take a queued job and run it on the current stack
+    bool RunNestedJob();
+    //A large stack job doesn't run nested on a small stack fiber, it is queued back
+    bool CanRunNested(Job* job);
+    //threads outside the job system run queued jobs while waiting
+    bool IsHelpingOnWait() const {
+        return help_on_wait_.load(std::memory_order_relaxed) || scheduler_.IsSerial();
+    }
+
+    //the job executing on the calling fiber or thread, nullptr outside jobs
+    Job* GetRunningJob();
+    void AssignScheduleKey(Job* job);
+
+    void TraceJob(JobTraceEvent type, Job* job, uint32_t arg = 0) {
+        if (JobTrace::IsEnabled()) {
+            JobTrace::Record(type, job, job_queue_.GetIndex(job), arg);
+        }
+    }
+
+    //trace name of the jobs scheduled now: the JobTraceScope or the running job
+    const char* GetTraceName();
+
+    void AddDependency(Job* job, const JobHandle& wait_handle);
+    //Drop one prerequisite of job, queue it (or finish it if it has no task) when none is left
+    void ReleaseDependency(Job* job);
+    //Retire job and release everything that waits on it
+    void FinishJob(Job* job);
+
+    //Queue a runnable job and wake a parked worker for it
+    void PushJob(Job* job);
+
+    void Idle(uint32_t& idle_rounds);
+    void Park();
+    void NotifyWorker();
+    void NotifyAllWorkers();
+
+    void ExecuteJob(Job* job);
+    void ExecuteChunk(Job* job);
+    bool SpawnChunk(Job* owner, uint32_t begin, uint32_t end, JobPriority pri);
+
+    //split [0, count) in at most a few blocks per worker, each at least grain_size long
+    void GetScanBlocks(uint32_t count, uint32_t grain_size, uint32_t& block_count, uint32_t& block_size) const;
+
+    //Switch to next_fiber, self_fiber is handed back to the pool (idle, active or parked)
+    //only after the switch completed so no other thread can resume it while it is still running
+    void SwitchFiber(JobFiber* self_fiber, JobFiber* next_fiber,
+        FiberTransfer::Action action, const JobHandle* wait_handle = nullptr);
+    void SwitchFiber(JobFiber* next_fiber, const FiberTransfer& transfer);
+    void CompleteFiberSwitch();
+
     void ThreadLoop();
     void FiberLoop(JobFiber* ptrFiber);
 
 private:
+    enum ParkState : uint32_t {
+        kRunning,
+        kParked,
+        kNotified,
+    };
+
+    struct alignas(CACHE_LINE_SIZE) WorkerState {
+        std::atomic<uint32_t> park_state = kRunning; //futex word
+        std::atomic<int64_t> wake_time = 0; //ns, set by the notifier
+
+        //owner only
+        uint64_t park_count = 0;
+        uint64_t wake_count = 0;
+        double wake_latency = 0.0; //total, us
+        double max_wake_latency = 0.0;
+    };
+
     concurrent::ThreadPool thread_pool_;
+    JobIdlePolicy idle_policy_;
+    JobPoolPolicy pool_policy_;
+    std::atomic_bool help_on_wait_ = false;
+    std::atomic<uint64_t> inline_job_count_ = 0;
+    std::vector<JobFiber*> loop_fibers_;
+    std::unique_ptr<WorkerState[]> worker_states_;
+    std::atomic_uint parked_count_ = 0;
 
     JobFiberPool fiber_pool_;
     JobQueue job_queue_;
+    JobScheduler scheduler_;
 
-    DWORD job_fiber_cookie_;
+    FiberLocal job_fiber_local_;
     std::atomic_bool keep_running_ = true;
+    std::atomic_uint worker_count_ = 0;
 };
 
+template<typename T, typename Reduce, typename Combine>
+T JobSystem::ParallelReduce(uint32_t count, uint32_t grain_size, const T& identity,
+    const Reduce& reduce, const Combine& combine, JobPriority pri)
+{
+    uint32_t block_count, block_size;
+    GetScanBlocks(count, grain_size, block_count, block_size);
+
+    std::vector<T> partials(block_count, identity);
+    auto handle = ParallelFor([&partials, &reduce, block_size, count](uint32_t begin, uint32_t end) {
+        for (uint32_t i = begin; i < end; ++i) {
+            partials[i] = reduce(i * block_size, std::min(count, (i + 1) * block_size));
+        }
+    }, block_count, 1, pri);
+
+    WaitComplete(handle);
+
+    T result = identity;
+    for (auto& partial : partials) {
+        result = combine(result, partial);
+    }
+
+    return result;
+}
+
+template<typename T, typename Reduce, typename Scan, typename Combine>
+void JobSystem::ParallelScan(uint32_t count, uint32_t grain_size, const T& identity,
+    const Reduce& reduce, const Scan& scan, const Combine& combine, JobPriority pri)
+{
+    uint32_t block_count, block_size;
+    GetScanBlocks(count, grain_size, block_count, block_size);
+
+    std::vector<T> prefix(block_count, identity);
+    auto sum_handle = ParallelFor([&prefix, &reduce, block_size, count](uint32_t begin, uint32_t end) {
+        for (uint32_t i = begin; i < end; ++i) {
+            prefix[i] = reduce(i * block_size, std::min(count, (i + 1) * block_size));
+        }
+    }, block_count, 1, pri);
+
+    WaitComplete(sum_handle);
+
+    //exclusive prefix of the block sums
+    T sum = identity;
+    for (auto& value : prefix) {
+        T block_sum = value;
+        value = sum;
+        sum = combine(sum, block_sum);
+    }
+
+    auto scan_handle = ParallelFor([&prefix, &scan, block_size, count](uint32_t begin, uint32_t end) {
+        for (uint32_t i = begin; i < end; ++i) {
+            scan(i * block_size, std::min(count, (i + 1) * block_size), prefix[i]);
+        }
+    }, block_count, 1, pri);
+
+    WaitComplete(scan_handle);
+}
+
 }
 }
@@ -0,0 +1,153 @@
+#include "JobTask.h"
+#include <assert.h>
+#include <new>
+#include <stdexcept>
+#include "Common/Log.h"
+
+namespace glacier {
+namespace jobs {
+
+CoroutineFrameAllocator::SizeClass CoroutineFrameAllocator::classes_[kClassCount];
+std::atomic<size_t> CoroutineFrameAllocator::in_use_ = 0;
+std::atomic<size_t> CoroutineFrameAllocator::high_water_ = 0;
+
+size_t CoroutineFrameAllocator::GetClass(size_t size) {
+    size_t index = 0;
+    size_t class_size = kMinFrameSize;
+    while (class_size < size) {
+        class_size <<= 1;
+        ++index;
+    }
+
+    return index;
+}
+
+void* CoroutineFrameAllocator::Allocate(size_t size) {
+    size_t index = GetClass(size);
+    if (index >= kClassCount) {
+        return ::operator new(size);
+    }
+
+    size_t in_use = in_use_.fetch_add(1, std::memory_order_relaxed) + 1;
+    size_t high_water = high_water_.load(std::memory_order_relaxed);
+    while (in_use > high_water && !high_water_.compare_exchange_weak(high_water, in_use, std::memory_order_relaxed)) {}
+
+    auto& size_class = classes_[index];
+    {
+        concurrent::SpinLockGuard guard(size_class.lock);
+        FreeFrame* frame = size_class.free_list;
+        if (frame) {
+            size_class.free_list = frame->next;
+            return frame;
+        }
+    }
+
+    //refill with a slab, slabs are kept for the lifetime of the process
+    size_t frame_size = kMinFrameSize << index;
+    uint8_t* slab = static_cast<uint8_t*>(::operator new(frame_size * kFramesPerSlab));
+
+    FreeFrame* head = nullptr;
+    for (size_t i = kFramesPerSlab - 1; i > 0; --i) {
+        FreeFrame* frame = reinterpret_cast<FreeFrame*>(slab + i * frame_size);
+        frame->next = head;
+        head = frame;
+    }
+
+    concurrent::SpinLockGuard guard(size_class.lock);
+    reinterpret_cast<FreeFrame*>(slab + (kFramesPerSlab - 1) * frame_size)->next = size_class.free_list;
+    size_class.free_list = head;
+
+    return slab;
+}
+
+void CoroutineFrameAllocator::Free(void* ptr, size_t size) noexcept {
+    size_t index = GetClass(size);
+    if (index >= kClassCount) {
+        ::operator delete(ptr);
+        return;
+    }
+
+    in_use_.fetch_sub(1, std::memory_order_relaxed);
+
+    auto& size_class = classes_[index];
+    FreeFrame* frame = static_cast<FreeFrame*>(ptr);
+
+    concurrent::SpinLockGuard guard(size_class.lock);
+    frame->next = size_class.free_list;
+    size_class.free_list = frame;
+}
+
+void JobTask::FinalAwaiter::await_suspend(Handle coroutine) noexcept {
+    //the frame goes first, whoever waits on the handle may tear down what it references
+    JobHandle completion = coroutine.promise().completion;
+    std::exception_ptr exception = std::move(coroutine.promise().exception);
+    coroutine.destroy();
+
+    JobSystem::Instance()->CompleteManualHandle(completion);
+
+    //final_suspend can't throw, a waiter left hanging would be worse than a lost exception
+    if (exception) {
+        try {
+            std::rethrow_exception(exception);
+        } catch (const std::exception& e) {
+            LOG_ERR("JobTask :: unhandled exception: {}", e.what());
+        } catch (...) {
+            LOG_ERR("JobTask :: unhandled exception");
+        }
+    }
+}
+
+bool JobTask::HandleAwaiter::await_ready() const {
+    if (!handles) {
+        return single.IsComplete();
+    }
+
+    for (uint32_t i = 0; i < count; ++i) {
+        if (!handles[i].IsComplete()) return false;
+    }
+
+    return true;
+}
+
+void JobTask::HandleAwaiter::await_suspend(std::coroutine_handle<> coroutine) {
+    //the awaiter lives in the frame, which may be resumed and gone as soon as the job is queued
+    const JobHandle* wait_handles = handles ? handles : &single;
+    JobSystem::Instance()->Schedule([coroutine]() { coroutine.resume(); }, wait_handles, count, priority);
+}
+
+JobTask::HandleAwaiter JobTask::promise_type::await_transform(JobTask&& task) const {
+    JobHandle handle = task.Schedule(priority);
+    return { nullptr, 1, handle, priority };
+}
+
+bool JobBatchAwaiter::await_ready() const {
+    for (uint32_t i = 0; i < count; ++i) {
+        if (!handles[i].IsComplete()) return false;
+    }
+
+    return true;
+}
+
+JobHandle JobTask::Schedule(JobPriority pri) {
+    assert(coroutine_);
+
+    Handle coroutine = std::exchange(coroutine_, nullptr);
+    auto& promise = coroutine.promise();
+    promise.priority = pri;
+    promise.completion = JobSystem::Instance()->CreateManualHandle(pri);
+
+    JobHandle completion = promise.completion;
+    JobSystem::Instance()->Schedule([coroutine]() { coroutine.resume(); }, pri);
+
+    return completion;
+}
+
+void JobTask::Release() noexcept {
+    if (coroutine_) {
+        coroutine_.destroy();
+        coroutine_ = nullptr;
+    }
+}
+
+}
+}
@@ -0,0 +1,183 @@
+#pragma once
+
+#include <coroutine>
+#include <exception>
+#include <utility>
+#include <type_traits>
+#include "JobSystem.h"
+#include "Concurrent/SpinLock.h"
+
+namespace glacier {
+namespace jobs {
+
+//Coroutine frames come from per size class free lists refilled in slabs,
+//frames above the largest class go to the global heap
+class CoroutineFrameAllocator {
+public:
+    static constexpr size_t kMinFrameSize = 256;
+    static constexpr size_t kClassCount = 5; //256 .. 4096 bytes
+    static constexpr size_t kFramesPerSlab = 32;
+
+    static void* Allocate(size_t size);
+    static void Free(void* ptr, size_t size) noexcept;
+
+    static size_t GetInUse() { return in_use_.load(std::memory_order_relaxed); }
+    static size_t GetHighWater() { return high_water_.load(std::memory_order_relaxed); }
+
+private:
+    struct FreeFrame {
+        FreeFrame* next;
+    };
+
+    struct alignas(CACHE_LINE_SIZE) SizeClass {
+        concurrent::SpinLock lock;
+        FreeFrame* free_list = nullptr;
+    };
+
+    static size_t GetClass(size_t size);
+
+    static SizeClass classes_[kClassCount];
+    static std::atomic<size_t> in_use_;
+    static std::atomic<size_t> high_water_;
+};
+
+//Coroutine that runs as jobs on the JobSystem.
+//It starts suspended, Schedule queues its first step as a job and returns a handle
+//completing with the coroutine. Inside it:
+//  co_await handle;                          //any JobHandle, ParallelFor/batch handles included
+//  co_await AwaitAll(handles, count);        //several handles
+//  co_await AwaitFence(queue, fence_value);  //GPU fence of a render::CommandQueue
+//  co_await std::move(other_task);           //schedule another task and wait for it
+//every co_await resumes the coroutine as a new job, possibly on another worker, no fiber is blocked.
+//Blocking fiber calls (YieldJob, WaitComplete) stay usable from the coroutine body.
+//An exception escaping the body is logged, the frame is freed and the handle completes as usual.
+class JobTask {
+public:
+    struct promise_type;
+    using Handle = std::coroutine_handle<promise_type>;
+
+    struct FinalAwaiter {
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(Handle coroutine) noexcept;
+        void await_resume() const noexcept {}
+    };
+
+    struct HandleAwaiter {
+        const JobHandle* handles;
+        uint32_t count;
+        JobHandle single;
+        JobPriority priority;
+
+        bool await_ready() const;
+        void await_suspend(std::coroutine_handle<> coroutine);
+        void await_resume() const noexcept {}
+    };
+
+    struct promise_type {
+        JobHandle completion;
+        JobPriority priority = JobPriority::kNormal;
+        std::exception_ptr exception;
+
+        static void* operator new(size_t size) { return CoroutineFrameAllocator::Allocate(size); }
+        static void operator delete(void* ptr, size_t size) { CoroutineFrameAllocator::Free(ptr, size); }
+
+        JobTask get_return_object() noexcept { return JobTask(Handle::from_promise(*this)); }
+        std::suspend_always initial_suspend() const noexcept { return {}; }
+        FinalAwaiter final_suspend() const noexcept { return {}; }
+        void return_void() const noexcept {}
+        void unhandled_exception() noexcept { exception = std::current_exception(); }
+
+        HandleAwaiter await_transform(const JobHandle& handle) const {
+            return { nullptr, 1, handle, priority };
+        }
+
+        HandleAwaiter await_transform(JobTask&& task) const;
+
+        template<typename Awaitable> requires (!std::is_same_v<std::decay_t<Awaitable>, JobHandle> &&
+            !std::is_same_v<std::decay_t<Awaitable>, JobTask>)
+        Awaitable&& await_transform(Awaitable&& awaitable) const noexcept {
+            return std::forward<Awaitable>(awaitable);
+        }
+    };
+
+    JobTask() noexcept {}
+    JobTask(JobTask&& other) noexcept : coroutine_(std::exchange(other.coroutine_, nullptr)) {}
+    JobTask(const JobTask&) = delete;
+    JobTask& operator=(const JobTask&) = delete;
+
+    JobTask& operator=(JobTask&& other) noexcept {
+        if (this != &other) {
+            Release();
+            coroutine_ = std::exchange(other.coroutine_, nullptr);
+        }
+
+        return *this;
+    }
+
+    ~JobTask() {
+        Release();
+    }
+
+    bool IsValid() const { return (bool)coroutine_; }
+
+    //Queue the coroutine, the task gives up its frame which is freed once the coroutine returns
+    JobHandle Schedule(JobPriority pri = JobPriority::kNormal);
+
+private:
+    explicit JobTask(Handle coroutine) noexcept : coroutine_(coroutine) {}
+
+    //a task never scheduled still owns its frame
+    void Release() noexcept;
+
+    Handle coroutine_;
+};
+
+struct JobBatchAwaiter {
+    const JobHandle* handles;
+    uint32_t count;
+
+    bool await_ready() const;
+
+    template<typename Promise>
+    void await_suspend(std::coroutine_handle<Promise> coroutine) {
+        JobTask::HandleAwaiter awaiter = { handles, count, {}, coroutine.promise().priority };
+        awaiter.await_suspend(coroutine);
+    }
+
+    void await_resume() const noexcept {}
+};
+
+//handles must stay alive until the coroutine resumes
+inline JobBatchAwaiter AwaitAll(const JobHandle* handles, uint32_t count) {
+    return { handles, count };
+}
+
+//The queue's fence thread sleeps until the GPU reaches the value and only then
+//schedules the resume, so no worker polls and no fiber blocks on the GPU
+template<typename Queue>
+struct JobFenceAwaiter {
+    Queue* queue;
+    uint64_t fence_value;
+
+    bool await_ready() const {
+        return queue->IsFenceComplete(fence_value);
+    }
+
+    template<typename Promise>
+    void await_suspend(std::coroutine_handle<Promise> coroutine) {
+        JobPriority priority = coroutine.promise().priority;
+        queue->OnFenceComplete(fence_value, [coroutine, priority]() {
+            JobSystem::Instance()->Schedule([coroutine]() { coroutine.resume(); }, priority);
+        });
+    }
+
+    void await_resume() const noexcept {}
+};
+
+template<typename Queue>
+JobFenceAwaiter<Queue> AwaitFence(Queue* queue, uint64_t fence_value) {
+    return { queue, fence_value };
+}
+
+}
+}
@@ -0,0 +1,328 @@
+#include "JobTrace.h"
+#include <stdio.h>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace glacier {
+namespace jobs {
+
+namespace {
+
+struct TraceBuffer {
+    uint32_t tid;
+    char name[32];
+
+    //owner only, reset by the owner when it first records in a new capture
+    std::atomic<uint32_t> session = 0;
+    uint32_t capacity = 0;
+    std::unique_ptr<JobTraceRecord[]> records;
+
+    std::atomic<uint32_t> count = 0; //published records
+    std::atomic<uint64_t> dropped = 0;
+};
+
+std::mutex registry_lock;
+std::vector<std::unique_ptr<TraceBuffer>> registry;
+
+std::atomic<uint32_t> trace_session = 0;
+std::atomic<uint32_t> trace_capacity = JobTrace::kDefaultCapacity;
+std::atomic<int64_t> trace_start_time = 0;
+std::atomic<int64_t> trace_stop_time = 0;
+
+thread_local TraceBuffer* tls_trace_buffer = nullptr;
+thread_local const char* tls_scope_name = nullptr;
+
+int64_t GetTraceTime() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+//fibers move between threads, the thread local must be looked up again after every switch
+FIBER_NOINLINE TraceBuffer* GetThreadBuffer() {
+    TraceBuffer* buffer = tls_trace_buffer;
+    if (!buffer) {
+        std::lock_guard<std::mutex> guard(registry_lock);
+        buffer = new TraceBuffer();
+        buffer->tid = (uint32_t)registry.size();
+        snprintf(buffer->name, sizeof(buffer->name), "thread %u", buffer->tid);
+        registry.emplace_back(buffer);
+
+        tls_trace_buffer = buffer;
+    }
+
+    return buffer;
+}
+
+FIBER_NOINLINE const char*& GetScopeNameRef() {
+    return tls_scope_name;
+}
+
+void Append(const JobTraceRecord& record) {
+    TraceBuffer* buffer = GetThreadBuffer();
+
+    uint32_t session = trace_session.load(std::memory_order_acquire);
+    if (buffer->session.load(std::memory_order_relaxed) != session) {
+        uint32_t capacity = trace_capacity.load(std::memory_order_relaxed);
+        if (buffer->capacity != capacity) {
+            buffer->records = std::make_unique<JobTraceRecord[]>(capacity);
+            buffer->capacity = capacity;
+        }
+
+        buffer->count.store(0, std::memory_order_relaxed);
+        buffer->dropped.store(0, std::memory_order_relaxed);
+        buffer->session.store(session, std::memory_order_release);
+    }
+
+    uint32_t count = buffer->count.load(std::memory_order_relaxed);
+    if (count >= buffer->capacity) {
+        buffer->dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    buffer->records[count] = record;
+    buffer->count.store(count + 1, std::memory_order_release);
+}
+
+const char* GetKindName(JobKind kind) {
+    switch (kind) {
+    case JobKind::kTask: return "task";
+    case JobKind::kParallel: return "parallel";
+    case JobKind::kBatch: return "batch";
+    case JobKind::kRange: return "range";
+    case JobKind::kChunk: return "chunk";
+    default: return "job";
+    }
+}
+
+const char* GetPriorityName(JobPriority pri) {
+    switch (pri) {
+    case JobPriority::kCritical: return "critical";
+    case JobPriority::kHigh: return "high";
+    case JobPriority::kNormal: return "normal";
+    default: return "low";
+    }
+}
+
+void AppendEscaped(std::string& json, const char* str) {
+    for (; *str; ++str) {
+        char c = *str;
+        if (c == '"' || c == '\\') {
+            json += '\\';
+            json += c;
+        }
+        else if ((unsigned char)c >= 0x20) {
+            json += c;
+        }
+    }
+}
+
+void AppendEvent(std::string& json, const char* ph, const char* name, const char* cat,
+    double ts, uint32_t tid, const char* extra)
+{
+    char buf[256];
+    snprintf(buf, sizeof(buf), "{\"ph\":\"%s\",\"cat\":\"%s\",\"ts\":%.3f,\"pid\":1,\"tid\":%u,\"name\":\"",
+        ph, cat, ts, tid);
+
+    json += buf;
+    AppendEscaped(json, name);
+    json += '"';
+    json += extra;
+    json += "},\n";
+}
+
+}
+
+std::atomic_bool JobTrace::enabled_ = false;
+
+void JobTrace::Start(uint32_t capacity_per_thread) {
+    trace_capacity.store(capacity_per_thread > 0 ? capacity_per_thread : 1, std::memory_order_relaxed);
+    trace_start_time.store(GetTraceTime(), std::memory_order_relaxed);
+    trace_stop_time.store(0, std::memory_order_relaxed);
+    trace_session.fetch_add(1, std::memory_order_release);
+
+    enabled_.store(true, std::memory_order_release);
+}
+
+void JobTrace::Stop() {
+    enabled_.store(false, std::memory_order_release);
+    trace_stop_time.store(GetTraceTime(), std::memory_order_relaxed);
+}
+
+void JobTrace::SetThreadName(const char* name) {
+    TraceBuffer* buffer = GetThreadBuffer();
+
+    std::lock_guard<std::mutex> guard(registry_lock);
+    snprintf(buffer->name, sizeof(buffer->name), "%s", name);
+}
+
+void JobTrace::Record(JobTraceEvent type, const Job* job, uint32_t index, uint32_t arg) {
+    if (!IsEnabled()) {
+        return;
+    }
+
+    JobTraceRecord record;
+    record.time = GetTraceTime();
+    record.name = job->name;
+    record.job = index;
+    record.version = job->version.load(std::memory_order_relaxed);
+    record.arg = arg;
+    record.type = type;
+    record.priority = job->priority;
+    record.kind = job->kind;
+
+    Append(record);
+}
+
+void JobTrace::Record(JobTraceEvent type, uint32_t arg) {
+    if (!IsEnabled()) {
+        return;
+    }
+
+    JobTraceRecord record = {};
+    record.time = GetTraceTime();
+    record.job = JobHandle::kInvalidIndex;
+    record.arg = arg;
+    record.type = type;
+
+    Append(record);
+}
+
+const char* JobTrace::GetScopeName() {
+    return GetScopeNameRef();
+}
+
+void JobTrace::SetScopeName(const char* name) {
+    GetScopeNameRef() = name;
+}
+
+bool JobTrace::ExportChromeTrace(const char* path) {
+    std::string json;
+    ExportChromeTrace(json);
+
+    FILE* file = fopen(path, "wb");
+    if (!file) {
+        return false;
+    }
+
+    bool result = fwrite(json.data(), 1, json.size(), file) == json.size();
+    fclose(file);
+
+    return result;
+}
+
+//Slices have to nest per thread: a job suspended on one thread and resumed on another
+//shows up as several slices, events cut by the capture boundaries are dropped or closed
+void JobTrace::ExportChromeTrace(std::string& json) {
+    std::lock_guard<std::mutex> guard(registry_lock);
+
+    uint32_t session = trace_session.load(std::memory_order_acquire);
+    int64_t start_time = trace_start_time.load(std::memory_order_relaxed);
+    int64_t stop_time = trace_stop_time.load(std::memory_order_relaxed);
+
+    json = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+
+    char extra[256];
+    for (auto& buffer : registry) {
+        snprintf(extra, sizeof(extra), "{\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"name\":\"thread_name\",\"args\":{\"name\":\"",
+            buffer->tid);
+        json += extra;
+        AppendEscaped(json, buffer->name);
+        json += "\"}},\n";
+
+        if (buffer->session.load(std::memory_order_acquire) != session) {
+            continue;
+        }
+
+        uint32_t count = buffer->count.load(std::memory_order_acquire);
+        uint32_t depth = 0;
+        double ts = 0.0;
+
+        for (uint32_t i = 0; i < count; ++i) {
+            const auto& record = buffer->records[i];
+            const char* name = record.name ? record.name : GetKindName(record.kind);
+            uint64_t id = ((uint64_t)record.version << 32) | record.job;
+            ts = (record.time - start_time) / 1e3;
+
+            switch (record.type) {
+            case JobTraceEvent::kJobBegin:
+                //ends the edge started when the job was queued, binds to the slice below
+                snprintf(extra, sizeof(extra), ",\"id\":%llu", (unsigned long long)id);
+                AppendEvent(json, "f", "queue", "job", ts, buffer->tid, extra);
+
+                if (record.arg != JobHandle::kInvalidIndex) {
+                    snprintf(extra, sizeof(extra), ",\"args\":{\"job\":%u,\"priority\":\"%s\",\"kind\":\"%s\",\"parent\":%u}",
+                        record.job, GetPriorityName(record.priority), GetKindName(record.kind), record.arg);
+                }
+                else {
+                    snprintf(extra, sizeof(extra), ",\"args\":{\"job\":%u,\"priority\":\"%s\",\"kind\":\"%s\"}",
+                        record.job, GetPriorityName(record.priority), GetKindName(record.kind));
+                }
+
+                AppendEvent(json, "B", name, "job", ts, buffer->tid, extra);
+                ++depth;
+                break;
+            case JobTraceEvent::kJobResume:
+                snprintf(extra, sizeof(extra), ",\"args\":{\"job\":%u,\"priority\":\"%s\",\"resumed\":true}",
+                    record.job, GetPriorityName(record.priority));
+                AppendEvent(json, "B", name, "job", ts, buffer->tid, extra);
+                ++depth;
+                break;
+            case JobTraceEvent::kJobEnd:
+            case JobTraceEvent::kJobSuspend:
+            case JobTraceEvent::kIdleEnd:
+                if (depth > 0) {
+                    AppendEvent(json, "E", "", "", ts, buffer->tid, "");
+                    --depth;
+                }
+                break;
+            case JobTraceEvent::kJobQueue:
+                snprintf(extra, sizeof(extra), ",\"id\":%llu", (unsigned long long)id);
+                AppendEvent(json, "s", "queue", "job", ts, buffer->tid, extra);
+                break;
+            case JobTraceEvent::kSteal:
+                snprintf(extra, sizeof(extra), ",\"s\":\"t\",\"args\":{\"job\":%u,\"victim\":%u}",
+                    record.job, record.arg);
+                AppendEvent(json, "i", "steal", "scheduler", ts, buffer->tid, extra);
+                break;
+            case JobTraceEvent::kIdleBegin:
+                AppendEvent(json, "B", "idle", "idle", ts, buffer->tid, "");
+                ++depth;
+                break;
+            }
+        }
+
+        if (stop_time > 0) {
+            ts = (stop_time - start_time) / 1e3;
+        }
+
+        for (; depth > 0; --depth) {
+            AppendEvent(json, "E", "", "", ts, buffer->tid, "");
+        }
+    }
+
+    //drop the separator of the last event
+    if (json.size() >= 2 && json[json.size() - 2] == ',') {
+        json.erase(json.size() - 2, 1);
+    }
+
+    json += "]}\n";
+}
+
+uint64_t JobTrace::GetDroppedCount() {
+    std::lock_guard<std::mutex> guard(registry_lock);
+
+    uint32_t session = trace_session.load(std::memory_order_acquire);
+    uint64_t dropped = 0;
+    for (auto& buffer : registry) {
+        if (buffer->session.load(std::memory_order_acquire) == session) {
+            dropped += buffer->dropped.load(std::memory_order_relaxed);
+        }
+    }
+
+    return dropped;
+}
+
+}
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <string>
+#include "Job.h"
+
+namespace glacier {
+namespace jobs {
+
+enum class JobTraceEvent : uint8_t {
+    kJobBegin,
+    kJobEnd,
+    kJobSuspend,    //the fiber running the job switched away, arg is the FiberTransfer action
+    kJobResume,
+    kJobQueue,      //the job became runnable, start of the edge to its begin
+    kSteal,         //arg is the victim worker
+    kIdleBegin,     //worker parked
+    kIdleEnd,
+};
+
+struct JobTraceRecord {
+    int64_t time; //ns
+    const char* name;
+    uint32_t job; //index
+    uint32_t version;
+    uint32_t arg; //parent index for kJobBegin
+    JobTraceEvent type;
+    JobPriority priority;
+    JobKind kind;
+};
+
+//Job system timeline: events are appended to per thread buffers without locks while a capture runs,
+//and exported as Chrome trace json (chrome://tracing or ui.perfetto.dev).
+//Recording costs a relaxed load and a branch when no capture runs.
+class JobTrace {
+public:
+    static constexpr uint32_t kDefaultCapacity = 64 * 1024; //events per thread
+
+    static bool IsEnabled() { return enabled_.load(std::memory_order_relaxed); }
+
+    //Begin a new capture, events of the previous one are dropped.
+    //A thread whose buffer is full drops its events until the next capture.
+    static void Start(uint32_t capacity_per_thread = kDefaultCapacity);
+    static void Stop();
+
+    static void SetThreadName(const char* name);
+
+    static void Record(JobTraceEvent type, const Job* job, uint32_t index, uint32_t arg = 0);
+    static void Record(JobTraceEvent type, uint32_t arg = 0);
+
+    //name for jobs scheduled by the calling thread, see JobTraceScope
+    static const char* GetScopeName();
+    static void SetScopeName(const char* name);
+
+    //Export the last capture, not while a new one starts
+    static bool ExportChromeTrace(const char* path);
+    static void ExportChromeTrace(std::string& json);
+
+    static uint64_t GetDroppedCount();
+
+private:
+    static std::atomic_bool enabled_;
+};
+
+//Jobs scheduled inside the scope are named name in the trace, other jobs take the name
+//of the job scheduling them. The scope must not span a wait, the fiber may resume on another thread.
+//name is assumed to be a static string
+class JobTraceScope : private Uncopyable {
+public:
+    JobTraceScope(const char* name) : prev_(JobTrace::GetScopeName()) {
+        JobTrace::SetScopeName(name);
+    }
+
+    ~JobTraceScope() {
+        JobTrace::SetScopeName(prev_);
+    }
+
+private:
+    const char* prev_;
+};
+
+}
+}
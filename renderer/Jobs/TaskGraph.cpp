@@ -0,0 +1,233 @@
+#include "TaskGraph.h"
+#include <assert.h>
+#include <algorithm>
+#include "JobSystem.h"
+#include "Common/Log.h"
+
+namespace glacier {
+namespace jobs {
+
+TaskGraph::NodeId TaskGraph::AddNode(const char* name, JobDelegate&& task, JobPriority pri) {
+    assert(!compiled_);
+
+    Node node;
+    node.name = name;
+    node.task = std::move(task);
+    node.priority = pri;
+
+    nodes_.emplace_back(std::move(node));
+    return (NodeId)nodes_.size() - 1;
+}
+
+void TaskGraph::AddEdge(NodeId before, NodeId after) {
+    assert(!compiled_);
+    assert(before < nodes_.size() && after < nodes_.size() && before != after);
+
+    edges_.emplace_back(before, after);
+}
+
+bool TaskGraph::Compile() {
+    assert(!compiled_);
+
+    uint32_t node_count = (uint32_t)nodes_.size();
+
+    std::sort(edges_.begin(), edges_.end(), [](auto& a, auto& b) {
+        return a.second < b.second || (a.second == b.second && a.first < b.first);
+    });
+    edges_.erase(std::unique(edges_.begin(), edges_.end()), edges_.end());
+
+    //edges are sorted by target, so the predecessors of a node are contiguous
+    pred_ids_.resize(edges_.size());
+    std::vector<uint32_t> out_degree(node_count, 0);
+    for (uint32_t i = 0; i < edges_.size(); ++i) {
+        auto& edge = edges_[i];
+        auto& node = nodes_[edge.second];
+        if (node.pred_count == 0) {
+            node.pred_offset = i;
+        }
+
+        ++node.pred_count;
+        ++out_degree[edge.first];
+        pred_ids_[i] = edge.first;
+    }
+
+    //Kahn's algorithm
+    std::vector<std::vector<NodeId>> successors(node_count);
+    std::vector<uint32_t> in_degree(node_count);
+    for (auto& edge : edges_) {
+        successors[edge.first].push_back(edge.second);
+    }
+
+    order_.clear();
+    order_.reserve(node_count);
+    for (NodeId i = 0; i < node_count; ++i) {
+        in_degree[i] = nodes_[i].pred_count;
+        if (in_degree[i] == 0) {
+            order_.push_back(i);
+        }
+    }
+
+    for (uint32_t i = 0; i < order_.size(); ++i) {
+        for (auto succ : successors[order_[i]]) {
+            if (--in_degree[succ] == 0) {
+                order_.push_back(succ);
+            }
+        }
+    }
+
+    if (order_.size() != node_count) {
+        order_.clear();
+        pred_ids_.clear();
+        for (auto& node : nodes_) {
+            node.pred_offset = 0;
+            node.pred_count = 0;
+        }
+
+        return false;
+    }
+
+    for (NodeId i = 0; i < node_count; ++i) {
+        if (out_degree[i] == 0) {
+            sink_ids_.push_back(i);
+        }
+    }
+
+    pred_handles_.resize(pred_ids_.size());
+    sink_handles_.resize(sink_ids_.size());
+
+    path_cost_.resize(node_count);
+    path_pred_.resize(node_count);
+
+    compiled_ = true;
+    return true;
+}
+
+JobHandle TaskGraph::Run() {
+    assert(compiled_);
+    assert(handle_.IsComplete()); //a graph only has one run in flight
+
+    auto job_system = JobSystem::Instance();
+    run_begin_ = ClockType::now();
+
+    uint32_t sink_count = 0;
+    for (auto id : order_) {
+        auto& node = nodes_[id];
+        JobHandle* wait_handles = pred_handles_.data() + node.pred_offset;
+        for (uint32_t i = 0; i < node.pred_count; ++i) {
+            wait_handles[i] = nodes_[pred_ids_[node.pred_offset + i]].handle;
+        }
+
+        JobTraceScope trace_scope(node.name);
+        node.handle = job_system->Schedule([this, id]() { Execute(id); },
+            wait_handles, node.pred_count, node.priority);
+    }
+
+    for (uint32_t i = 0; i < sink_ids_.size(); ++i) {
+        sink_handles_[i] = nodes_[sink_ids_[i]].handle;
+    }
+
+    handle_ = job_system->Schedule(JobDelegate{}, sink_handles_.data(), (uint32_t)sink_handles_.size());
+
+    return handle_;
+}
+
+void TaskGraph::Wait() {
+    handle_.WaitComplete();
+}
+
+void TaskGraph::Execute(NodeId id) {
+    auto& node = nodes_[id];
+
+    node.begin = ClockType::now();
+    node.task();
+    node.end = ClockType::now();
+}
+
+void TaskGraph::ComputeCriticalPath() const {
+    for (auto id : order_) {
+        auto& node = nodes_[id];
+        double duration = std::chrono::duration<double, std::milli>(node.end - node.begin).count();
+
+        double max_cost = 0.0;
+        NodeId max_pred = kInvalidNode;
+        for (uint32_t i = 0; i < node.pred_count; ++i) {
+            NodeId pred = pred_ids_[node.pred_offset + i];
+            if (max_pred == kInvalidNode || path_cost_[pred] > max_cost) {
+                max_cost = path_cost_[pred];
+                max_pred = pred;
+            }
+        }
+
+        path_cost_[id] = max_cost + duration;
+        path_pred_[id] = max_pred;
+    }
+}
+
+double TaskGraph::GetCriticalPath(std::vector<NodeId>& path) const {
+    assert(compiled_ && handle_.IsComplete());
+
+    path.clear();
+    if (sink_ids_.empty()) return 0.0;
+
+    ComputeCriticalPath();
+
+    NodeId last = sink_ids_[0];
+    for (auto id : sink_ids_) {
+        if (path_cost_[id] > path_cost_[last]) {
+            last = id;
+        }
+    }
+
+    double cost = path_cost_[last];
+    for (NodeId id = last; id != kInvalidNode; id = path_pred_[id]) {
+        path.push_back(id);
+    }
+
+    std::reverse(path.begin(), path.end());
+
+    return cost;
+}
+
+void TaskGraph::GetTimings(std::vector<NodeTiming>& timings) const {
+    std::vector<NodeId> path;
+    GetCriticalPath(path);
+
+    timings.clear();
+    timings.reserve(nodes_.size());
+    for (auto& node : nodes_) {
+        NodeTiming timing;
+        timing.name = node.name;
+        timing.begin = std::chrono::duration<double, std::milli>(node.begin - run_begin_).count();
+        timing.duration = std::chrono::duration<double, std::milli>(node.end - node.begin).count();
+        timing.critical = false;
+        timings.push_back(timing);
+    }
+
+    for (auto id : path) {
+        timings[id].critical = true;
+    }
+}
+
+void TaskGraph::PrintTimings() const {
+    std::vector<NodeTiming> timings;
+    GetTimings(timings);
+
+    std::vector<NodeId> path;
+    double critical_time = GetCriticalPath(path);
+
+    double total_time = 0.0;
+    for (auto& timing : timings) {
+        total_time = std::max(total_time, timing.begin + timing.duration);
+    }
+
+    LOG_LOG("TaskGraph :: {:.3f} ms  critical path {:.3f} ms", total_time, critical_time);
+
+    for (auto id : order_) {
+        auto& timing = timings[id];
+        LOG_LOG("  {}{} :: {:.3f} ms  start {:.3f} ms", timing.critical ? "*" : " ",
+            timing.name, timing.duration, timing.begin);
+    }
+}
+
+}
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <vector>
+#include <chrono>
+#include <utility>
+#include "Job.h"
+#include "Common/Uncopyable.h"
+
+namespace glacier {
+namespace jobs {
+
+//A fixed DAG of jobs declared once and run every frame.
+//Nodes/edges are only added before Compile, which validates the graph and lays out
+//dependencies in flat arrays so that Run doesn't allocate.
+class TaskGraph : private Uncopyable {
+public:
+    using NodeId = uint32_t;
+    using ClockType = std::conditional<std::chrono::high_resolution_clock::is_steady,
+        std::chrono::high_resolution_clock, std::chrono::steady_clock >::type;
+
+    static constexpr NodeId kInvalidNode = std::numeric_limits<uint32_t>::max();
+
+    struct NodeTiming {
+        const char* name;
+        double begin; //ms since Run
+        double duration; //ms
+        bool critical; //on the critical path of the last run
+    };
+
+    //name is assumed to be a static string
+    NodeId AddNode(const char* name, JobDelegate&& task, JobPriority pri = JobPriority::kNormal);
+    //before must complete before after starts
+    void AddEdge(NodeId before, NodeId after);
+
+    //Returns false if the graph has a cycle
+    bool Compile();
+    bool IsCompiled() const { return compiled_; }
+
+    //Schedule all nodes, the returned handle completes with the last node
+    JobHandle Run();
+    void Wait();
+    bool IsComplete() const { return handle_.IsComplete(); }
+
+    //Valid once the last run completed
+    double GetCriticalPath(std::vector<NodeId>& path) const;
+    void GetTimings(std::vector<NodeTiming>& timings) const;
+    void PrintTimings() const;
+
+    uint32_t GetNodeCount() const { return (uint32_t)nodes_.size(); }
+    const char* GetNodeName(NodeId id) const { return nodes_[id].name; }
+
+private:
+    struct Node {
+        const char* name;
+        JobDelegate task;
+        JobPriority priority;
+
+        //predecessors in pred_ids_/pred_handles_
+        uint32_t pred_offset = 0;
+        uint32_t pred_count = 0;
+
+        JobHandle handle;
+        ClockType::time_point begin;
+        ClockType::time_point end;
+    };
+
+    void Execute(NodeId id);
+    //longest chain ending at every node, by the durations of the last run
+    void ComputeCriticalPath() const;
+
+    std::vector<Node> nodes_;
+    std::vector<std::pair<NodeId, NodeId>> edges_;
+
+    std::vector<NodeId> order_; //topological order
+    std::vector<NodeId> pred_ids_;
+    std::vector<JobHandle> pred_handles_;
+    std::vector<NodeId> sink_ids_; //nodes nobody depends on
+    std::vector<JobHandle> sink_handles_;
+
+    mutable std::vector<double> path_cost_;
+    mutable std::vector<NodeId> path_pred_;
+
+    JobHandle handle_;
+    ClockType::time_point run_begin_;
+    bool compiled_ = false;
+};
+
+}
+}
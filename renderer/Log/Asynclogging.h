@@ -3,7 +3,7 @@
 #include <string>
 #include <thread>
 #include "Common/Singleton.h"
-#include "concurrent/ringbuffer.h"
+#include "Concurrent/MPMCRingBuffer.h"
 #include "logging.h"
 
 namespace glacier {
@@ -30,7 +30,7 @@ protected:
     bool flush_;
     bool running_;
 
-    concurrent::RingBuffer<LogLine, 2048> queue_;
+    concurrent::MPMCRingBuffer<LogLine, 2048> queue_;
     std::thread thread_;
 };
 
@@ -0,0 +1,96 @@
+#pragma once
+
+#if defined(_M_X64) || defined(__x86_64__) || defined(_M_IX86) || defined(__SSE2__)
+#define GLACIER_SIMD_SSE 1
+#include <emmintrin.h>
+#elif defined(_M_ARM64) || defined(__aarch64__) || defined(__ARM_NEON)
+#define GLACIER_SIMD_NEON 1
+#include <arm_neon.h>
+#endif
+
+namespace glacier {
+namespace math {
+
+//4 float lanes, SSE2 on x64, NEON on arm, plain floats anywhere else.
+//Loads and stores need 16 bytes alignment.
+struct Float4 {
+    static constexpr int kWidth = 4;
+
+#if defined(GLACIER_SIMD_SSE)
+    __m128 v;
+
+    Float4() = default;
+    Float4(__m128 v_) : v(v_) {}
+    explicit Float4(float s) : v(_mm_set1_ps(s)) {}
+
+    static Float4 Load(const float* p) { return _mm_load_ps(p); }
+    void Store(float* p) const { _mm_store_ps(p, v); }
+
+    friend Float4 operator+(Float4 a, Float4 b) { return _mm_add_ps(a.v, b.v); }
+    friend Float4 operator-(Float4 a, Float4 b) { return _mm_sub_ps(a.v, b.v); }
+    friend Float4 operator*(Float4 a, Float4 b) { return _mm_mul_ps(a.v, b.v); }
+    friend Float4 Min(Float4 a, Float4 b) { return _mm_min_ps(a.v, b.v); }
+    friend Float4 Max(Float4 a, Float4 b) { return _mm_max_ps(a.v, b.v); }
+#elif defined(GLACIER_SIMD_NEON)
+    float32x4_t v;
+
+    Float4() = default;
+    Float4(float32x4_t v_) : v(v_) {}
+    explicit Float4(float s) : v(vdupq_n_f32(s)) {}
+
+    static Float4 Load(const float* p) { return vld1q_f32(p); }
+    void Store(float* p) const { vst1q_f32(p, v); }
+
+    friend Float4 operator+(Float4 a, Float4 b) { return vaddq_f32(a.v, b.v); }
+    friend Float4 operator-(Float4 a, Float4 b) { return vsubq_f32(a.v, b.v); }
+    friend Float4 operator*(Float4 a, Float4 b) { return vmulq_f32(a.v, b.v); }
+    friend Float4 Min(Float4 a, Float4 b) { return vminq_f32(a.v, b.v); }
+    friend Float4 Max(Float4 a, Float4 b) { return vmaxq_f32(a.v, b.v); }
+#else
+    float v[kWidth];
+
+    Float4() = default;
+    explicit Float4(float s) : v{ s, s, s, s } {}
+
+    static Float4 Load(const float* p) {
+        Float4 r;
+        for (int i = 0; i < kWidth; ++i) r.v[i] = p[i];
+        return r;
+    }
+
+    void Store(float* p) const {
+        for (int i = 0; i < kWidth; ++i) p[i] = v[i];
+    }
+
+#define GLACIER_FLOAT4_OP(name, expr) \
+    friend Float4 name(Float4 a, Float4 b) { \
+        Float4 r; \
+        for (int i = 0; i < kWidth; ++i) { float x = a.v[i], y = b.v[i]; r.v[i] = (expr); } \
+        return r; \
+    }
+
+    GLACIER_FLOAT4_OP(operator+, x + y)
+    GLACIER_FLOAT4_OP(operator-, x - y)
+    GLACIER_FLOAT4_OP(operator*, x * y)
+    GLACIER_FLOAT4_OP(Min, x < y ? x : y)
+    GLACIER_FLOAT4_OP(Max, x > y ? x : y)
+#undef GLACIER_FLOAT4_OP
+#endif
+
+    Float4& operator+=(Float4 b) { return *this = *this + b; }
+    Float4& operator-=(Float4 b) { return *this = *this - b; }
+};
+
+//3 vectors of 4 lanes each
+struct Vec3Float4 {
+    Float4 x, y, z;
+
+    Float4 Dot(const Vec3Float4& b) const { return x * b.x + y * b.y + z * b.z; }
+
+    friend Vec3Float4 operator*(const Vec3Float4& a, Float4 s) { return { a.x * s, a.y * s, a.z * s }; }
+    Vec3Float4& operator+=(const Vec3Float4& b) { x += b.x; y += b.y; z += b.z; return *this; }
+    Vec3Float4& operator-=(const Vec3Float4& b) { x -= b.x; y -= b.y; z -= b.z; return *this; }
+};
+
+}
+}
@@ -52,6 +52,11 @@ float BoxCollider::Distance(const Vec3f& point) {
     return ClosestPoint(point).Distance(point);
 }
 
+void BoxCollider::UpdateShapeCache() {
+    Collider::UpdateShapeCache();
+    Axis();
+}
+
 AABB BoxCollider::CalcAABB() {
     const Matrix3x3& axis = Axis();
     Vec3f ext = axis.r0.Abs() * extents_.x + axis.r1.Abs() * extents_.y + axis.r2.Abs() * extents_.z;
@@ -16,6 +16,7 @@ public:
     Vec3f ClosestPoint(const Vec3f& point) override;
     Vec3f FarthestPoint(const Vec3f& wdir) override;
     Matrix3x3 CalcInertiaTensor(float mass) override;
+    void UpdateShapeCache() override;
     void OnDrawSelectedGizmos() override;
 
 protected:
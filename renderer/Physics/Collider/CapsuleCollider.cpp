@@ -138,6 +138,11 @@ bool CapsuleCollider::Intersects(CapsuleCollider& other) {
     return intersects;
 }
 
+void CapsuleCollider::UpdateShapeCache() {
+    Collider::UpdateShapeCache();
+    Segment();
+}
+
 AABB CapsuleCollider::CalcAABB() {
     const LineSegment& ls = Segment();
     Vec3f d(radius_);
@@ -22,6 +22,7 @@ public:
     bool Intersects(CapsuleCollider& other);
 
     Matrix3x3 CalcInertiaTensor(float mass) override;
+    void UpdateShapeCache() override;
     void OnDrawSelectedGizmos() override;
 
 protected:
@@ -73,6 +73,10 @@ public:
     virtual Vec3f FarthestPoint(const Vec3f& wdir) = 0;
     virtual Matrix3x3 CalcInertiaTensor(float mass) = 0;
 
+    //Refresh the shape data cached from the transform, the queries above don't write
+    //anything afterwards until the transform changes: the narrowphase runs them in parallel
+    virtual void UpdateShapeCache() { bounds(); }
+
     bool is_sensor() const { return is_sensor_; }
     bool is_static() const { return !rigidbody_; }
 
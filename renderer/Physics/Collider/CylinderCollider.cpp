@@ -169,6 +169,11 @@ bool CylinderCollider::Intersects(const Ray& ray, float max, float& t) {
     return false;
 }
 
+void CylinderCollider::UpdateShapeCache() {
+    Collider::UpdateShapeCache();
+    Segment();
+}
+
 AABB CylinderCollider::CalcAABB() {
     const LineSegment& ls = Segment();
     Vec3f a = ls.b - ls.a;
@@ -20,6 +20,7 @@ public:
     Vec3f FarthestPoint(const Vec3f& wdir) override;
     bool Intersects(const Ray& ray, float max, float& t) override;
     Matrix3x3 CalcInertiaTensor(float mass) override;
+    void UpdateShapeCache() override;
 
     void OnDrawSelectedGizmos() override;
 
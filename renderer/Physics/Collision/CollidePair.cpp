@@ -33,6 +33,10 @@ bool CollidePair::Equals(const CollidePair& other) const {
     return first->id() == other.first->id() && second->id() == other.second->id();
 }
 
+uint64_t CollidePair::key() const {
+    return (uint64_t)first->id() | ((uint64_t)second->id() << 32);
+}
+
 }
 }
 
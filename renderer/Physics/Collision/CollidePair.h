@@ -1,5 +1,6 @@
 #pragma once
 
+#include <stdint.h>
 #include "Physics/Collision/CollidePair.h"
 #include "Physics/Collision/ContactPoint.h"
 
@@ -20,6 +21,8 @@ struct CollidePair {
     CollidePair(Collider* first_, Collider* second_);
     CollidePair(Collider* first_, Collider* second_, const ContactPoint& contact_, bool sensor_ = true);
     bool Equals(const CollidePair& other) const;
+    //first id in the low half, the key of the pair's ContactManifold
+    uint64_t key() const;
 };
 
 }
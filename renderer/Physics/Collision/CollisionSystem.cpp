@@ -1,8 +1,11 @@
 #include "CollisionSystem.h"
+#include <algorithm>
 #include "Physics/Collision/Boardphase/BoardphaseDetector.h"
 #include "Physics/Collision/Narrowphase/NarrowphaseDetector.h"
 #include "Physics/Collider/Collider.h"
 #include "Physics/Dynamic/Rigidbody.h"
+#include "Jobs/JobSystem.h"
+#include "Inspect/Profiler.h"
 
 namespace glacier {
 namespace physics {
@@ -41,6 +44,12 @@ void CollisionSystem::RemoveCollider(Collider* collider) {
         }
     }
 
+    //keeps the order, MatchPairCache merges by key
+    last_pair_cache_.erase(std::remove_if(last_pair_cache_.begin(), last_pair_cache_.end(),
+        [collider](const PairCache& cache) {
+            return cache.pair.first == collider || cache.pair.second == collider;
+        }), last_pair_cache_.end());
+
     boardphase_detector_->RemoveCollider(collider);
 }
 
@@ -63,27 +72,135 @@ void CollisionSystem::Detect() {
     board_result_.clear();
     boardphase_detector_->Detect(board_result_);
 
+    //the broadphase order depends on the tree layout, the key order doesn't
+    std::sort(board_result_.begin(), board_result_.end(), [](const CollidePair& a, const CollidePair& b) {
+        return a.key() < b.key();
+    });
+
+    MatchPairCache();
+
+    auto job_system = jobs::JobSystem::Instance();
+    if (parallel_narrowphase_ && job_system->GetThreadCount() > 0 &&
+        board_result_.size() >= kParallelNarrowphasePairs)
+    {
+        DetectParallel();
+    }
+    else {
+        DetectRange(narrowphase_detector_.get(), simplex_, 0, board_result_.size());
+    }
+
     collide_list_.clear();
-    for (size_t i = 0; i < board_result_.size(); ++i) {
-        CollidePair& cp = board_result_[i];
-        Collider* a = cp.first;
-        Collider* b = cp.second;
+    for (auto& cache : pair_cache_) {
+        if (cache.hit) {
+            collide_list_.push_back(cache.pair);
+        }
+    }
 
-        //simplex_.num = 0;
-        bool hit = narrowphase_detector_->Detect(a, b, simplex_);
-        if (hit) {
-            if (a->is_contactable() && b->is_contactable()) {
-                bool contat = narrowphase_detector_->Solve(a, b, simplex_, contact_);
-                if (contat) {
-                    collide_list_.emplace_back(a, b, contact_, false);
-                } else {
-                    //Debug.Log("Can't find contact manifold");
-                }
-            }
-            else {
-                collide_list_.push_back(cp);
+    std::swap(pair_cache_, last_pair_cache_);
+}
+
+void CollisionSystem::MatchPairCache() {
+    pair_cache_.clear();
+    pair_cache_.reserve(board_result_.size());
+
+    //both sorted by key
+    size_t j = 0;
+    for (auto& cp : board_result_) {
+        uint64_t key = cp.key();
+        while (j < last_pair_cache_.size() && last_pair_cache_[j].pair.key() < key) {
+            ++j;
+        }
+
+        bool cached = j < last_pair_cache_.size() && last_pair_cache_[j].pair.key() == key;
+        pair_cache_.emplace_back(cp, cached ? (uint32_t)j : kNoCache);
+    }
+}
+
+void CollisionSystem::DetectParallel() {
+    PerfSample("Parallel Narrowphase");
+
+    //the queries fill the shape caches lazily, so they are filled before going wide
+    for (auto& cp : board_result_) {
+        cp.first->UpdateShapeCache();
+        cp.second->UpdateShapeCache();
+    }
+
+    auto job_system = jobs::JobSystem::Instance();
+    size_t context_count = job_system->GetThreadCount();
+    while (narrowphase_contexts_.size() < context_count) {
+        auto context = std::make_unique<NarrowphaseContext>();
+        context->detector = narrowphase_detector_->Clone();
+        narrowphase_contexts_.push_back(std::move(context));
+    }
+
+    //every pair writes its own cache entry, the merge is the serial walk in Detect
+    //the gjk/epa queries are the deepest calls of the step, batches run on large stacks
+    auto handle = job_system->ParallelFor([this](uint32_t begin, uint32_t end) {
+        //a batch never waits, it stays on the thread it started on
+        uint32_t worker = jobs::JobSystem::GetCurrentWorker();
+        if (worker < narrowphase_contexts_.size()) {
+            auto& context = *narrowphase_contexts_[worker];
+            DetectRange(context.detector.get(), context.simplex, begin, end);
+            return;
+        }
+
+        NarrowphaseContext* context = AcquireOutsideContext();
+        DetectRange(context->detector.get(), context->simplex, begin, end);
+        ReleaseOutsideContext(context);
+    }, (uint32_t)board_result_.size(), kNarrowphaseBatch, jobs::JobPriority::kNormal, jobs::JobStackSize::kLarge);
+
+    job_system->WaitComplete(handle);
+}
+
+CollisionSystem::NarrowphaseContext* CollisionSystem::AcquireOutsideContext() {
+    concurrent::SpinLockGuard guard(outside_lock_);
+    if (!free_outside_contexts_.empty()) {
+        NarrowphaseContext* context = free_outside_contexts_.back();
+        free_outside_contexts_.pop_back();
+        return context;
+    }
+
+    auto context = std::make_unique<NarrowphaseContext>();
+    context->detector = narrowphase_detector_->Clone();
+    outside_contexts_.push_back(std::move(context));
+
+    return outside_contexts_.back().get();
+}
+
+void CollisionSystem::ReleaseOutsideContext(NarrowphaseContext* context) {
+    concurrent::SpinLockGuard guard(outside_lock_);
+    free_outside_contexts_.push_back(context);
+}
+
+void CollisionSystem::DetectRange(NarrowPhaseDetector* detector, Simplex& simplex, size_t begin, size_t end) {
+    for (size_t i = begin; i < end; ++i) {
+        PairCache& cache = pair_cache_[i];
+        Collider* a = cache.pair.first;
+        Collider* b = cache.pair.second;
+        uint32_t version_a = a->transform().version();
+        uint32_t version_b = b->transform().version();
+        bool contactable = a->is_contactable() && b->is_contactable();
+
+        if (cache.last != kNoCache) {
+            const PairCache& last = last_pair_cache_[cache.last];
+            if (last.version_a == version_a && last.version_b == version_b && last.contactable == contactable) {
+                cache = last;
+                cache.last = kNoCache;
+                continue;
             }
         }
+
+        cache.version_a = version_a;
+        cache.version_b = version_b;
+        cache.contactable = contactable;
+
+        //simplex.num = 0;
+        cache.hit = detector->Detect(a, b, simplex);
+        if (cache.hit && contactable) {
+            cache.pair.sensor = false;
+            //false if no contact manifold is found
+            cache.hit = detector->Solve(a, b, simplex, cache.pair.contact);
+        }
     }
 }
 
@@ -135,22 +252,22 @@ void CollisionSystem::Clear() {
 
     collide_list_.clear();
     last_collide_list_.clear();
+    pair_cache_.clear();
+    last_pair_cache_.clear();
 }
 
 void CollisionSystem::Minus(const std::vector<CollidePair>& a, const std::vector<CollidePair>& b, 
     std::vector<CollidePair>& result) const 
 {
+    size_t j = 0;
     for (size_t i = 0; i < a.size(); ++i) {
         const CollidePair& entry = a[i];
-        bool have = false;
-        for (size_t j = 0; j < b.size(); ++j) {
-            if (b[j].Equals(entry)) {
-                have = true;
-                break;
-            }
+        uint64_t key = entry.key();
+        while (j < b.size() && b[j].key() < key) {
+            ++j;
         }
 
-        if (!have) {
+        if (j == b.size() || b[j].key() != key) {
             result.push_back(entry);
         }
     }
@@ -1,12 +1,14 @@
 #pragma once
 
 #include <vector>
+#include <memory>
 #include "geometry/aabb.h"
 #include "Physics/Collision/HitResult.h"
 #include "Physics/Collision/Narrowphase/MinkowskiSum.h"
 #include "Physics/Collision/ContactPoint.h"
 #include "Physics/Collision/CollidePair.h"
 #include "Physics/CollisionFilter.h"
+#include "Concurrent/SpinLock.h"
 
 namespace glacier {
 
@@ -31,9 +33,17 @@ public:
 
     void Update(Rigidbody* body);
 
+    //Pairs below are split in batches of kNarrowphaseBatch over the job system
+    static constexpr uint32_t kParallelNarrowphasePairs = 256;
+    static constexpr uint32_t kNarrowphaseBatch = 32;
+
     std::vector<CollidePair>& Step(std::vector<CollidePair>& collision_enter, std::vector<CollidePair>& collision_exit);
+    //The result is sorted by pair key, serial or parallel alike, so both are bit identical.
+    //Pairs whose colliders didn't move since the last step reuse their last result.
     void Detect();
 
+    void SetParallelNarrowphase(bool parallel) { parallel_narrowphase_ = parallel; }
+
     RayHitResult RayCast(const Ray& ray, float max, uint32_t layer_mask, bool query_sensor);
     bool Detect(const AABB& aabb, std::vector<Collider*>& result, const CollisionFilter* filter);
     bool Detect(Collider* s, std::vector<Collider*>& result, const CollisionFilter* filter);
@@ -44,19 +54,56 @@ public:
     //const BoardPhaseDetector* boardphase_detector() const { return boardphase_detector_; }
 
 private:
+    static constexpr uint32_t kNoCache = (uint32_t)-1;
+
+    //narrowphase result of a broadphase pair, valid while both transforms keep their version
+    struct PairCache {
+        CollidePair pair;
+        uint32_t version_a;
+        uint32_t version_b;
+        uint32_t last; //index in the cache of the last step or kNoCache
+        bool contactable;
+        bool hit;
+
+        PairCache(const CollidePair& pair_, uint32_t last_) : pair(pair_), version_a(0), version_b(0),
+            last(last_), contactable(false), hit(false) {}
+    };
+
+    //scratch of a thread running the narrowphase
+    struct NarrowphaseContext {
+        std::unique_ptr<NarrowPhaseDetector> detector;
+        Simplex simplex;
+    };
+
+    void MatchPairCache();
+    void DetectParallel();
+    //threads outside the job system may run batches while they wait, each takes a context of its own
+    NarrowphaseContext* AcquireOutsideContext();
+    void ReleaseOutsideContext(NarrowphaseContext* context);
+    void DetectRange(NarrowPhaseDetector* detector, Simplex& simplex, size_t begin, size_t end);
+
+    //a and b sorted by pair key
     void Minus(const std::vector<CollidePair>& a, const std::vector<CollidePair>& b, std::vector<CollidePair>& result) const;
 
     std::unique_ptr<BoardPhaseDetector> boardphase_detector_;
     std::unique_ptr<NarrowPhaseDetector> narrowphase_detector_;
 
     Simplex simplex_;
-    ContactPoint contact_;
 
-    std::vector<CollidePair> board_result_;
+    std::vector<CollidePair> board_result_; //sorted by pair key
+    std::vector<PairCache> pair_cache_; //of board_result_
+    std::vector<PairCache> last_pair_cache_;
     std::vector<Collider*> board_query_result_;
 
     std::vector<CollidePair> collide_list_;
     std::vector<CollidePair> last_collide_list_;
+
+    bool parallel_narrowphase_ = true;
+    //one per job worker
+    std::vector<std::unique_ptr<NarrowphaseContext>> narrowphase_contexts_;
+    concurrent::SpinLock outside_lock_;
+    std::vector<std::unique_ptr<NarrowphaseContext>> outside_contexts_;
+    std::vector<NarrowphaseContext*> free_outside_contexts_;
 };
 
 }
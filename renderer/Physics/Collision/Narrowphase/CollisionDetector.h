@@ -1,5 +1,6 @@
 #pragma once
 
+#include <memory>
 #include "Common/Uncopyable.h"
 #include "geometry/aabb.h"
 
@@ -16,6 +17,8 @@ public:
     virtual ~CollisionDetector() {};
     virtual bool Intersect(Collider* a, Collider* b, Simplex& sm) = 0;
     virtual bool Intersect(const AABB& a, Collider* b, Simplex& sm) = 0;
+    //same settings, own scratch state, for another thread
+    virtual std::unique_ptr<CollisionDetector> Clone() const = 0;
 };
 
 }
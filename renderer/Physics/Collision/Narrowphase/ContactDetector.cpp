@@ -32,6 +32,10 @@ void ContactDetector::Clear() {
 
 }
 
+std::unique_ptr<NarrowPhaseDetector> ContactDetector::Clone() const {
+    return std::make_unique<ContactDetector>(collision_detector_->Clone(), contact_generator_->Clone());
+}
+
 }
 }
 
@@ -21,6 +21,7 @@ public:
     bool Detect(const AABB& a, Collider* b, Simplex& simplex) override;
     bool Solve(Collider* a, Collider* b, Simplex& simplex, ContactPoint& ci) override;
     void Clear() override;
+    std::unique_ptr<NarrowPhaseDetector> Clone() const override;
 
 private:
     std::unique_ptr<CollisionDetector> collision_detector_;
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <memory>
 #include "Common/Uncopyable.h"
 
 namespace glacier {
@@ -15,6 +16,8 @@ class ContactManifoldSolver : private Uncopyable {
 public:
     virtual ~ContactManifoldSolver() {};
     virtual bool Solve(Collider* a, Collider* b, Simplex& simplex, ContactPoint& ci) = 0;
+    //same settings, own scratch state, for another thread
+    virtual std::unique_ptr<ContactManifoldSolver> Clone() const = 0;
 };
 
 }
@@ -19,6 +19,10 @@ Epa::Epa(int max_iteration, float threshold) :
     edge_allocator_(kMaxEdgeSize) {
 }
 
+std::unique_ptr<ContactManifoldSolver> Epa::Clone() const {
+    return std::make_unique<Epa>(max_iteration_, grow_threshold_);
+}
+
 bool Epa::Solve(Collider* a, Collider* b, Simplex& simplex, ContactPoint& ci) {
     simplex.BlowingUp(a, b);
 
@@ -55,6 +55,7 @@ public:
 
     Epa(int max_iteration, float threshold);
     bool Solve(Collider* a, Collider* b, Simplex& simplex, ContactPoint& ci);
+    std::unique_ptr<ContactManifoldSolver> Clone() const override;
 
 private:
     bool ExtraContactManifold(SupportTriangle* tri, ContactPoint& ci);
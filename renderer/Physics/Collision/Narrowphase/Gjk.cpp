@@ -6,6 +6,10 @@ namespace physics {
 Gjk::Gjk(int max_iteration) : max_iteration_(max_iteration) {
 }
 
+std::unique_ptr<CollisionDetector> Gjk::Clone() const {
+    return std::make_unique<Gjk>(max_iteration_);
+}
+
 bool Gjk::Intersect(const AABB& a, Collider* b, Simplex& simplex) {
     Vec3f dir = MinkowskiSum::StartDir(a, b);
     
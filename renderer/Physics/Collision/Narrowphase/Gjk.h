@@ -14,6 +14,7 @@ public:
     Gjk(int max_iteration);
     bool Intersect(Collider* a, Collider* b, Simplex& simplex) override;
     bool Intersect(const AABB& a, Collider* b, Simplex& simplex) override;
+    std::unique_ptr<CollisionDetector> Clone() const override;
 
 private:
     bool UpdateSimplex(Simplex& simplex, Vec3f& dir);
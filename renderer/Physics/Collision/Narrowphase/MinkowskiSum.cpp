@@ -5,7 +5,7 @@
 namespace glacier {
 namespace physics {
 
-uint32_t SupportVert::id_counter_ = 0;
+thread_local uint32_t SupportVert::id_counter_ = 0;
 
 SupportVert::SupportVert() {
 }
@@ -10,7 +10,8 @@ class Collider;
 namespace physics {
 
 struct SupportVert {
-    static uint32_t id_counter_;
+    //only compared within one polytope, per thread for the parallel narrowphase
+    static thread_local uint32_t id_counter_;
 
     //world space
     Vec3f point;
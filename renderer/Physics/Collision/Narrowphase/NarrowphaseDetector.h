@@ -1,5 +1,6 @@
 #pragma once
 
+#include <memory>
 #include "Common/Uncopyable.h"
 #include "MinkowskiSum.h"
 
@@ -18,6 +19,8 @@ public:
     virtual bool Detect(const AABB& a, Collider* b, Simplex& simplex) = 0;
     virtual bool Solve(Collider* a, Collider* b, Simplex& simplex, ContactPoint& ci) = 0;
     virtual void Clear() = 0;
+    //Same settings, own scratch state: a detector is used by one thread at a time
+    virtual std::unique_ptr<NarrowPhaseDetector> Clone() const = 0;
 };
 
 }
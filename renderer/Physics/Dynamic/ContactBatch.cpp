@@ -0,0 +1,393 @@
+#include "ContactBatch.h"
+#include <algorithm>
+#include <bit>
+#include "Contact.h"
+#include "ContactManifold.h"
+#include "Physics/Collider/Collider.h"
+#include "Physics/Dynamic/Rigidbody.h"
+#include "Physics/World.h"
+#include "Jobs/JobSystem.h"
+
+namespace glacier {
+namespace physics {
+
+using math::Float4;
+using math::Vec3Float4;
+
+namespace {
+
+constexpr uint32_t kWidth = ContactBatchSolver::kWidth;
+
+void SetLane(float (&v)[3][kWidth], uint32_t lane, const Vec3f& value) {
+    v[0][lane] = value.x;
+    v[1][lane] = value.y;
+    v[2][lane] = value.z;
+}
+
+Vec3f GetLane(const float (&v)[3][kWidth], uint32_t lane) {
+    return { v[0][lane], v[1][lane], v[2][lane] };
+}
+
+Vec3Float4 Load3(const float (&v)[3][kWidth]) {
+    return { Float4::Load(v[0]), Float4::Load(v[1]), Float4::Load(v[2]) };
+}
+
+void Store3(const Vec3Float4& value, float (&v)[3][kWidth]) {
+    value.x.Store(v[0]);
+    value.y.Store(v[1]);
+    value.z.Store(v[2]);
+}
+
+}
+
+void ContactBatchSolver::Solve(std::vector<ContactManifold*>& mfs, float warmstart_ratio, float inv_delta_time,
+    uint32_t iteration)
+{
+    for (auto& mf : mfs) {
+        mf->WarmStart(warmstart_ratio);
+    }
+
+    uint32_t thread_count = jobs::JobSystem::Instance()->GetThreadCount();
+    if (thread_count_ > 0) {
+        thread_count = std::min(thread_count, thread_count_);
+    }
+
+    Prepare(mfs, inv_delta_time, thread_count);
+
+    for (uint32_t i = 0; i < iteration; ++i) {
+        for (uint32_t color = 0; color < color_count_; ++color) {
+            SolveColor(color_groups_[color], thread_count);
+        }
+
+        for (size_t j = serial_begin_; j < batches_.size(); ++j) {
+            SolveBatch(batches_[j]);
+        }
+    }
+
+    Finish();
+}
+
+uint32_t ContactBatchSolver::AddBody(Rigidbody* body) {
+    if (!body) return kStaticBody;
+
+    //left over by the last solve if it doesn't point back to the body
+    uint32_t index = body->solver_index_;
+    if (index < bodies_.size() && bodies_[index].body == body) {
+        return index;
+    }
+
+    index = (uint32_t)bodies_.size();
+    body->solver_index_ = index;
+    bodies_.push_back({ body, body->mass_center(), body->inv_inertia_tensor(),
+        body->linear_velocity(), body->angular_velocity(), body->inv_mass(), 0, body->is_dynamic() });
+
+    return index;
+}
+
+bool ContactBatchSolver::Touches(const ContactBatch& batch, uint32_t a, uint32_t b) const {
+    //static and kinematic bodies are read only, any number of lanes can share them
+    bool dynamic_a = bodies_[a].dynamic;
+    bool dynamic_b = bodies_[b].dynamic;
+    for (uint32_t lane = 0; lane < batch.count; ++lane) {
+        uint32_t lane_a = batch.body_a[lane];
+        uint32_t lane_b = batch.body_b[lane];
+        if (dynamic_a && (lane_a == a || lane_b == a)) return true;
+        if (dynamic_b && (lane_a == b || lane_b == b)) return true;
+    }
+
+    return false;
+}
+
+uint32_t ContactBatchSolver::FindBatch(uint32_t a, uint32_t b) {
+    size_t first = open_batches_.size() > kBatchSearch ? open_batches_.size() - kBatchSearch : 0;
+    for (size_t i = open_batches_.size(); i > first; --i) {
+        uint32_t index = open_batches_[i - 1];
+        auto& batch = batches_[index];
+        if (!Touches(batch, a, b)) {
+            if (batch.count + 1 == kWidth) {
+                open_batches_.erase(open_batches_.begin() + i - 1);
+            }
+
+            return index;
+        }
+    }
+
+    uint32_t index = (uint32_t)batches_.size();
+    batches_.emplace_back(); //zero lanes
+    open_batches_.push_back(index);
+    return index;
+}
+
+void ContactBatchSolver::SetRow(JacobianRow& row, uint32_t lane, const Vec3f& dir, const Vec3f& ra,
+    const Vec3f& rb, const SolverBody& a, const SolverBody& b, float impulse_sum)
+{
+    Vec3f ra_cross = ra.Cross(dir); //ra X n
+    Vec3f rb_cross = rb.Cross(dir); //rb X n
+    Vec3f ia_ra_cross = a.inv_inertia * ra_cross; //Ia^-1 * (ra X n)
+    Vec3f ib_rb_cross = b.inv_inertia * rb_cross; //Ib^-1 * (rb X n)
+
+    //effective mass = J * M^-1 * J^T
+    float effective_mass = a.inv_mass + b.inv_mass + ia_ra_cross.Dot(ra_cross) + ib_rb_cross.Dot(rb_cross);
+
+    SetLane(row.dir, lane, dir);
+    SetLane(row.ra_cross, lane, ra_cross);
+    SetLane(row.rb_cross, lane, rb_cross);
+    SetLane(row.ia_ra_cross, lane, ia_ra_cross);
+    SetLane(row.ib_rb_cross, lane, ib_rb_cross);
+    row.inv_effective_mass[lane] = effective_mass > 0.0f ? 1.0f / effective_mass : 0.0f;
+    row.impulse_sum[lane] = impulse_sum;
+}
+
+void ContactBatchSolver::AddContact(ContactBatch& batch, uint32_t lane, ContactManifold* mf, Contact& contact,
+    uint32_t a, uint32_t b)
+{
+    const SolverBody& body_a = bodies_[a];
+    const SolverBody& body_b = bodies_[b];
+    Vec3f ra = contact.pointA - (a != kStaticBody ? body_a.center : mf->a_->position());
+    Vec3f rb = contact.pointB - (b != kStaticBody ? body_b.center : mf->b_->position());
+
+    SetRow(batch.normal, lane, contact.normal, ra, rb, body_a, body_b, contact.normalImpulseSum);
+    SetRow(batch.tangent[0], lane, contact.tangent[0], ra, rb, body_a, body_b, contact.tangentImpulseSum[0]);
+    SetRow(batch.tangent[1], lane, contact.tangent[1], ra, rb, body_a, body_b, contact.tangentImpulseSum[1]);
+
+    float d = (contact.pointB - contact.pointA).Dot(contact.normal);
+    batch.penetration_bias[lane] = -bias_factor_ * math::Max(-d - penetration_slop_, 0.0f);
+    batch.restitution[lane] = mf->restitution_;
+    batch.friction[lane] = mf->friction_;
+    batch.inv_mass_a[lane] = body_a.inv_mass;
+    batch.inv_mass_b[lane] = body_b.inv_mass;
+
+    batch.body_a[lane] = a;
+    batch.body_b[lane] = b;
+    batch.contact[lane] = &contact;
+    ++batch.count;
+}
+
+void ContactBatchSolver::Prepare(std::vector<ContactManifold*>& mfs, float inv_delta_time, uint32_t thread_count) {
+    bodies_.clear();
+    batches_.clear();
+    open_batches_.clear();
+    color_count_ = 0;
+    serial_begin_ = 0;
+    bodies_.push_back({ nullptr, Vec3f::zero, Matrix3x3::zero, Vec3f::zero, Vec3f::zero, 0.0f, 0, false });
+
+    World* world = World::Instance();
+    bias_factor_ = world->baumgarte_factor() * inv_delta_time;
+    penetration_slop_ = world->penetration_slop();
+    restitution_slop_ = world->restitution_slop();
+
+    size_t contact_count = 0;
+    for (auto mf : mfs) {
+        contact_count += mf->contacts_.size();
+    }
+
+    if (thread_count > 1 && contact_count >= kParallelContacts) {
+        PrepareColors(mfs);
+    } else {
+        PrepareSerial(mfs);
+    }
+}
+
+void ContactBatchSolver::PrepareSerial(std::vector<ContactManifold*>& mfs) {
+    for (auto mf : mfs) {
+        uint32_t a = AddBody(mf->a_->rigidbody());
+        uint32_t b = AddBody(mf->b_->rigidbody());
+        for (auto& contact : mf->contacts_) {
+            auto& batch = batches_[FindBatch(a, b)];
+            AddContact(batch, batch.count, mf, contact, a, b);
+        }
+    }
+}
+
+void ContactBatchSolver::PrepareColors(std::vector<ContactManifold*>& mfs) {
+    for (auto& manifolds : color_manifolds_) {
+        manifolds.clear();
+    }
+
+    uncolored_.clear();
+
+    //greedy, the lowest color free on both dynamic bodies
+    for (auto mf : mfs) {
+        uint32_t index_a = AddBody(mf->a_->rigidbody());
+        uint32_t index_b = AddBody(mf->b_->rigidbody());
+        SolverBody& a = bodies_[index_a];
+        SolverBody& b = bodies_[index_b];
+        uint32_t used = (a.dynamic ? a.colors : 0) | (b.dynamic ? b.colors : 0);
+        if (used == ~0u) {
+            uncolored_.push_back(mf);
+            continue;
+        }
+
+        uint32_t color = (uint32_t)std::countr_zero(~used);
+        if (a.dynamic) a.colors |= 1u << color;
+        if (b.dynamic) b.colors |= 1u << color;
+
+        color_manifolds_[color].push_back(mf);
+        color_count_ = std::max(color_count_, color + 1);
+    }
+
+    for (uint32_t color = 0; color < color_count_; ++color) {
+        auto& manifolds = color_manifolds_[color];
+        auto& groups = color_groups_[color];
+        groups.clear();
+
+        for (size_t i = 0; i < manifolds.size(); i += kWidth) {
+            size_t end = std::min(i + kWidth, manifolds.size());
+            size_t batch_count = 0;
+            for (size_t j = i; j < end; ++j) {
+                batch_count = std::max(batch_count, manifolds[j]->contacts_.size());
+            }
+
+            groups.push_back({ (uint32_t)batches_.size(), (uint32_t)batch_count });
+            for (size_t k = 0; k < batch_count; ++k) {
+                batches_.emplace_back(); //zero lanes
+                auto& batch = batches_.back();
+                for (size_t j = i; j < end; ++j) {
+                    ContactManifold* mf = manifolds[j];
+                    if (k < mf->contacts_.size()) {
+                        uint32_t a = AddBody(mf->a_->rigidbody());
+                        uint32_t b = AddBody(mf->b_->rigidbody());
+                        AddContact(batch, (uint32_t)(j - i), mf, mf->contacts_[k], a, b);
+                    }
+                }
+            }
+        }
+    }
+
+    serial_begin_ = (uint32_t)batches_.size();
+    PrepareSerial(uncolored_);
+}
+
+void ContactBatchSolver::SolveColor(std::vector<BatchGroup>& groups, uint32_t thread_count) {
+    uint32_t count = (uint32_t)groups.size();
+    if (count < 2 * kGroupGrain) {
+        for (auto& group : groups) {
+            for (uint32_t i = 0; i < group.count; ++i) {
+                SolveBatch(batches_[group.first + i]);
+            }
+        }
+
+        return;
+    }
+
+    //at most thread_count jobs
+    uint32_t grain = std::max(kGroupGrain, (count + thread_count - 1) / thread_count);
+    auto job_system = jobs::JobSystem::Instance();
+    auto handle = job_system->ParallelFor([this, &groups](uint32_t begin, uint32_t end) {
+        for (uint32_t i = begin; i < end; ++i) {
+            auto& group = groups[i];
+            for (uint32_t j = 0; j < group.count; ++j) {
+                SolveBatch(batches_[group.first + j]);
+            }
+        }
+    }, count, grain, jobs::JobPriority::kNormal, jobs::JobStackSize::kLarge);
+
+    job_system->WaitComplete(handle);
+}
+
+void ContactBatchSolver::SolveBatch(ContactBatch& batch) {
+    //velocities of the lanes' bodies, padding lanes read the static body
+    alignas(16) float velocity_a[3][kWidth];
+    alignas(16) float omega_a[3][kWidth];
+    alignas(16) float velocity_b[3][kWidth];
+    alignas(16) float omega_b[3][kWidth];
+
+    for (uint32_t lane = 0; lane < kWidth; ++lane) {
+        const SolverBody& a = bodies_[batch.body_a[lane]];
+        const SolverBody& b = bodies_[batch.body_b[lane]];
+        SetLane(velocity_a, lane, a.velocity);
+        SetLane(omega_a, lane, a.omega);
+        SetLane(velocity_b, lane, b.velocity);
+        SetLane(omega_b, lane, b.omega);
+    }
+
+    Vec3Float4 va = Load3(velocity_a);
+    Vec3Float4 wa = Load3(omega_a);
+    Vec3Float4 vb = Load3(velocity_b);
+    Vec3Float4 wb = Load3(omega_b);
+
+    Float4 inv_mass_a = Float4::Load(batch.inv_mass_a);
+    Float4 inv_mass_b = Float4::Load(batch.inv_mass_b);
+    Float4 zero(0.0f);
+
+    //JV = relative velocity projected to the row direction
+    auto relative_velocity = [&](const JacobianRow& row) {
+        Vec3Float4 dir = Load3(row.dir);
+        return (vb.Dot(dir) - va.Dot(dir)) + (wb.Dot(Load3(row.rb_cross)) - wa.Dot(Load3(row.ra_cross)));
+    };
+
+    auto apply_impulse = [&](const JacobianRow& row, Float4 lambda) {
+        Vec3Float4 dir = Load3(row.dir);
+        va -= dir * (lambda * inv_mass_a);
+        wa -= Load3(row.ia_ra_cross) * lambda;
+        vb += dir * (lambda * inv_mass_b);
+        wb += Load3(row.ib_rb_cross) * lambda;
+    };
+
+    //normal
+    Float4 relvn = relative_velocity(batch.normal);
+    Float4 restitution_bias = Float4::Load(batch.restitution) * Max(zero - relvn - Float4(restitution_slop_), zero);
+    Float4 bias = Float4::Load(batch.penetration_bias) - restitution_bias;
+
+    //lambda = -(JV + b) / effective mass
+    Float4 lambda = zero - (relvn + bias) * Float4::Load(batch.normal.inv_effective_mass);
+    Float4 old_sum = Float4::Load(batch.normal.impulse_sum);
+    Float4 normal_sum = Max(zero, old_sum + lambda);
+    normal_sum.Store(batch.normal.impulse_sum);
+    apply_impulse(batch.normal, normal_sum - old_sum);
+
+    //friction
+    Float4 hi = Float4::Load(batch.friction) * normal_sum;
+    Float4 lo = zero - hi;
+    for (auto& row : batch.tangent) {
+        Float4 relvt = relative_velocity(row);
+        lambda = zero - relvt * Float4::Load(row.inv_effective_mass);
+        old_sum = Float4::Load(row.impulse_sum);
+        Float4 sum = Min(Max(old_sum + lambda, lo), hi);
+        sum.Store(row.impulse_sum);
+        apply_impulse(row, sum - old_sum);
+    }
+
+    Store3(va, velocity_a);
+    Store3(wa, omega_a);
+    Store3(vb, velocity_b);
+    Store3(wb, omega_b);
+
+    //lanes touch different dynamic bodies, read only bodies get their own velocity back
+    for (uint32_t lane = 0; lane < kWidth; ++lane) {
+        SolverBody& a = bodies_[batch.body_a[lane]];
+        SolverBody& b = bodies_[batch.body_b[lane]];
+        if (a.dynamic) {
+            a.velocity = GetLane(velocity_a, lane);
+            a.omega = GetLane(omega_a, lane);
+        }
+
+        if (b.dynamic) {
+            b.velocity = GetLane(velocity_b, lane);
+            b.omega = GetLane(omega_b, lane);
+        }
+    }
+}
+
+void ContactBatchSolver::Finish() {
+    for (auto& body : bodies_) {
+        if (body.dynamic) {
+            body.body->linear_velocity(body.velocity);
+            body.body->angular_velocity(body.omega);
+        }
+    }
+
+    for (auto& batch : batches_) {
+        for (uint32_t lane = 0; lane < kWidth; ++lane) {
+            Contact* contact = batch.contact[lane];
+            if (!contact) continue;
+
+            contact->normalImpulseSum = batch.normal.impulse_sum[lane];
+            contact->tangentImpulseSum[0] = batch.tangent[0].impulse_sum[lane];
+            contact->tangentImpulseSum[1] = batch.tangent[1].impulse_sum[lane];
+        }
+    }
+}
+
+}
+}
@@ -0,0 +1,131 @@
+#pragma once
+
+#include <vector>
+#include <stdint.h>
+#include "Math/Vec3.h"
+#include "Math/Mat3.h"
+#include "Math/Simd.h"
+#include "Common/Uncopyable.h"
+
+namespace glacier {
+
+class Rigidbody;
+
+namespace physics {
+
+struct Contact;
+class ContactManifold;
+
+//Solves the contacts of a set of manifolds kWidth at a time, same model as Contact::Solve.
+//Contacts are packed in batches whose lanes touch different dynamic bodies, every batch keeps
+//its Jacobians, effective masses and accumulated impulses lane by lane (structure of arrays),
+//so a solver iteration is a gather, the lanes math and a scatter of the body velocities.
+//Large islands are colored first: the manifolds of a color touch different dynamic bodies
+//(static and kinematic ones are read only, they don't count), so the batches of a color are
+//solved in parallel on the job system, one color after the other.
+class ContactBatchSolver : private Uncopyable {
+public:
+    static constexpr uint32_t kWidth = math::Float4::kWidth;
+    //open batches searched for a free lane before a new one is started
+    static constexpr uint32_t kBatchSearch = 8;
+    //manifolds left without a color are solved serially after the colors
+    static constexpr uint32_t kColorCount = 32;
+    //islands with fewer contacts aren't colored
+    static constexpr uint32_t kParallelContacts = 256;
+    //batch groups per job at least
+    static constexpr uint32_t kGroupGrain = 4;
+
+    //warm start, iteration solver passes and write back of the velocities and impulses
+    void Solve(std::vector<ContactManifold*>& mfs, float warmstart_ratio, float inv_delta_time,
+        uint32_t iteration);
+
+    //threads solving a colored island: 0 every job worker, 1 no coloring
+    void SetThreadCount(uint32_t count) { thread_count_ = count; }
+
+    uint32_t batch_count() const { return (uint32_t)batches_.size(); }
+    //colors used by the last solve, 0 if it wasn't colored
+    uint32_t color_count() const { return color_count_; }
+
+private:
+    static constexpr uint32_t kStaticBody = 0; //no rigidbody, zero velocity and inverse mass
+
+    struct SolverBody {
+        Rigidbody* body;
+        Vec3f center;
+        Matrix3x3 inv_inertia;
+        Vec3f velocity;
+        Vec3f omega;
+        float inv_mass;
+        uint32_t colors; //bit mask of the colors of its manifolds
+        bool dynamic;
+    };
+
+    //one constraint direction: the normal or a tangent
+    struct alignas(16) JacobianRow {
+        float dir[3][kWidth];
+        float ra_cross[3][kWidth]; //ra X dir
+        float rb_cross[3][kWidth]; //rb X dir
+        float ia_ra_cross[3][kWidth]; //Ia^-1 * (ra X dir)
+        float ib_rb_cross[3][kWidth]; //Ib^-1 * (rb X dir)
+        float inv_effective_mass[kWidth];
+        float impulse_sum[kWidth];
+    };
+
+    //padding lanes stay zero, their impulses are zero
+    struct alignas(16) ContactBatch {
+        JacobianRow normal;
+        JacobianRow tangent[2];
+        float inv_mass_a[kWidth];
+        float inv_mass_b[kWidth];
+        float penetration_bias[kWidth];
+        float restitution[kWidth];
+        float friction[kWidth];
+
+        uint32_t body_a[kWidth];
+        uint32_t body_b[kWidth];
+        Contact* contact[kWidth]; //nullptr for padding lanes
+        uint32_t count; //lanes used
+    };
+
+    //kWidth manifolds of one color, the i-th contact of each in the i-th batch:
+    //a group is solved by one job, groups of a color don't share dynamic bodies
+    struct BatchGroup {
+        uint32_t first;
+        uint32_t count;
+    };
+
+    static void SetRow(JacobianRow& row, uint32_t lane, const Vec3f& dir, const Vec3f& ra, const Vec3f& rb,
+        const SolverBody& a, const SolverBody& b, float impulse_sum);
+
+    uint32_t AddBody(Rigidbody* body);
+    uint32_t FindBatch(uint32_t a, uint32_t b);
+    bool Touches(const ContactBatch& batch, uint32_t a, uint32_t b) const;
+    void AddContact(ContactBatch& batch, uint32_t lane, ContactManifold* mf, Contact& contact,
+        uint32_t a, uint32_t b);
+
+    void Prepare(std::vector<ContactManifold*>& mfs, float inv_delta_time, uint32_t thread_count);
+    void PrepareColors(std::vector<ContactManifold*>& mfs);
+    void PrepareSerial(std::vector<ContactManifold*>& mfs);
+    void SolveColor(std::vector<BatchGroup>& groups, uint32_t thread_count);
+    void SolveBatch(ContactBatch& batch);
+    void Finish();
+
+    uint32_t thread_count_ = 0;
+
+    std::vector<SolverBody> bodies_;
+    std::vector<ContactBatch> batches_;
+    std::vector<uint32_t> open_batches_; //not full yet, by age
+
+    uint32_t color_count_ = 0;
+    std::vector<ContactManifold*> color_manifolds_[kColorCount];
+    std::vector<BatchGroup> color_groups_[kColorCount];
+    std::vector<ContactManifold*> uncolored_;
+    uint32_t serial_begin_ = 0; //batches from there on are solved serially
+
+    float bias_factor_ = 0.0f;
+    float penetration_slop_ = 0.0f;
+    float restitution_slop_ = 0.0f;
+};
+
+}
+}
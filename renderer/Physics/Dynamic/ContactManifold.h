@@ -16,6 +16,7 @@ struct ContactPoint;
 class ContactManifold : private Uncopyable {
 public:
     friend struct Contact;
+    friend class ContactBatchSolver;
 
     ContactManifold(ContactManifold&& cm) noexcept;
     ContactManifold(Collider* a, Collider* b, uint64_t key, const ContactPoint& ci);
@@ -23,6 +24,8 @@ public:
 
     size_t count() const;
     uint64_t key() const;
+    Collider* a() const { return a_; }
+    Collider* b() const { return b_; }
     Collider* GetOther(Collider* me);
     void UpdateContact();
     void Add(const ContactPoint& ci);
@@ -1,6 +1,7 @@
 #include "ContactSolver.h"
 #include "Physics/Collision/CollidePair.h"
 #include "Physics/Dynamic/Rigidbody.h"
+#include "Physics/Dynamic/Island.h"
 #include "Physics/Collider/Collider.h"
 
 namespace glacier {
@@ -32,6 +33,10 @@ void ContactSolver::ClearContact(Collider* collider) {
                 other->rigidbody()->Awake();
             }
 
+            if (island_) {
+                island_->Unlink(&mf);
+            }
+
             manifolds_.erase(it);
         }
     }
@@ -46,7 +51,8 @@ void ContactSolver::Step(std::vector<CollidePair> &collideList) {
         auto a = cp.first;
         auto b = cp.second;
         if ((!a->is_dynamic() && !b->is_dynamic()) ||
-            a->is_sensor() || b->is_sensor()) {
+            a->is_sensor() || b->is_sensor() ||
+            (!IsAwake(a) && !IsAwake(b))) {
             continue;
         }
 
@@ -56,14 +62,20 @@ void ContactSolver::Step(std::vector<CollidePair> &collideList) {
 
 void ContactSolver::UpdateContact() {
     for (auto& it : manifolds_) {
-        it.second.UpdateContact();
-        if (it.second.count() == 0) {
+        ContactManifold& mf = it.second;
+        if (!IsAwake(mf.a()) && !IsAwake(mf.b())) continue;
+
+        mf.UpdateContact();
+        if (mf.count() == 0) {
             removes_.push_back(it.first);
         }
     }
 
     for (auto key : removes_) {
         auto it = manifolds_.find(key);
+        if (island_) {
+            island_->Unlink(&it->second);
+        }
         manifolds_.erase(it);
     }
 
@@ -76,12 +88,20 @@ void ContactSolver::AddContactPoint(Collider* a, Collider* b, const ContactPoint
     if (it != manifolds_.end()) {
         it->second.Add(ci);
     } else {
-        manifolds_.emplace_hint(it, key, ContactManifold(a, b, key, ci));
+        it = manifolds_.emplace_hint(it, key, ContactManifold(a, b, key, ci));
         //manifolds_.emplace(key, a, b, key, ci);
+        if (island_) {
+            island_->Link(&it->second);
+        }
     }
 }
 
-void ContactSolver::Solve(std::vector<ContactManifold*>& mfs, float warmstartRatio) const {
+void ContactSolver::Solve(std::vector<ContactManifold*>& mfs, float warmstartRatio) {
+    if (simd_ && inv_interval_ > math::kEpsilon) {
+        batch_solver_.Solve(mfs, warmstartRatio, inv_interval_, max_iteration_);
+        return;
+    }
+
     for (auto& mf : mfs) {
         mf->WarmStart(warmstartRatio);
     }
@@ -95,6 +115,11 @@ void ContactSolver::Solve(std::vector<ContactManifold*>& mfs, float warmstartRat
     }
 }
 
+bool ContactSolver::IsAwake(Collider* collider) {
+    Rigidbody* body = collider->rigidbody();
+    return body && !body->asleep();
+}
+
 ContactManifold* ContactSolver::Find(uint64_t key) const {
     auto it =  manifolds_.find(key);
     if (it != manifolds_.end()) {
@@ -4,6 +4,7 @@
 #include <vector>
 #include <stdint.h>
 #include "ContactManifold.h"
+#include "ContactBatch.h"
 #include "Physics/Collision/CollidePair.h"
 
 namespace glacier {
@@ -13,6 +14,8 @@ class Gizmos;
 
 namespace physics {
 
+class Island;
+
 class ContactSolver {
 public:
     ContactSolver(uint32_t maxIter=10);
@@ -23,9 +26,15 @@ public:
     void Step(std::vector<CollidePair> &collideList);
     void UpdateContact();
     void AddContactPoint(Collider* a, Collider* b, const ContactPoint& ci);
-    void Solve(std::vector<ContactManifold*>& mfs, float warmstartRatio) const;
+    //batched over simd lanes unless SetSimd(false), the scalar path solves one contact at a time
+    void Solve(std::vector<ContactManifold*>& mfs, float warmstartRatio);
+    void SetSimd(bool simd) { simd_ = simd; }
+    //threads solving a large island, see ContactBatchSolver
+    void SetThreadCount(uint32_t count) { batch_solver_.SetThreadCount(count); }
     ContactManifold* Find(uint64_t key) const;
     void inv_interval(float value) { inv_interval_ = value; }
+    //told about the manifolds coming and going
+    void island(Island* island) { island_ = island; }
 
     const std::unordered_map<uint64_t, ContactManifold>& GetManifold() const { return manifolds_; }
 
@@ -33,11 +42,18 @@ public:
     void OnDrawGizmos();
 
 private:
+    //a contact between sleeping or static bodies is left as is
+    static bool IsAwake(Collider* collider);
+
     float inv_interval_;
     uint32_t max_iteration_;
 
     std::unordered_map<uint64_t, ContactManifold> manifolds_;
     std::vector<uint64_t> removes_;
+
+    bool simd_ = true;
+    ContactBatchSolver batch_solver_;
+    Island* island_ = nullptr;
 };
 
 }
@@ -9,80 +9,354 @@ namespace physics {
 Island::Island() {
 }
 
-void Island::Step(ContactSolver* solver, const List<Rigidbody>& world_bodies, float delta_time) {
+void Island::AddBody(Rigidbody* body) {
+    pending_.push_back(body);
+}
+
+void Island::RemoveBody(Rigidbody* body) {
+    pending_.erase(std::remove(pending_.begin(), pending_.end(), body), pending_.end());
+    kinematics_.erase(std::remove(kinematics_.begin(), kinematics_.end(), body), kinematics_.end());
+    if (!IsRegistered(body)) return;
+
+    Group& group = groups_[body->island_];
+    uint32_t index = body->island_index_;
+    group.bodies[index] = group.bodies.back();
+    group.bodies[index]->island_index_ = index;
+    group.bodies.pop_back();
+
+    //the rest may have fallen apart, an empty island is freed by the next Step
+    uint32_t root = Find(body->island_);
+    body->island_ = kNone;
+    --groups_[root].size;
+    ++groups_[root].removed_contacts;
+    if (groups_[root].size == 0) {
+        WakeGroup(root);
+    }
+}
+
+void Island::Link(ContactManifold* mf) {
+    Rigidbody* a = mf->a()->rigidbody();
+    Rigidbody* b = mf->b()->rigidbody();
+    if (!a || !b || !a->is_dynamic() || !b->is_dynamic()) return;
+
+    //the contact may come before the Step registering them
+    Register(a);
+    Register(b);
+
+    uint32_t root_a = Find(a->island_);
+    uint32_t root_b = Find(b->island_);
+    if (root_a == root_b) return;
+
+    //a sleeping island touched by an awake one wakes up
+    WakeGroup(root_a);
+    WakeGroup(root_b);
+
+    //union by size, the bodies are moved by MergeGroups
+    if (groups_[root_a].size < groups_[root_b].size) {
+        std::swap(root_a, root_b);
+    }
+
+    Group& root = groups_[root_a];
+    Group& child = groups_[root_b];
+    child.parent = root_a;
+    root.size += child.size;
+    root.removed_contacts += child.removed_contacts;
+    merged_.push_back(root_b);
+}
+
+void Island::Unlink(ContactManifold* mf) {
+    Rigidbody* a = mf->a()->rigidbody();
+    Rigidbody* b = mf->b()->rigidbody();
+    if (!a || !b || !a->is_dynamic() || !b->is_dynamic()) return;
+    if (!IsRegistered(a)) return;
+
+    ++groups_[Find(a->island_)].removed_contacts;
+}
+
+void Island::Wake(Rigidbody* body) {
+    if (!IsRegistered(body)) return;
+
+    WakeGroup(Find(body->island_));
+}
+
+void Island::Step(ContactSolver* solver, float delta_time) {
+    RegisterPending();
+    MergeGroups();
+    WakeByKinematics(solver);
+
     ++version_;
     if (version_ == 0) version_ = 1;
 
-    for (auto& seed : world_bodies) {
-        if (seed->asleep() || seed->IsOnIsland(version_)) continue;
+    //a split walks the contacts of the whole island, once per step at most
+    bool split = false;
+    next_awake_.clear();
+    for (size_t i = 0; i < awake_.size(); ++i) {
+        uint32_t id = awake_[i];
+        Group& group = groups_[id];
+        if (!group.alive || group.parent != id || group.asleep || group.version == version_) continue;
 
-        manifolds_.clear();
-        bodies_.clear();
-        //stack_.clear();
+        group.version = version_;
+        if (group.size == 0) {
+            FreeGroup(id);
+            continue;
+        }
 
-        seed->AddIsland(version_);
-        seed->Awake(true);
+        CollectManifolds(solver, id);
+        solver->Solve(manifolds_, kWarmStartRatio);
+        UpdateSleep(id, delta_time);
 
-        stack_.push(seed.data);
-        bodies_.push_back(seed.data);
+        if (groups_[id].sleep_time > kTimeToSleep) {
+            //a whole island sleeps or none of it, a split lets its resting parts sleep
+            if (groups_[id].removed_contacts == 0) {
+                SleepGroup(id);
+                continue;
+            }
 
-        while (!stack_.empty()) {
-            Rigidbody* body = stack_.top();
-            stack_.pop();
+            if (!split) {
+                split = true;
+                Split(solver, id);
+                continue;
+            }
+        }
 
-            for (auto collider : body->colliders_) {
-                for (auto key : collider->contacts_) {
-                    ContactManifold* mf = solver->Find(key);
-                    assert(mf);
+        next_awake_.push_back(id);
+    }
+
+    std::swap(awake_, next_awake_);
+    manifolds_.clear();
+}
 
-                    if (!mf->IsOnIsland(version_)) {
-                        manifolds_.push_back(mf);
-                        mf->AddIsland(version_);
-                    }
+void Island::Clear() {
+    groups_.clear();
+    free_groups_.clear();
+    merged_.clear();
+    awake_.clear();
+    next_awake_.clear();
+    pending_.clear();
+    kinematics_.clear();
+    island_count_ = 0;
+}
 
-                    Collider* other_collider = mf->GetOther(collider);
-                    if (!other_collider) continue;
+bool Island::IsRegistered(Rigidbody* body) const {
+    //left over by a freed island or Clear if it doesn't point back to the body
+    uint32_t id = body->island_;
+    if (id >= groups_.size() || !groups_[id].alive) return false;
 
-                    Rigidbody* other = other_collider->rigidbody();
-                    if (!other || other->IsOnIsland(version_)) continue;
+    auto& bodies = groups_[id].bodies;
+    return body->island_index_ < bodies.size() && bodies[body->island_index_] == body;
+}
 
-                    other->AddIsland(version_);
-                    other->Awake(true);
+void Island::Register(Rigidbody* body) {
+    if (body->is_kinematic()) {
+        if (std::find(kinematics_.begin(), kinematics_.end(), body) == kinematics_.end()) {
+            kinematics_.push_back(body);
+        }
+        return;
+    }
+
+    if (!body->is_dynamic() || IsRegistered(body)) return;
+
+    uint32_t id = NewGroup();
+    AddToGroup(id, body);
+    groups_[id].size = 1;
+    awake_.push_back(id);
+}
+
+uint32_t Island::Find(uint32_t id) {
+    while (groups_[id].parent != id) {
+        groups_[id].parent = groups_[groups_[id].parent].parent; //path halving
+        id = groups_[id].parent;
+    }
+
+    return id;
+}
+
+uint32_t Island::NewGroup() {
+    uint32_t id;
+    if (!free_groups_.empty()) {
+        id = free_groups_.back();
+        free_groups_.pop_back();
+    } else {
+        id = (uint32_t)groups_.size();
+        groups_.emplace_back();
+    }
+
+    Group& group = groups_[id];
+    group.parent = id;
+    group.size = 0;
+    group.bodies.clear();
+    group.removed_contacts = 0;
+    group.sleep_time = 0.0f;
+    group.version = 0;
+    group.asleep = false;
+    group.alive = true;
+
+    ++island_count_;
+    return id;
+}
+
+void Island::FreeGroup(uint32_t id) {
+    Group& group = groups_[id];
+    group.alive = false;
+    group.bodies.clear();
+    free_groups_.push_back(id);
+
+    --island_count_;
+}
+
+void Island::AddToGroup(uint32_t id, Rigidbody* body) {
+    auto& bodies = groups_[id].bodies;
+    body->island_ = id;
+    body->island_index_ = (uint32_t)bodies.size();
+    bodies.push_back(body);
+}
+
+void Island::WakeGroup(uint32_t id) {
+    Group& group = groups_[id];
+    group.sleep_time = 0.0f;
+    if (!group.asleep) return;
+
+    group.asleep = false;
+    awake_.push_back(id);
+
+    for (auto body : group.bodies) {
+        body->Awake();
+    }
+}
+
+void Island::SleepGroup(uint32_t id) {
+    Group& group = groups_[id];
+    group.asleep = true;
+
+    for (auto body : group.bodies) {
+        body->SetAsleep();
+    }
+}
+
+void Island::RegisterPending() {
+    for (auto body : pending_) {
+        Register(body);
+    }
 
-                    stack_.push(other);
-                    bodies_.push_back(other);
+    pending_.clear();
+}
+
+void Island::MergeGroups() {
+    //every root is found before any group is freed, the chains stay intact
+    for (auto id : merged_) {
+        uint32_t root = Find(id);
+        for (auto body : groups_[id].bodies) {
+            AddToGroup(root, body);
+        }
+    }
+
+    for (auto id : merged_) {
+        FreeGroup(id);
+    }
+
+    merged_.clear();
+}
+
+void Island::WakeByKinematics(ContactSolver* solver) {
+    for (auto body : kinematics_) {
+        if (body->linear_velocity() == Vec3f::zero && body->angular_velocity() == Vec3f::zero) continue;
+
+        for (auto collider : body->colliders_) {
+            for (auto key : collider->contacts_) {
+                ContactManifold* mf = solver->Find(key);
+                assert(mf);
+
+                Rigidbody* other = mf->GetOther(collider)->rigidbody();
+                if (other && IsRegistered(other)) {
+                    WakeGroup(Find(other->island_));
                 }
             }
         }
+    }
+}
 
-        solver->Solve(manifolds_, kWarmStartRatio);
+void Island::CollectManifolds(ContactSolver* solver, uint32_t id) {
+    manifolds_.clear();
+
+    for (auto body : groups_[id].bodies) {
+        for (auto collider : body->colliders_) {
+            for (auto key : collider->contacts_) {
+                ContactManifold* mf = solver->Find(key);
+                assert(mf);
 
-        float minSleepTime = (std::numeric_limits<float>::max)();
-        for (auto body : bodies_) {
-            if (body->linear_velocity().MagnitudeSq() > kLinearSleepSq ||
-                body->angular_velocity().MagnitudeSq() > kAngularSleepSq) {
-                body->Awake();
-                minSleepTime = 0.0f;
-            } else {
-                body->Sleep(delta_time);
-                minSleepTime = math::Min(minSleepTime, body->sleep_time());
+                if (!mf->IsOnIsland(version_)) {
+                    manifolds_.push_back(mf);
+                    mf->AddIsland(version_);
+                }
             }
         }
+    }
+}
+
+void Island::UpdateSleep(uint32_t id, float delta_time) {
+    Group& group = groups_[id];
+    float min_sleep_time = (std::numeric_limits<float>::max)();
+    for (auto body : group.bodies) {
+        if (body->linear_velocity().MagnitudeSq() > kLinearSleepSq ||
+            body->angular_velocity().MagnitudeSq() > kAngularSleepSq) {
+            body->Awake();
+            min_sleep_time = 0.0f;
+        } else {
+            body->Sleep(delta_time);
+            min_sleep_time = math::Min(min_sleep_time, body->sleep_time());
+        }
+    }
+
+    group.sleep_time = min_sleep_time;
+}
+
+void Island::Split(ContactSolver* solver, uint32_t id) {
+    split_bodies_.clear();
+    std::swap(split_bodies_, groups_[id].bodies);
+    FreeGroup(id);
+
+    //the bodies are marked with this step's version once they found their part,
+    //the first part may reuse the id but only the unmarked ones are left to visit
+    for (auto seed : split_bodies_) {
+        if (seed->IsOnIsland(version_)) continue;
+
+        uint32_t part = NewGroup();
+        float min_sleep_time = (std::numeric_limits<float>::max)();
+
+        seed->AddIsland(version_);
+        stack_.push_back(seed);
+
+        while (!stack_.empty()) {
+            Rigidbody* body = stack_.back();
+            stack_.pop_back();
+
+            AddToGroup(part, body);
+            min_sleep_time = math::Min(min_sleep_time, body->sleep_time());
+
+            for (auto collider : body->colliders_) {
+                for (auto key : collider->contacts_) {
+                    ContactManifold* mf = solver->Find(key);
+                    assert(mf);
 
-        if (minSleepTime > 0.5f) {
-            for (auto body : bodies_) {
-                if (body->is_dynamic()) {
-                    body->SetAsleep();
+                    Rigidbody* other = mf->GetOther(collider)->rigidbody();
+                    if (!other || other->island_ != id || other->IsOnIsland(version_)) continue;
+
+                    other->AddIsland(version_);
+                    stack_.push_back(other);
                 }
             }
         }
+
+        //solved this step already, the parts may fall asleep on the next one
+        Group& group = groups_[part];
+        group.size = (uint32_t)group.bodies.size();
+        group.sleep_time = min_sleep_time;
+        group.version = version_;
+        next_awake_.push_back(part);
     }
 
-    manifolds_.clear();
-    bodies_.clear();
-    //stack_.Clear();
+    split_bodies_.clear();
 }
 
 }
 }
-
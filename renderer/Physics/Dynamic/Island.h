@@ -1,7 +1,6 @@
 #pragma once
 
 #include <vector>
-#include <stack>
 #include "physics/dynamic/rigidbody.h"
 #include "common/list.h"
 
@@ -11,19 +10,78 @@ namespace physics {
 class ContactSolver;
 class ContactManifold;
 
+//Persistent islands of dynamic bodies linked by contacts. A new contact unions the islands
+//of its bodies (union-find, merged once per step), a removed one only marks its island as a
+//split candidate: it's split when it would fall asleep. Sleeping islands skip the solver.
+//Static and kinematic bodies don't link islands, a moving kinematic body wakes the ones it touches.
 class Island {
 public:
     constexpr static float kLinearSleepSq = 0.01f;
     constexpr static float kAngularSleepSq = 2.0f / 180.0f * math::kPI;
     constexpr static float kWarmStartRatio = 0.2f;
+    constexpr static float kTimeToSleep = 0.5f;
+    constexpr static uint32_t kNone = (uint32_t)-1;
 
     Island();
-    void Step(ContactSolver* solver, const List<Rigidbody>& world_bodies, float delta_time);
+
+    //bodies are registered at the next Step, they may not be constructed yet
+    void AddBody(Rigidbody* body);
+    void RemoveBody(Rigidbody* body);
+
+    //from the ContactSolver as manifolds come and go
+    void Link(ContactManifold* mf);
+    void Unlink(ContactManifold* mf);
+
+    void Wake(Rigidbody* body);
+
+    void Step(ContactSolver* solver, float delta_time);
+    void Clear();
+
+    uint32_t island_count() const { return island_count_; }
+    //exact after Step
+    uint32_t awake_island_count() const { return (uint32_t)awake_.size(); }
 
 private:
+    struct Group {
+        uint32_t parent; //union-find, itself for a root
+        uint32_t size; //bodies of the whole set while it's a root
+        std::vector<Rigidbody*> bodies; //labeled with this group
+        uint32_t removed_contacts; //since the last split
+        float sleep_time; //min of its bodies
+        uint32_t version; //last step it was solved in
+        bool asleep;
+        bool alive;
+    };
+
+    bool IsRegistered(Rigidbody* body) const;
+    void Register(Rigidbody* body);
+    uint32_t Find(uint32_t id);
+    uint32_t NewGroup();
+    void FreeGroup(uint32_t id);
+    void AddToGroup(uint32_t id, Rigidbody* body);
+    void WakeGroup(uint32_t id);
+    void SleepGroup(uint32_t id);
+
+    void RegisterPending();
+    void MergeGroups();
+    void WakeByKinematics(ContactSolver* solver);
+    void CollectManifolds(ContactSolver* solver, uint32_t id);
+    void UpdateSleep(uint32_t id, float delta_time);
+    void Split(ContactSolver* solver, uint32_t id);
+
+    std::vector<Group> groups_;
+    std::vector<uint32_t> free_groups_;
+    std::vector<uint32_t> merged_; //unioned since the last MergeGroups
+    std::vector<uint32_t> awake_; //roots, may hold dead or sleeping entries until the next Step
+    std::vector<uint32_t> next_awake_;
+    uint32_t island_count_ = 0;
+
+    std::vector<Rigidbody*> pending_;
+    std::vector<Rigidbody*> kinematics_;
+
     std::vector<ContactManifold*> manifolds_;
-    std::vector<Rigidbody*> bodies_;
-    std::stack<Rigidbody*> stack_;
+    std::vector<Rigidbody*> split_bodies_;
+    std::vector<Rigidbody*> stack_;
 
     uint32_t version_ = 0;
 };
@@ -3,6 +3,7 @@
 #include <assert.h>
 #include "physics/world.h"
 #include "physics/collider/collider.h"
+#include "physics/dynamic/island.h"
 #include "Core/GameObject.h"
 
 namespace glacier {
@@ -27,7 +28,10 @@ Rigidbody::Rigidbody(RigidbodyType type, bool use_gravity) :
     angular_damping_(0),
     sleep_time_(0),
     asleep_(false),
-    island_ver_(0)
+    island_ver_(0),
+    solver_index_(0),
+    island_(physics::Island::kNone),
+    island_index_(0)
 {
 }
 
@@ -334,7 +338,13 @@ void Rigidbody::Awake(bool flagonly) {
     if (!flagonly) {
         sleep_time_ = 0.0f;
     }
+
+    //the whole island wakes with it
+    bool was_asleep = asleep_;
     asleep_ = false;
+    if (was_asleep) {
+        physics::World::Instance()->OnBodyAwake(this);
+    }
 }
 
 void Rigidbody::Sleep(float dt) {
@@ -17,6 +17,7 @@ namespace physics {
     class DynamicBvh;
     class CollisionFilter;
     class Island;
+    class ContactBatchSolver;
 }
 
 class Rigidbody :
@@ -29,6 +30,7 @@ public:
     friend physics::DynamicBvh;
     friend physics::World;
     friend physics::Island;
+    friend physics::ContactBatchSolver;
 
     Rigidbody(RigidbodyType type = RigidbodyType::kDynamic, bool use_gravity = false);
     ~Rigidbody();
@@ -118,6 +120,9 @@ private:
     float sleep_time_;// = 0f;
     bool asleep_;// = false;
     uint32_t island_ver_;// = 0;
+    uint32_t solver_index_;
+    uint32_t island_; //group in physics::Island
+    uint32_t island_index_; //slot in its bodies
 };
 
 }
@@ -29,6 +29,7 @@ World::World()
     contact_solver_->inv_interval((float)frequency_);
 
     island_ = std::make_unique<Island>();
+    contact_solver_->island(island_.get());
 
     gravity(Vec3f{ 0.0f, -9.8f, 0.0f });
 }
@@ -37,6 +38,24 @@ World::~World() {
     Clear();
 }
 
+void World::Add(ListNode<Rigidbody>& node) {
+    BaseType::Add(node);
+    if (island_) {
+        island_->AddBody(node.data);
+    }
+}
+
+void World::Remove(ListNode<Rigidbody>& node) {
+    BaseType::Remove(node);
+    if (island_) {
+        island_->RemoveBody(node.data);
+    }
+}
+
+void World::OnBodyAwake(Rigidbody* body) {
+    island_->Wake(body);
+}
+
 void World::AddCollider(Collider* collider) {
     collision_system_->AddCollider(collider);
 }
@@ -77,7 +96,7 @@ void World::Step() {
 
     contact_solver_->Step(collideList); //dynamic solver
 
-    island_->Step(contact_solver_.get(), objects_, inv_frequency_);
+    island_->Step(contact_solver_.get(), inv_frequency_);
     for (auto& body : objects_) {
         UpdateBody(body.data);
     }
@@ -132,6 +151,7 @@ RayHitResult World::RayCast(const Ray& ray, float max, uint32_t layer_mask, bool
 void World::Clear() {
     collision_system_->Clear();
     contact_solver_->Clear();
+    island_->Clear();
 
     objects_.clear();
 
@@ -146,6 +166,26 @@ void World::Resume() {
     pause_ = false;
 }
 
+void World::SetParallelNarrowphase(bool parallel) {
+    collision_system_->SetParallelNarrowphase(parallel);
+}
+
+void World::SetSimdSolver(bool simd) {
+    contact_solver_->SetSimd(simd);
+}
+
+void World::SetSolverThreads(uint32_t count) {
+    contact_solver_->SetThreadCount(count);
+}
+
+uint32_t World::island_count() const {
+    return island_->island_count();
+}
+
+uint32_t World::awake_island_count() const {
+    return island_->awake_island_count();
+}
+
 void World::OnDrawGizmos(bool draw_bvh) {
     collision_system_->OnDrawGizmos(draw_bvh);
     //contact_solver_->OnDrawGizmos();
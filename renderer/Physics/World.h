@@ -38,6 +38,10 @@ public:
 
     void Clear();
 
+    //the bodies are also tracked by the islands
+    void Add(ListNode<Rigidbody>& node);
+    void Remove(ListNode<Rigidbody>& node);
+
     void AddCollider(Collider* collider);
     void RemoveCollider(Collider* collider);
     
@@ -47,6 +51,17 @@ public:
     void Pause();
     void Resume();
 
+    //narrowphase on the job system for large pair lists, same results either way
+    void SetParallelNarrowphase(bool parallel);
+    //contacts solved in simd batches, converges like the scalar solver but not bit identical
+    void SetSimdSolver(bool simd);
+    //large islands are colored and solved on up to count job workers, 0 every worker, 1 serial
+    void SetSolverThreads(uint32_t count);
+
+    uint32_t island_count() const;
+    //islands solved by the last Step, sleeping ones skip the solver
+    uint32_t awake_island_count() const;
+
     RayHitResult RayCast(const Ray& ray, float max, 
         uint32_t layer_mask = GameObject::kAllLayers, bool query_sensor = true);
 
@@ -73,6 +88,7 @@ private:
     void FixedUpdate(float deltaTime);
     void UpdateBody(Rigidbody* body);
     void ProcessCallBack();
+    void OnBodyAwake(Rigidbody* body);
 
     static constexpr int kDefaultFrequency = 50;
 
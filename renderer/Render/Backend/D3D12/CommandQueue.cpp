@@ -29,7 +29,7 @@ D3D12CommandQueue::D3D12CommandQueue(D3D12GfxDriver* driver, CommandBufferType t
     desc.NodeMask = 0;
 
     GfxThrowIfFailed(device_->CreateCommandQueue(&desc, IID_PPV_ARGS(&command_queue_)));
-    GfxThrowIfFailed(device_->CreateFence(current_fence_value, D3D12_FENCE_FLAG_NONE, IID_PPV_ARGS(&fence_)));
+    GfxThrowIfFailed(device_->CreateFence(current_fence_value.load(std::memory_order_relaxed), D3D12_FENCE_FLAG_NONE, IID_PPV_ARGS(&fence_)));
 
     switch (native_type_) {
         case D3D12_COMMAND_LIST_TYPE_COPY:
@@ -56,6 +56,18 @@ D3D12CommandQueue::D3D12CommandQueue(D3D12GfxDriver* driver, CommandBufferType t
 }
 
 D3D12CommandQueue::~D3D12CommandQueue() {
+    if (fence_thread_.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(fence_wait_lock_);
+            fence_thread_alive_ = false;
+        }
+
+        ::SetEvent(fence_wake_event_);
+        fence_thread_.join();
+
+        ::CloseHandle(fence_event_);
+        ::CloseHandle(fence_wake_event_);
+    }
 }
 
 void D3D12CommandQueue::SetName(const TCHAR* Name) {
@@ -63,13 +75,14 @@ void D3D12CommandQueue::SetName(const TCHAR* Name) {
 }
 
 uint64_t D3D12CommandQueue::Signal() {
-    uint64_t fenceValue = ++current_fence_value;
+    concurrent::SpinLockGuard guard(signal_lock_);
+    uint64_t fenceValue = current_fence_value.fetch_add(1, std::memory_order_acq_rel) + 1;
     GfxThrowIfFailed(command_queue_->Signal(fence_.Get(), fenceValue));
     return fenceValue;
 }
 
 void D3D12CommandQueue::Wait(const D3D12CommandQueue& other) {
-    command_queue_->Wait(other.fence_.Get(), other.current_fence_value);
+    command_queue_->Wait(other.fence_.Get(), other.current_fence_value.load(std::memory_order_acquire));
 }
 
 uint64_t D3D12CommandQueue::GetCompletedFenceValue() {
@@ -95,10 +108,70 @@ void D3D12CommandQueue::WaitForFenceValue(uint64_t fenceValue) {
     }
 }
 
+void D3D12CommandQueue::OnFenceComplete(uint64_t fenceValue, std::function<void()>&& callback) {
+    {
+        std::lock_guard<std::mutex> lock(fence_wait_lock_);
+        if (!fence_thread_.joinable()) {
+            fence_event_ = ::CreateEvent(nullptr, false, false, nullptr);
+            fence_wake_event_ = ::CreateEvent(nullptr, false, false, nullptr);
+            ThrowAssert(fence_event_ && fence_wake_event_, "CreateEvent(...)");
+
+            fence_thread_alive_ = true;
+            fence_thread_ = std::thread([this]() { FenceThreadLoop(); });
+        }
+
+        fence_waits_.emplace_back(fenceValue, std::move(callback));
+    }
+
+    ::SetEvent(fence_wake_event_);
+}
+
+void D3D12CommandQueue::FenceThreadLoop() {
+    std::vector<std::function<void()>> completed;
+
+    while (true) {
+        uint64_t next_value = 0;
+        {
+            std::lock_guard<std::mutex> lock(fence_wait_lock_);
+            if (!fence_thread_alive_) {
+                break;
+            }
+
+            uint64_t completed_value = fence_->GetCompletedValue();
+            for (size_t i = 0; i < fence_waits_.size();) {
+                if (fence_waits_[i].first <= completed_value) {
+                    completed.push_back(std::move(fence_waits_[i].second));
+                    fence_waits_[i] = std::move(fence_waits_.back());
+                    fence_waits_.pop_back();
+                } else {
+                    if (next_value == 0 || fence_waits_[i].first < next_value) {
+                        next_value = fence_waits_[i].first;
+                    }
+                    ++i;
+                }
+            }
+        }
+
+        for (auto& callback : completed) {
+            callback();
+        }
+        completed.clear();
+
+        //the fence event fires right away if the value completed in between
+        HANDLE events[] = { fence_wake_event_, fence_event_ };
+        DWORD event_count = 1;
+        if (next_value > 0 && SUCCEEDED(fence_->SetEventOnCompletion(next_value, fence_event_))) {
+            event_count = 2;
+        }
+
+        ::WaitForMultipleObjects(event_count, events, FALSE, INFINITE);
+    }
+}
+
 void D3D12CommandQueue::Flush() {
-    Signal();
+    uint64_t fence_value = Signal();
     // Wait until the GPU has completed commands up to this fence point.
-    WaitForFenceValue(current_fence_value);
+    WaitForFenceValue(fence_value);
 
     ProccessInFlightCommandLists();
 }
@@ -150,7 +223,8 @@ uint64_t D3D12CommandQueue::ExecuteCommandBuffer(std::vector<CommandBuffer*>& cm
 
     // Queue command lists for reuse.
     for (auto commandList : inflight_list) {
-        inflight_command_lists_.Push({ fence_value, commandList });
+        commandList->SetFenceValue(fence_value);
+        inflight_command_lists_.Push(commandList);
     }
 
     // If there are any command lists that generate mips then execute those
@@ -170,22 +244,28 @@ uint64_t D3D12CommandQueue::ExecuteCommandBuffer(CommandBuffer* cmd_buffer) {
 }
 
 void D3D12CommandQueue::ProccessInFlightCommandLists() {
-    CommandBufferEntry commandListEntry;
-
-    while (inflight_command_lists_.TryPeek(commandListEntry)) {
-        auto fenceValue = std::get<0>(commandListEntry);
-        auto commandList = std::get<1>(commandListEntry);
+    //another thread is recycling them already
+    if (!inflight_lock_.TryLock()) {
+        return;
+    }
 
-        if (!IsFenceComplete(fenceValue)) {
+    //concurrent submissions may be queued slightly out of fence order, a buffer is then recycled a bit later
+    while (auto commandList = inflight_command_lists_.Peek()) {
+        if (!IsFenceComplete(commandList->GetFenceValue())) {
             break;
         }
 
-        inflight_command_lists_.Pop();
+        //the last one may still be linked by a concurrent submission, try it next time
+        if (!inflight_command_lists_.Pop()) {
+            break;
+        }
 
         commandList->Reset();
 
         available_command_lists_.Push(commandList);
     }
+
+    inflight_lock_.Unlock();
 }
 
 D3D12CommandBuffer* D3D12CommandQueue::GetNativeCommandBuffer() {
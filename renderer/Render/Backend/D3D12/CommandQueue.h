@@ -4,7 +4,8 @@
 #include <atomic>              // For std::atomic_bool
 #include <condition_variable>  // For std::condition_variable.
 #include <cstdint>             // For uint64_t
-#include "Concurrent/ThreadSafeQueue.h"
+#include <thread>
+#include <utility>
 #include "Render/Base/CommandQueue.h"
 
 namespace glacier {
@@ -30,6 +31,7 @@ public:
     uint64_t GetCompletedFenceValue();
     bool IsFenceComplete(uint64_t fenceValue );
     void WaitForFenceValue(uint64_t fenceValue);
+    void OnFenceComplete(uint64_t fenceValue, std::function<void()>&& callback) override;
 
     void Flush();
 
@@ -44,12 +46,21 @@ public:
 
 private:
     std::unique_ptr<CommandBuffer> CreateCommandBuffer() override;
+    void FenceThreadLoop();
 
     ID3D12Device* device_ = nullptr;
     D3D12_COMMAND_LIST_TYPE native_type_;
 
     ComPtr<ID3D12CommandQueue> command_queue_ = nullptr;
     ComPtr<ID3D12Fence> fence_ = nullptr;
+
+    //started by the first OnFenceComplete, sleeps on the fence event of the lowest pending value
+    std::mutex fence_wait_lock_;
+    std::vector<std::pair<uint64_t, std::function<void()>>> fence_waits_;
+    HANDLE fence_event_ = nullptr;
+    HANDLE fence_wake_event_ = nullptr; //new wait or shutdown
+    std::thread fence_thread_;
+    bool fence_thread_alive_ = false;
 };
 
 }
@@ -10,6 +10,7 @@
 #include "Math/Vec3.h"
 #include "Common/Color.h"
 #include "Common/Uncopyable.h"
+#include "Concurrent/MPSCQueue.h"
 
 namespace glacier {
 namespace render {
@@ -26,7 +27,8 @@ class RenderTarget;
 class Buffer;
 class Texture;
 
-class CommandBuffer : private Uncopyable {
+//Recycled through the MPSC queues of its CommandQueue
+class CommandBuffer : private Uncopyable, public concurrent::MPSCNode {
 public:
     CommandBuffer(GfxDriver* driver, CommandBufferType type);
     virtual ~CommandBuffer() {}
@@ -102,10 +104,15 @@ public:
 
     GfxDriver* GetDriver() const { return driver_; }
 
+    //fence signaled by the last submission of the buffer
+    uint64_t GetFenceValue() const { return fence_value_; }
+    void SetFenceValue(uint64_t fence_value) { fence_value_ = fence_value; }
+
 protected:
     bool closed_ = false;
     
     GfxDriver* driver_;
+    uint64_t fence_value_ = 0;
     CommandBufferType type_;
 
     CommandBuffer* compute_cmd_buffer_ = nullptr;
@@ -20,12 +20,17 @@ CommandQueue::CommandQueue(GfxDriver* driver, CommandBufferType type) :
 
 CommandBuffer* CommandQueue::GetCommandBuffer() {
     CommandBuffer* command_list;
+    {
+        concurrent::SpinLockGuard guard(available_lock_);
+        command_list = available_command_lists_.Pop();
+    }
 
-    if (!available_command_lists_.TryPop(command_list)) {
+    if (!command_list) {
         auto pointer = CreateCommandBuffer();
         command_list = pointer.get();
 
-        command_list_pool_.Push(std::move(pointer));
+        std::lock_guard<std::mutex> guard(pool_lock_);
+        command_list_pool_.push_back(std::move(pointer));
     }
 
     return command_list;
@@ -1,10 +1,13 @@
 #pragma once
 
 #include <vector>
+#include <functional>
 #include <atomic>
 #include <condition_variable>
 #include <cstdint>
-#include "Concurrent/ThreadSafeQueue.h"
+#include <mutex>
+#include "Concurrent/MPSCQueue.h"
+#include "Concurrent/SpinLock.h"
 #include "CommandBuffer.h"
 
 namespace glacier {
@@ -14,8 +17,6 @@ class GfxDriver;
 
 class CommandQueue {
 public:
-    using CommandBufferEntry = std::tuple<uint64_t, CommandBuffer*>;
-
     CommandQueue(GfxDriver* driver, CommandBufferType type);
     virtual ~CommandQueue() {}
 
@@ -27,6 +28,8 @@ public:
     virtual uint64_t GetCompletedFenceValue() = 0;
     virtual bool IsFenceComplete(uint64_t fenceValue ) = 0;
     virtual void WaitForFenceValue(uint64_t fenceValue) = 0;
+    //callback runs on a thread of the queue once fenceValue completed, it should only hand work off
+    virtual void OnFenceComplete(uint64_t fenceValue, std::function<void()>&& callback) = 0;
 
     virtual void Flush() = 0;
 
@@ -44,12 +47,21 @@ protected:
 
     GfxDriver* driver_ = nullptr;
     CommandBufferType type_;
-    uint64_t current_fence_value = 0;
-
-    concurrent::ThreadSafeQueue<std::unique_ptr<CommandBuffer>> command_list_pool_;
-
-    concurrent::ThreadSafeQueue<CommandBufferEntry> inflight_command_lists_;
-    concurrent::ThreadSafeQueue<CommandBuffer*> available_command_lists_;
+    //read by any thread, fence values are taken and signaled under the lock so the
+    //queue sees them in increasing order whichever thread submits
+    std::atomic<uint64_t> current_fence_value = 0;
+    concurrent::SpinLock signal_lock_;
+
+    //owns every buffer created, only touched when the queues run dry
+    std::mutex pool_lock_;
+    std::vector<std::unique_ptr<CommandBuffer>> command_list_pool_;
+
+    //Submitting threads push without locking, the consumer locks are only taken by consumers:
+    //one thread recycles the inflight buffers at a time, the others skip it
+    concurrent::MPSCQueue<CommandBuffer> inflight_command_lists_; //in submission order, see GetFenceValue
+    concurrent::SpinLock inflight_lock_;
+    concurrent::MPSCQueue<CommandBuffer> available_command_lists_;
+    concurrent::SpinLock available_lock_;
 };
 
 }
@@ -84,6 +84,10 @@ void PerfStats::DrawStatsPanel(CommandBuffer* cmd_buffer) {
     ImGui::Text("Frame Time:"); ImGui::SameLine(kLabelWidth);
     ImGui::Text("%.4fms", elapsed_time * 1000.0f);
 
+    //hitches don't show in the averages
+    ImGui::Text("Frame p95/p99:"); ImGui::SameLine(kLabelWidth);
+    ImGui::Text("%.4fms / %.4fms", cpu_stats_.p95() * 1000.0f, cpu_stats_.p99() * 1000.0f);
+
     elapsed_time = gpu_time_;
     if (elapsed_time == 0.0) {
         auto result = frame_query_->GetQueryResult(cmd_buffer);
@@ -95,6 +99,9 @@ void PerfStats::DrawStatsPanel(CommandBuffer* cmd_buffer) {
     ImGui::Text("GPU Frame Time:"); ImGui::SameLine(kLabelWidth);
     ImGui::Text("%.4fms", elapsed_time * 1000.0f);
 
+    ImGui::Text("GPU p95/p99:"); ImGui::SameLine(kLabelWidth);
+    ImGui::Text("%.4fms / %.4fms", gpu_stats_.p95() * 1000.0f, gpu_stats_.p99() * 1000.0f);
+
     auto result = primitiv_query_->GetQueryResult(cmd_buffer);
 
     ImGui::Text("Render Vertices:"); ImGui::SameLine(kLabelWidth);
@@ -12,6 +12,8 @@ class CommandBuffer;
 
 class PerfStats {
 public:
+    static constexpr uint32_t kFrameHistory = 300; //frames kept for the percentiles
+
     PerfStats(GfxDriver* gfx);
 
     void PreRender(CommandBuffer* cmd_buffer);
@@ -22,6 +24,7 @@ public:
 protected:
     void Reset();
 
+    //averages over the last second
     double cpu_time_ = 0.0;
     double gpu_time_ = 0.0;
     double accum_time_ = 0.0;
@@ -30,8 +33,8 @@ protected:
     std::shared_ptr<Query> primitiv_query_;
     Timer timer_;
 
-    Statistic gpu_stats_;
-    Statistic cpu_stats_;
+    Statistic gpu_stats_{ kFrameHistory };
+    Statistic cpu_stats_{ kFrameHistory };
 };
 
 }
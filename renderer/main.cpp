@@ -1,15 +1,26 @@
 
+#include <stdio.h>
+#include <string>
+#include "Jobs/JobSystem.h"
+#include "Bench/Bench.h"
+
+#ifdef _WIN32
 #include "App.h"
 #include "Lux/VM.h"
 #include "Common/Util.h"
 #include "Common/Log.h"
-#include "Jobs/JobSystem.h"
 
 int CALLBACK WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, 
     LPSTR lpCmdLine, int nCmdShow) 
 {
     using namespace glacier;
 
+    //headless: "-bench [suite] [-threads n] [-unpinned] [-out path]"
+    bench::BenchOptions bench_options;
+    if (bench::ParseBenchOptions(lpCmdLine, bench_options)) {
+        return bench::RunBench(bench_options);
+    }
+
     jobs::JobSystem::Instance()->Initialize(4);
     App app{};
 
@@ -21,3 +32,27 @@ int CALLBACK WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance,
 
     return 0;
 }
+
+#else
+
+//the renderer needs d3d12, elsewhere only the headless benchmarks (jobs, physics) run
+int main(int argc, char** argv) {
+    using namespace glacier;
+
+    std::string cmd_line;
+    for (int i = 1; i < argc; ++i) {
+        cmd_line += " \"";
+        cmd_line += argv[i];
+        cmd_line += '"';
+    }
+
+    bench::BenchOptions bench_options;
+    if (bench::ParseBenchOptions(cmd_line.c_str(), bench_options)) {
+        return bench::RunBench(bench_options);
+    }
+
+    fprintf(stderr, "usage: %s -bench [suite] [-threads n] [-unpinned] [-out path]\n", argc > 0 ? argv[0] : "glacier");
+    return 1;
+}
+
+#endif